@@ -0,0 +1,665 @@
+/**
+ *
+ * @brief      Typed results of the BrainyPi AI API endpoints.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <cstring>
+#include <iostream>
+
+#include <rapidjson/reader.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/error/en.h>
+
+#include "api_result.hpp"
+#include "trace.hpp"
+
+void ApiResult::clear()
+{
+	api_version.clear();
+	request_id = 0;
+	has_error = false;
+	error = ApiError();
+	faces.clear();
+	embeddings.clear();
+	objects.clear();
+	poses.clear();
+	classes.clear();
+	confidence = 0;
+}
+
+static void rescale_box(BoundingBox &box, float factor)
+{
+	box.top *= factor;
+	box.left *= factor;
+	box.width *= factor;
+	box.height *= factor;
+}
+
+static void rescale_face(Face &face, float factor)
+{
+	rescale_box(face.box, factor);
+	for (auto &landmark : face.landmarks) {
+		landmark.x *= factor;
+		landmark.y *= factor;
+	}
+}
+
+void ApiResult::rescale(double factor)
+{
+	float f = (float)factor;
+
+	if (f == 1.0f) {
+		return;
+	}
+	for (auto &face : faces) {
+		rescale_face(face, f);
+	}
+	for (auto &embedding : embeddings) {
+		rescale_face(embedding.face, f);
+	}
+	for (auto &object : objects) {
+		rescale_box(object.box, f);
+	}
+	for (auto &pose : poses) {
+		for (auto &point : pose.points) {
+			point.x *= f;
+			point.y *= f;
+		}
+	}
+}
+
+void ApiResult::merge(const ApiResult &other)
+{
+	if (api_version.empty()) {
+		api_version = other.api_version;
+		request_id = other.request_id;
+	}
+	if (other.has_error && !has_error) {
+		has_error = true;
+		error = other.error;
+	}
+	faces.insert(faces.end(), other.faces.begin(), other.faces.end());
+	embeddings.insert(embeddings.end(), other.embeddings.begin(),
+			  other.embeddings.end());
+	objects.insert(objects.end(), other.objects.begin(),
+		       other.objects.end());
+	poses.insert(poses.end(), other.poses.begin(), other.poses.end());
+	classes.insert(classes.end(), other.classes.begin(),
+		       other.classes.end());
+	if (other.confidence != 0) {
+		confidence = other.confidence;
+	}
+}
+
+typedef rapidjson::Writer<rapidjson::StringBuffer> JsonWriter;
+
+static void write_box(JsonWriter &w, const BoundingBox &box)
+{
+	w.Key("boundingBox");
+	w.StartObject();
+	w.Key("top");
+	w.Double(box.top);
+	w.Key("left");
+	w.Double(box.left);
+	w.Key("width");
+	w.Double(box.width);
+	w.Key("height");
+	w.Double(box.height);
+	w.EndObject();
+}
+
+static void write_face(JsonWriter &w, const Face &face)
+{
+	w.Key("confidence");
+	w.Double(face.confidence);
+	write_box(w, face.box);
+	w.Key("landmarks");
+	w.StartArray();
+	for (auto &landmark : face.landmarks) {
+		w.StartObject();
+		w.Key("type");
+		w.String(landmark.type.c_str());
+		w.Key("x");
+		w.Double(landmark.x);
+		w.Key("y");
+		w.Double(landmark.y);
+		w.EndObject();
+	}
+	w.EndArray();
+}
+
+std::string api_result_to_json(const ApiResult &result)
+{
+	rapidjson::StringBuffer buffer;
+	JsonWriter w(buffer);
+
+	w.SetMaxDecimalPlaces(4);
+	w.StartObject();
+	w.Key("apiVersion");
+	w.String(result.api_version.c_str());
+	w.Key("requestId");
+	w.Int64(result.request_id);
+	if (result.has_error) {
+		w.Key("error");
+		w.StartObject();
+		w.Key("code");
+		w.Int(result.error.code);
+		w.Key("message");
+		w.String(result.error.message.c_str());
+		w.EndObject();
+	}
+
+	w.Key("result");
+	w.StartObject();
+	if (!result.faces.empty() || !result.embeddings.empty()) {
+		w.Key("faces");
+		w.StartArray();
+		for (auto &face : result.faces) {
+			w.StartObject();
+			write_face(w, face);
+			w.EndObject();
+		}
+		for (auto &embedding : result.embeddings) {
+			w.StartObject();
+			write_face(w, embedding.face);
+			w.Key("embeddings");
+			w.StartArray();
+			for (float value : embedding.embeddings) {
+				w.Double(value);
+			}
+			w.EndArray();
+			w.EndObject();
+		}
+		w.EndArray();
+	}
+	if (!result.objects.empty()) {
+		w.Key("objects");
+		w.StartArray();
+		for (auto &object : result.objects) {
+			w.StartObject();
+			w.Key("object");
+			w.String(object.object.c_str());
+			w.Key("confidence");
+			w.Double(object.confidence);
+			write_box(w, object.box);
+			w.EndObject();
+		}
+		w.EndArray();
+	}
+	if (!result.poses.empty()) {
+		w.Key("poses");
+		w.StartArray();
+		for (auto &pose : result.poses) {
+			w.StartObject();
+			w.Key("points");
+			w.StartArray();
+			for (auto &point : pose.points) {
+				w.StartObject();
+				w.Key("x");
+				w.Double(point.x);
+				w.Key("y");
+				w.Double(point.y);
+				w.Key("confidence");
+				w.Double(point.confidence);
+				w.EndObject();
+			}
+			w.EndArray();
+			w.EndObject();
+		}
+		w.EndArray();
+	}
+	if (!result.classes.empty()) {
+		w.Key("classes");
+		w.StartArray();
+		for (auto &label : result.classes) {
+			w.StartObject();
+			w.Key("class");
+			w.String(label.label.c_str());
+			w.Key("confidence");
+			w.Double(label.confidence);
+			w.EndObject();
+		}
+		w.EndArray();
+	}
+	if (result.confidence != 0) {
+		w.Key("confidence");
+		w.Double(result.confidence);
+	}
+	w.EndObject();
+	w.EndObject();
+
+	return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+/**
+ * @brief      SAX handler filling an ApiResult.
+ *
+ *             Tracks which container is open and which key was read last,
+ *             and writes every value straight into its typed field.
+ *             Unknown members and containers are skipped.
+ */
+class ApiResultHandler {
+public:
+	explicit ApiResultHandler(ApiResult &result) : result_(result) {}
+
+	bool Null() { return value_done(); }
+	bool Bool(bool) { return value_done(); }
+	bool Int(int i) { return number(i); }
+	bool Uint(unsigned u) { return number(u); }
+	bool Int64(int64_t i) { return number((double)i); }
+	bool Uint64(uint64_t u) { return number((double)u); }
+	bool Double(double d) { return number(d); }
+	bool RawNumber(const char *, rapidjson::SizeType, bool)
+	{
+		return value_done();
+	}
+	bool String(const char *str, rapidjson::SizeType length, bool);
+	bool Key(const char *str, rapidjson::SizeType length, bool);
+	bool StartObject();
+	bool EndObject(rapidjson::SizeType);
+	bool StartArray();
+	bool EndArray(rapidjson::SizeType);
+
+private:
+	enum State {
+		DOCUMENT,
+		ROOT,
+		ERROR_OBJECT,
+		RESULT,
+		FACES,
+		FACE,
+		BOX,
+		LANDMARKS,
+		LANDMARK,
+		EMBEDDINGS,
+		OBJECTS,
+		OBJECT,
+		POSES,
+		POSE,
+		POINTS,
+		POINT,
+		CLASSES,
+		CLASS,
+		SKIP
+	};
+
+	enum Field {
+		NONE,
+		API_VERSION,
+		REQUEST_ID,
+		RESULT_KEY,
+		ERROR_KEY,
+		CODE,
+		MESSAGE,
+		FACES_KEY,
+		OBJECTS_KEY,
+		POSES_KEY,
+		CLASSES_KEY,
+		CONFIDENCE,
+		BOUNDING_BOX,
+		TOP,
+		LEFT,
+		WIDTH,
+		HEIGHT,
+		LANDMARKS_KEY,
+		TYPE,
+		X,
+		Y,
+		EMBEDDINGS_KEY,
+		OBJECT_KEY,
+		POINTS_KEY,
+		CLASS_KEY
+	};
+
+	bool number(double value);
+	bool value_done()
+	{
+		key_ = NONE;
+		return true;
+	}
+	bool open(State state)
+	{
+		stack_.push_back(state);
+		key_ = NONE;
+		return true;
+	}
+	State top() const { return stack_.back(); }
+	State child(bool object) const;
+	BoundingBox &box();
+
+	ApiResult &result_;
+	std::vector<State> stack_{ DOCUMENT };
+	Field key_ = NONE;
+	bool face_has_embeddings_ = false;
+};
+
+bool ApiResultHandler::Key(const char *str, rapidjson::SizeType length, bool)
+{
+	static const struct {
+		const char *name;
+		Field field;
+	} fields[] = {
+		{ "apiVersion", API_VERSION },	{ "requestId", REQUEST_ID },
+		{ "result", RESULT_KEY },	{ "error", ERROR_KEY },
+		{ "code", CODE },		{ "message", MESSAGE },
+		{ "faces", FACES_KEY },		{ "objects", OBJECTS_KEY },
+		{ "poses", POSES_KEY },		{ "classes", CLASSES_KEY },
+		{ "confidence", CONFIDENCE },	{ "boundingBox", BOUNDING_BOX },
+		{ "top", TOP },			{ "left", LEFT },
+		{ "width", WIDTH },		{ "height", HEIGHT },
+		{ "landmarks", LANDMARKS_KEY }, { "type", TYPE },
+		{ "x", X },			{ "y", Y },
+		{ "embeddings", EMBEDDINGS_KEY }, { "object", OBJECT_KEY },
+		{ "points", POINTS_KEY },	{ "class", CLASS_KEY },
+	};
+
+	key_ = NONE;
+	if (top() == SKIP) {
+		return true;
+	}
+	for (auto &f : fields) {
+		if (std::strlen(f.name) == length &&
+		    std::memcmp(f.name, str, length) == 0) {
+			key_ = f.field;
+			break;
+		}
+	}
+	return true;
+}
+
+ApiResultHandler::State ApiResultHandler::child(bool object) const
+{
+	switch (top()) {
+	case DOCUMENT:
+		return object ? ROOT : SKIP;
+	case ROOT:
+		if (object && key_ == RESULT_KEY) {
+			return RESULT;
+		}
+		if (object && key_ == ERROR_KEY) {
+			return ERROR_OBJECT;
+		}
+		return SKIP;
+	case RESULT:
+		if (object) {
+			return SKIP;
+		}
+		switch (key_) {
+		case FACES_KEY:
+			return FACES;
+		case OBJECTS_KEY:
+			return OBJECTS;
+		case POSES_KEY:
+			return POSES;
+		case CLASSES_KEY:
+			return CLASSES;
+		default:
+			return SKIP;
+		}
+	case FACES:
+		return object ? FACE : SKIP;
+	case FACE:
+		if (object && key_ == BOUNDING_BOX) {
+			return BOX;
+		}
+		if (!object && key_ == LANDMARKS_KEY) {
+			return LANDMARKS;
+		}
+		if (!object && key_ == EMBEDDINGS_KEY) {
+			return EMBEDDINGS;
+		}
+		return SKIP;
+	case LANDMARKS:
+		return object ? LANDMARK : SKIP;
+	case OBJECTS:
+		return object ? OBJECT : SKIP;
+	case OBJECT:
+		return (object && key_ == BOUNDING_BOX) ? BOX : SKIP;
+	case POSES:
+		return object ? POSE : SKIP;
+	case POSE:
+		return (!object && key_ == POINTS_KEY) ? POINTS : SKIP;
+	case POINTS:
+		return object ? POINT : SKIP;
+	case CLASSES:
+		return object ? CLASS : SKIP;
+	default:
+		return SKIP;
+	}
+}
+
+bool ApiResultHandler::StartObject()
+{
+	State state = child(true);
+
+	switch (state) {
+	case FACE:
+		/* Parse into the embedding list so the values land in their
+		 * final vector, moved to faces at the end if there are none */
+		result_.embeddings.emplace_back();
+		result_.embeddings.back().embeddings.reserve(
+			FACE_EMBEDDING_DIM);
+		face_has_embeddings_ = false;
+		break;
+	case LANDMARK:
+		result_.embeddings.back().face.landmarks.emplace_back();
+		break;
+	case OBJECT:
+		result_.objects.emplace_back();
+		break;
+	case POSE:
+		result_.poses.emplace_back();
+		break;
+	case POINT:
+		result_.poses.back().points.emplace_back();
+		break;
+	case CLASS:
+		result_.classes.emplace_back();
+		break;
+	case ERROR_OBJECT:
+		result_.has_error = true;
+		break;
+	default:
+		break;
+	}
+	return open(state);
+}
+
+bool ApiResultHandler::EndObject(rapidjson::SizeType)
+{
+	if (top() == FACE && !face_has_embeddings_) {
+		result_.faces.push_back(
+			std::move(result_.embeddings.back().face));
+		result_.embeddings.pop_back();
+	}
+	stack_.pop_back();
+	return value_done();
+}
+
+bool ApiResultHandler::StartArray()
+{
+	State state = child(false);
+
+	if (state == EMBEDDINGS) {
+		face_has_embeddings_ = true;
+	}
+	return open(state);
+}
+
+bool ApiResultHandler::EndArray(rapidjson::SizeType)
+{
+	stack_.pop_back();
+	return value_done();
+}
+
+BoundingBox &ApiResultHandler::box()
+{
+	/* The box belongs to the container below it */
+	State owner = stack_[stack_.size() - 2];
+
+	if (owner == FACE) {
+		return result_.embeddings.back().face.box;
+	}
+	return result_.objects.back().box;
+}
+
+bool ApiResultHandler::number(double value)
+{
+	float v = (float)value;
+
+	switch (top()) {
+	case ROOT:
+		if (key_ == REQUEST_ID) {
+			result_.request_id = (int64_t)value;
+		}
+		break;
+	case ERROR_OBJECT:
+		if (key_ == CODE) {
+			result_.error.code = (int)value;
+		}
+		break;
+	case RESULT:
+		if (key_ == CONFIDENCE) {
+			result_.confidence = v;
+		}
+		break;
+	case FACE:
+		if (key_ == CONFIDENCE) {
+			result_.embeddings.back().face.confidence = v;
+		}
+		break;
+	case BOX:
+		switch (key_) {
+		case TOP:
+			box().top = v;
+			break;
+		case LEFT:
+			box().left = v;
+			break;
+		case WIDTH:
+			box().width = v;
+			break;
+		case HEIGHT:
+			box().height = v;
+			break;
+		default:
+			break;
+		}
+		break;
+	case LANDMARK:
+		if (key_ == X) {
+			result_.embeddings.back().face.landmarks.back().x = v;
+		} else if (key_ == Y) {
+			result_.embeddings.back().face.landmarks.back().y = v;
+		}
+		break;
+	case EMBEDDINGS:
+		result_.embeddings.back().embeddings.push_back(v);
+		break;
+	case OBJECT:
+		if (key_ == CONFIDENCE) {
+			result_.objects.back().confidence = v;
+		}
+		break;
+	case POINT:
+		if (key_ == X) {
+			result_.poses.back().points.back().x = v;
+		} else if (key_ == Y) {
+			result_.poses.back().points.back().y = v;
+		} else if (key_ == CONFIDENCE) {
+			result_.poses.back().points.back().confidence = v;
+		}
+		break;
+	case CLASS:
+		if (key_ == CONFIDENCE) {
+			result_.classes.back().confidence = v;
+		}
+		break;
+	default:
+		break;
+	}
+	return value_done();
+}
+
+bool ApiResultHandler::String(const char *str, rapidjson::SizeType length,
+			      bool)
+{
+	switch (top()) {
+	case ROOT:
+		if (key_ == API_VERSION) {
+			result_.api_version.assign(str, length);
+		}
+		break;
+	case ERROR_OBJECT:
+		if (key_ == MESSAGE) {
+			result_.error.message.assign(str, length);
+		}
+		break;
+	case LANDMARK:
+		if (key_ == TYPE) {
+			result_.embeddings.back().face.landmarks.back().type.assign(
+				str, length);
+		}
+		break;
+	case OBJECT:
+		if (key_ == OBJECT_KEY) {
+			result_.objects.back().object.assign(str, length);
+		}
+		break;
+	case CLASS:
+		if (key_ == CLASS_KEY) {
+			result_.classes.back().label.assign(str, length);
+		}
+		break;
+	default:
+		break;
+	}
+	return value_done();
+}
+
+bool parse_api_result(std::string &json, ApiResult &result)
+{
+	TraceSpan span(TRACE_PARSE);
+	result.clear();
+	if (json.empty()) {
+		result.has_error = true;
+		result.error.message = "Empty response";
+		return false;
+	}
+
+	ApiResultHandler handler(result);
+	rapidjson::Reader reader;
+	rapidjson::InsituStringStream stream(&json[0]);
+	rapidjson::ParseResult ok =
+		reader.Parse<rapidjson::kParseInsituFlag>(stream, handler);
+
+	if (!ok) {
+		result.clear();
+		result.has_error = true;
+		result.error.message =
+			std::string(rapidjson::GetParseError_En(ok.Code())) +
+			" (offset " + std::to_string(ok.Offset()) + ")";
+		return false;
+	}
+	return true;
+}
+
+bool parse_api_result_or_report(std::string &json, ApiResult &result)
+{
+	if (!parse_api_result(json, result)) {
+		std::cerr
+			<< "Error: Failed to parse JSON output from API server. "
+			<< result.error.message << std::endl;
+		return false;
+	}
+	if (result.has_error) {
+		std::cerr << "Error: Server returned error\nCode: "
+			  << result.error.code
+			  << "\nReason: " << result.error.message << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,142 @@
+/**
+ *
+ * @brief      Typed results of the BrainyPi AI API endpoints.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef API_RESULT_HPP
+#define API_RESULT_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Length of the face embeddings returned by /v1/face2embedding */
+#define FACE_EMBEDDING_DIM 128
+
+struct BoundingBox {
+	float top = 0;
+	float left = 0;
+	float width = 0;
+	float height = 0;
+};
+
+struct Landmark {
+	std::string type;
+	float x = 0;
+	float y = 0;
+};
+
+/* Entry of /v1/detectface */
+struct Face {
+	float confidence = 0;
+	BoundingBox box;
+	std::vector<Landmark> landmarks;
+};
+
+/* Entry of /v1/face2embedding */
+struct FaceEmbedding {
+	Face face;
+	std::vector<float> embeddings;
+};
+
+/* Entry of /v1/detectobjects */
+struct DetectedObject {
+	std::string object;
+	float confidence = 0;
+	BoundingBox box;
+};
+
+struct PosePoint {
+	float x = 0;
+	float y = 0;
+	float confidence = 0;
+};
+
+/* Entry of /v1/estimatepose */
+struct Pose {
+	std::vector<PosePoint> points;
+};
+
+/* Entry of /v1/classifyimage */
+struct ClassLabel {
+	std::string label;
+	float confidence = 0;
+};
+
+struct ApiError {
+	int code = 0;
+	std::string message;
+};
+
+/**
+ * @brief      Parsed response of any endpoint.
+ *
+ *             Only the member matching the endpoint is filled. A result
+ *             can be reused across responses to keep its allocations.
+ */
+struct ApiResult {
+	std::string api_version;
+	int64_t request_id = 0;
+	bool has_error = false; /* Server error or unparsable response */
+	ApiError error;
+
+	std::vector<Face> faces;
+	std::vector<FaceEmbedding> embeddings;
+	std::vector<DetectedObject> objects;
+	std::vector<Pose> poses;
+	std::vector<ClassLabel> classes;
+	float confidence = 0; /* /v1/compareface */
+
+	void clear();
+
+	/**
+	 * @brief      Scale all image coordinates by a factor.
+	 *
+	 *             Maps results of a downscaled upload back to the
+	 *             original image, see ApiSession::detect_face().
+	 */
+	void rescale(double factor);
+
+	/**
+	 * @brief      Append the entries of another result.
+	 *
+	 *             Combines the responses of several endpoints for the
+	 *             same image into one record.
+	 */
+	void merge(const ApiResult &other);
+};
+
+/**
+ * @brief      Parse a response in a single pass, without building a DOM.
+ *
+ *             The buffer is parsed in place and is modified.
+ *
+ * @param      json    Response body
+ * @param      result  Parsed result, cleared first
+ *
+ * @return     false if the body is not valid JSON; result.error.message
+ *             then describes the problem
+ */
+bool parse_api_result(std::string &json, ApiResult &result);
+
+/**
+ * @brief      Parse a response and print the error if there is one.
+ *
+ * @param      json    Response body, modified
+ * @param      result  Parsed result
+ *
+ * @return     false if the response is unparsable or a server error
+ */
+bool parse_api_result_or_report(std::string &json, ApiResult &result);
+
+/**
+ * @brief      Write a result in the response format of openapi.yaml.
+ *
+ *             Members without entries are left out, so a merged result
+ *             holds the "result" members of every endpoint it came from.
+ */
+std::string api_result_to_json(const ApiResult &result);
+
+#endif
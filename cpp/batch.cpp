@@ -0,0 +1,139 @@
+/**
+ *
+ * @brief      Batch driver running an image example over many images.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "batch.hpp"
+#include "output.hpp"
+
+static bool has_extension(const std::filesystem::path &path,
+			  std::initializer_list<const char *> extensions)
+{
+	std::string ext = path.extension().string();
+
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	for (auto e : extensions) {
+		if (ext == e) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool is_batch_input(const std::string &input)
+{
+	return std::filesystem::is_directory(input) ||
+	       has_extension(input, { ".txt", ".lst" });
+}
+
+std::vector<std::string> list_images(const std::string &input)
+{
+	std::vector<std::string> images;
+
+	if (std::filesystem::is_directory(input)) {
+		for (auto &entry : std::filesystem::directory_iterator(input)) {
+			if (entry.is_regular_file() &&
+			    has_extension(entry.path(),
+					  { ".jpg", ".jpeg", ".png", ".bmp" })) {
+				images.push_back(entry.path().string());
+			}
+		}
+		std::sort(images.begin(), images.end());
+		return images;
+	}
+
+	std::ifstream list(input);
+	std::string line;
+	while (std::getline(list, line)) {
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+		if (!line.empty()) {
+			images.push_back(line);
+		}
+	}
+	return images;
+}
+
+size_t run_batch(ApiSession &session, const std::vector<std::string> &images,
+		 size_t workers, const ImageJob &job)
+{
+	std::atomic<size_t> next(0);
+	std::atomic<size_t> done(0);
+	std::vector<std::thread> threads;
+	auto start = std::chrono::steady_clock::now();
+
+	workers = std::max<size_t>(1, std::min(workers, images.size()));
+	for (size_t i = 0; i < workers; i++) {
+		threads.emplace_back([&] {
+			size_t n;
+			while ((n = next++) < images.size()) {
+				std::string path = images[n];
+				job(session, path, true);
+				done++;
+			}
+		});
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	double seconds = std::chrono::duration<double>(
+				 std::chrono::steady_clock::now() - start)
+				 .count();
+	std::cout << "Processed " << done << " images in " << seconds
+		  << " s with " << workers << " workers ("
+		  << (seconds > 0 ? done / seconds : 0) << " images/s)"
+		  << std::endl;
+	return done;
+}
+
+int run_image_example(int argc, char **argv, const std::string &url,
+		      const std::string &default_input, const ImageJob &job)
+{
+	std::string input = argc > 1 ? argv[1] : default_input;
+	size_t workers = BATCH_DEFAULT_WORKERS;
+	ApiSessionOptions options;
+
+	if (argc > 2) {
+		workers = std::max(1, std::atoi(argv[2]));
+	}
+
+	if (!is_batch_input(input)) {
+		ApiSession session(url, options);
+
+		std::cout << "Starting client..." << std::endl;
+		job(session, input, false);
+		finish_outputs(true);
+		return 0;
+	}
+
+	std::vector<std::string> images = list_images(input);
+	if (images.empty()) {
+		std::cerr << "Error: No images found in " << input
+			  << std::endl;
+		return 1;
+	}
+
+	/* One request in flight per worker */
+	options.max_in_flight = workers;
+	options.max_connections_per_host =
+		std::max<int>(options.max_connections_per_host, workers);
+	ApiSession session(url, options);
+
+	std::cout << "Starting client on " << images.size() << " images..."
+		  << std::endl;
+	run_batch(session, images, workers, job);
+	finish_outputs(false);
+	return 0;
+}
@@ -0,0 +1,81 @@
+/**
+ *
+ * @brief      Batch driver running an image example over many images.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "helper.hpp"
+
+/* Workers of a batch run if none is given on the command line */
+#define BATCH_DEFAULT_WORKERS 4
+
+/**
+ * @brief      Work done for one image.
+ *
+ *             Called concurrently from several workers, so it must only
+ *             share thread safe state such as the ApiSession.
+ *
+ * @param      session     Connection to the API server
+ * @param      image_path  Image to process
+ * @param      batch       Whether the image is one of a batch rather than
+ *                         the single image given on the command line
+ */
+typedef std::function<void(ApiSession &session, std::string &image_path,
+			   bool batch)>
+	ImageJob;
+
+/**
+ * @brief      Whether an input names a batch rather than a single image.
+ *
+ * @return     true for a directory or a .txt/.lst file list
+ */
+bool is_batch_input(const std::string &input);
+
+/**
+ * @brief      Collect the images of a batch.
+ *
+ * @param[in]  input  Directory (its image files, sorted by name) or a file
+ *                    list with one path per line
+ */
+std::vector<std::string> list_images(const std::string &input);
+
+/**
+ * @brief      Run a job on every image with a pool of workers.
+ *
+ *             Each worker takes the next image, so decoding, encoding,
+ *             the request in flight and rendering of different images
+ *             overlap. Results are saved and shown in the background (see
+ *             output.hpp), the reported time leaves out writes still
+ *             queued when the last request is done.
+ *
+ * @return     Number of images processed
+ */
+size_t run_batch(ApiSession &session, const std::vector<std::string> &images,
+		 size_t workers, const ImageJob &job);
+
+/**
+ * @brief      Command line front-end shared by the image examples.
+ *
+ *             Usage: example [input] [workers]
+ *
+ *             input is an image, a directory or a file list and defaults
+ *             to default_input. A single image is processed and its
+ *             result held on screen until a key is pressed; a batch runs
+ *             on workers threads (default BATCH_DEFAULT_WORKERS) with the
+ *             preview showing the latest result. Both wait for the queued
+ *             outputs before returning.
+ *
+ * @return     Exit code for main()
+ */
+int run_image_example(int argc, char **argv, const std::string &url,
+		      const std::string &default_input, const ImageJob &job);
+
+#endif
@@ -0,0 +1,464 @@
+/**
+ * @brief      Client throughput and latency benchmark against a mock server.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "api_result.hpp"
+#include "helper.hpp"
+#include "mock_server.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+/* Heap allocations made by the benchmark process */
+static std::atomic<size_t> allocations(0);
+
+void *operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+/**
+ * @brief      Benchmark settings, see usage().
+ */
+struct BenchOptions {
+	std::string endpoint = API_DETECT_OBJECTS;
+	std::string image = "../sample_inputs/images/car.jpg";
+	std::string server;	/* Real servers, empty starts mock ones */
+	int concurrency = 4;	/* Closed loop: requests kept in flight */
+	double rate = 0;	/* Open loop: requests per second */
+	int requests = 500;
+	int warmup = 20;
+	int mock_servers = 1;	/* Mock nodes on consecutive ports */
+	int slow_ms = 0;	/* Extra latency of the first mock node */
+	int hedge_ms = 0;
+	int timeout_ms = 0;
+	bool adaptive = true;	/* Adaptive window, else a fixed one */
+	MockServerOptions mock;
+};
+
+/**
+ * @brief      Latencies and resource use of one run.
+ */
+struct BenchStats {
+	std::mutex mutex;
+	std::vector<double> latency_ms;
+	size_t errors = 0;
+
+	void add(double ms, bool ok)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		latency_ms.push_back(ms);
+		if (!ok) {
+			errors++;
+		}
+	}
+};
+
+static double elapsed_ms(Clock::time_point since)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - since)
+		.count();
+}
+
+static double cpu_seconds()
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+	       (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t i = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(i, sorted.size() - 1)];
+}
+
+/**
+ * @brief      Draw a result the way the examples do.
+ */
+static void render(cv::Mat &frame, const ApiResult &result)
+{
+	for (auto &face : result.faces) {
+		draw_bounding_box(frame, face.box.left, face.box.top,
+				  face.box.width, face.box.height);
+	}
+	for (auto &embedding : result.embeddings) {
+		const BoundingBox &box = embedding.face.box;
+		draw_bounding_box(frame, box.left, box.top, box.width,
+				  box.height);
+	}
+	for (auto &object : result.objects) {
+		draw_bounding_box(frame, object.box.left, object.box.top,
+				  object.box.width, object.box.height);
+		draw_label(frame,
+			   object.object + " " +
+				   std::to_string(object.confidence),
+			   object.box.left, object.box.top);
+	}
+	for (auto &pose : result.poses) {
+		for (auto &point : pose.points) {
+			cv::circle(frame, cv::Point2f(point.x, point.y), 3,
+				   cv::Scalar(0, 255, 0), -1);
+		}
+	}
+	for (auto &cls : result.classes) {
+		draw_label(frame, cls.label, 0, 0);
+	}
+}
+
+/**
+ * @brief      Request body and completion work of one benchmark request.
+ */
+class BenchRequest {
+public:
+	BenchRequest(ApiSession &session, const BenchOptions &options,
+		     const cv::Mat &image)
+		: session_(session), options_(options), image_(image)
+	{
+		if (options.endpoint == API_COMPARE_FACE) {
+			std::vector<float> face(FACE_EMBEDDING_DIM, 0.01f);
+			compare_body_ = compare_face_body(face, face);
+		}
+	}
+
+	/**
+	 * @brief      Encode and send one request.
+	 *
+	 * @param[in]  done  Receives the parsed result
+	 */
+	void send(const std::function<void(bool ok)> &done)
+	{
+		std::string body = compare_body_;
+		double scale = 1.0;
+
+		if (body.empty()) {
+			scale = encode_upload(image_, session_.upload_options(),
+					      body);
+		}
+		session_.post(options_.endpoint, std::move(body),
+			      [this, scale, done](ApiResponse &response) {
+				      done(complete(response, scale));
+			      });
+	}
+
+private:
+	bool complete(ApiResponse &response, double scale)
+	{
+		thread_local ApiResult result;
+		thread_local cv::Mat frame;
+
+		if (response.code != 200 ||
+		    !parse_api_result(response.body, result) ||
+		    result.has_error) {
+			return false;
+		}
+		result.rescale(scale);
+		image_.copyTo(frame);
+		render(frame, result);
+		return true;
+	}
+
+	ApiSession &session_;
+	const BenchOptions &options_;
+	const cv::Mat &image_;
+	std::string compare_body_;
+};
+
+/**
+ * @brief      Keep options.concurrency requests in flight.
+ */
+static void run_closed_loop(BenchRequest &request, int count, int concurrency,
+			    BenchStats *stats)
+{
+	std::atomic<int> next(0);
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < concurrency; i++) {
+		threads.emplace_back([&] {
+			while (next++ < count) {
+				std::promise<bool> result;
+				auto start = Clock::now();
+				request.send([&result](bool ok) {
+					result.set_value(ok);
+				});
+				bool ok = result.get_future().get();
+				if (stats) {
+					stats->add(elapsed_ms(start), ok);
+				}
+			}
+		});
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+}
+
+/**
+ * @brief      Start requests at a fixed rate whatever the response time.
+ *
+ *             Latency is measured from the scheduled start, so a client
+ *             that falls behind is charged for its queueing delay.
+ */
+static void run_open_loop(ApiSession &session, BenchRequest &request,
+			  int count, double rate, BenchStats *stats)
+{
+	auto interval = std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>(1.0 / rate));
+	auto due = Clock::now();
+
+	for (int i = 0; i < count; i++) {
+		std::this_thread::sleep_until(due);
+		auto start = due;
+		request.send([stats, start](bool ok) {
+			if (stats) {
+				stats->add(elapsed_ms(start), ok);
+			}
+		});
+		due += interval;
+	}
+	session.wait_idle();
+}
+
+static void usage(const char *prog)
+{
+	std::cerr
+		<< "Usage: " << prog << " [options]\n"
+		<< "  --endpoint PATH    e.g. /v1/detectface (default "
+		<< API_DETECT_OBJECTS << ")\n"
+		<< "  --image FILE       image to upload\n"
+		<< "  --requests N       measured requests (default 500)\n"
+		<< "  --concurrency N    closed loop, requests in flight (default 4)\n"
+		<< "  --rate R           open loop, requests per second\n"
+		<< "  --server URLS      benchmark real servers (comma separated)\n"
+		<< "  --mock-servers N   number of mock nodes (default 1)\n"
+		<< "  --slow-node MS     extra latency of the first mock node\n"
+		<< "  --hedge MS         hedge requests slower than MS\n"
+		<< "  --timeout MS       request timeout\n"
+		<< "  --adaptive 0|1     adapt the request window (default 1)\n"
+		<< "  --latency MS       mock inference time (default 20)\n"
+		<< "  --jitter MS        mock extra random latency (default 0)\n"
+		<< "  --capacity N       mock answers 429 above N requests\n"
+		<< "  --faces N          mock faces per result (default 3)\n"
+		<< std::endl;
+}
+
+static bool parse_args(int argc, char **argv, BenchOptions &options)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			return false;
+		}
+		std::string value = argv[++i];
+		if (arg == "--endpoint") {
+			options.endpoint = value;
+		} else if (arg == "--image") {
+			options.image = value;
+		} else if (arg == "--requests") {
+			options.requests = std::atoi(value.c_str());
+		} else if (arg == "--concurrency") {
+			options.concurrency = std::max(1, std::atoi(value.c_str()));
+		} else if (arg == "--rate") {
+			options.rate = std::atof(value.c_str());
+		} else if (arg == "--server") {
+			options.server = value;
+		} else if (arg == "--mock-servers") {
+			options.mock_servers = std::max(1, std::atoi(value.c_str()));
+		} else if (arg == "--slow-node") {
+			options.slow_ms = std::atoi(value.c_str());
+		} else if (arg == "--hedge") {
+			options.hedge_ms = std::atoi(value.c_str());
+		} else if (arg == "--timeout") {
+			options.timeout_ms = std::atoi(value.c_str());
+		} else if (arg == "--adaptive") {
+			options.adaptive = std::atoi(value.c_str()) != 0;
+		} else if (arg == "--capacity") {
+			options.mock.capacity = std::atoi(value.c_str());
+		} else if (arg == "--latency") {
+			options.mock.latency_ms = std::atoi(value.c_str());
+		} else if (arg == "--jitter") {
+			options.mock.jitter_ms = std::atoi(value.c_str());
+		} else if (arg == "--faces") {
+			options.mock.faces = std::atoi(value.c_str());
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	BenchOptions options;
+	std::vector<pid_t> server_pids;
+
+	if (!parse_args(argc, argv, options)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	cv::Mat image = cv::imread(options.image);
+	if (image.empty()) {
+		std::cerr << "Error: Cannot read " << options.image << std::endl;
+		return 1;
+	}
+
+	if (options.server.empty()) {
+		/* Serve from child processes so their CPU time and
+		 * allocations are not charged to the client */
+		for (int i = 0; i < options.mock_servers; i++) {
+			MockServerOptions mock = options.mock;
+			mock.port += i;
+			if (i == 0) {
+				mock.latency_ms += options.slow_ms;
+			}
+			MockServer server(mock);
+			options.server += (i ? "," : "") + server.url();
+			pid_t pid = fork();
+			if (pid == 0) {
+				server.start();
+				pause();
+				_exit(0);
+			}
+			server_pids.push_back(pid);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(300));
+	}
+
+	ApiSessionOptions session_options;
+	/* In open loop the adaptive window finds its own size */
+	session_options.adaptive = options.adaptive;
+	session_options.max_in_flight =
+		options.rate > 0 ? (options.adaptive ? 4 : 64) :
+				   options.concurrency;
+	session_options.max_limit =
+		std::max<size_t>(session_options.max_in_flight, 64);
+	session_options.max_connections_per_host =
+		std::max<int>(session_options.max_connections_per_host,
+			      session_options.max_limit);
+	session_options.hedge_ms = options.hedge_ms;
+	session_options.timeout_ms = options.timeout_ms;
+	int status = 0;
+	{
+		ApiSession session(options.server, session_options);
+		BenchRequest request(session, options, image);
+		BenchStats stats;
+
+		run_closed_loop(request, options.warmup, options.concurrency,
+				nullptr);
+
+		size_t allocs = allocations.load();
+		double cpu = cpu_seconds();
+		auto start = Clock::now();
+		if (options.rate > 0) {
+			run_open_loop(session, request, options.requests,
+				      options.rate, &stats);
+		} else {
+			run_closed_loop(request, options.requests,
+					options.concurrency, &stats);
+		}
+		double wall = elapsed_ms(start) / 1000.0;
+		cpu = cpu_seconds() - cpu;
+		allocs = allocations.load() - allocs;
+
+		std::vector<double> sorted = stats.latency_ms;
+		std::sort(sorted.begin(), sorted.end());
+		size_t n = std::max<size_t>(sorted.size(), 1);
+
+		std::cout << "endpoint     " << options.endpoint << "\n"
+			  << "mode         "
+			  << (options.rate > 0 ?
+				      "open loop, " +
+					      std::to_string(options.rate) +
+					      " req/s" :
+				      "closed loop, " +
+					      std::to_string(
+						      options.concurrency) +
+					      " in flight")
+			  << "\n"
+			  << "requests     " << sorted.size() << " ("
+			  << stats.errors << " errors)\n"
+			  << "throughput   " << sorted.size() / wall
+			  << " req/s\n"
+			  << "latency p50  " << percentile(sorted, 50)
+			  << " ms\n"
+			  << "latency p95  " << percentile(sorted, 95)
+			  << " ms\n"
+			  << "latency p99  " << percentile(sorted, 99)
+			  << " ms\n"
+			  << "cpu/request  " << cpu * 1000.0 / n << " ms\n"
+			  << "allocs/req   " << (double)allocs / n
+			  << std::endl;
+		for (auto &node : session.pool().stats()) {
+			std::cout << "node " << node.url << ": "
+				  << node.requests << " requests, "
+				  << node.failures << " failures, "
+				  << node.throttled << " throttled, "
+				  << node.latency_ms << " ms avg, window "
+				  << node.limit
+				  << (node.ejected ? ", ejected" : "")
+				  << std::endl;
+		}
+		status = stats.errors ? 1 : 0;
+	}
+
+	for (pid_t pid : server_pids) {
+		kill(pid, SIGTERM);
+		waitpid(pid, nullptr, 0);
+	}
+	return status;
+}
@@ -0,0 +1,198 @@
+/**
+ * @brief      Recall and latency of the face graph against the exhaustive
+ *             search.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "api_result.hpp"
+#include "face_index.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+/* Spread of the embeddings of one person around its centre */
+#define SAMPLE_NOISE 0.05f
+
+/* Photos enrolled per person */
+#define SAMPLES_PER_PERSON 4
+
+/* Code matches re-scored in float in int8+rerank mode */
+#define RERANK 32
+
+/**
+ * @brief      Synthetic gallery: people are random directions, their
+ *             photos noisy copies of it, like real face embeddings.
+ */
+struct Gallery {
+	std::vector<std::vector<float> > people;
+	std::minstd_rand rng{ 42 };
+	std::normal_distribution<float> normal{ 0, 1 };
+
+	explicit Gallery(size_t count)
+	{
+		people.resize(std::max<size_t>(count / SAMPLES_PER_PERSON, 1));
+		for (auto &p : people) {
+			p.resize(FACE_EMBEDDING_DIM);
+			for (auto &v : p) {
+				v = normal(rng) / std::sqrt(FACE_EMBEDDING_DIM);
+			}
+		}
+	}
+
+	void sample(size_t person, std::vector<float> &out)
+	{
+		out = people[person];
+		for (auto &v : out) {
+			v += SAMPLE_NOISE * normal(rng);
+		}
+	}
+};
+
+static double elapsed_us(Clock::time_point since)
+{
+	return std::chrono::duration<double, std::micro>(Clock::now() - since)
+		.count();
+}
+
+struct Run {
+	double avg_us = 0, p99_us = 0;
+	double recall1 = 0, recall10 = 0;
+};
+
+template <typename Search>
+static Run measure(const std::vector<std::vector<float> > &queries,
+		   const std::vector<std::vector<FaceMatch> > &truth,
+		   Search search)
+{
+	std::vector<double> us;
+	Run run;
+
+	for (size_t q = 0; q < queries.size(); q++) {
+		auto start = Clock::now();
+		std::vector<FaceMatch> found = search(queries[q].data());
+		us.push_back(elapsed_us(start));
+
+		if (truth.empty()) {
+			continue;
+		}
+		const std::vector<FaceMatch> &exact = truth[q];
+		run.recall1 += !found.empty() && found[0].id == exact[0].id;
+		size_t hits = 0;
+		for (auto &e : exact) {
+			for (auto &f : found) {
+				hits += f.id == e.id;
+			}
+		}
+		run.recall10 += (double)hits / exact.size();
+	}
+
+	std::sort(us.begin(), us.end());
+	for (double x : us) {
+		run.avg_us += x / us.size();
+	}
+	run.p99_us = us[us.size() * 99 / 100];
+	run.recall1 /= queries.size();
+	run.recall10 /= queries.size();
+	return run;
+}
+
+int main(int argc, char **argv)
+{
+	long count = argc > 1 ? std::atol(argv[1]) : 100000;
+	long queries_count = argc > 2 ? std::atol(argv[2]) : 500;
+	std::string mode = argc > 5 ? argv[5] : "float";
+	HnswOptions options;
+	FaceIndexOptions index_options;
+
+	if (argc > 3) {
+		options.m = std::atoi(argv[3]);
+	}
+	if (argc > 4) {
+		options.ef_construction = std::atoi(argv[4]);
+	}
+	if (mode == "int8" || mode == "int8+rerank") {
+		index_options.quantize = true;
+		index_options.rerank = mode == "int8" ? 0 : RERANK;
+	} else if (mode != "float") {
+		count = 0;
+	}
+	if (count <= 0 || queries_count <= 0) {
+		std::cerr << "Usage: " << argv[0]
+			  << " [faces] [queries] [m] [ef_construction]"
+			  << " [float | int8 | int8+rerank]" << std::endl;
+		return 1;
+	}
+
+	Gallery gallery(count);
+	FaceIndex index(index_options), reference;
+	std::vector<float> values;
+
+	for (long i = 0; i < count; i++) {
+		size_t person = i % gallery.people.size();
+		gallery.sample(person, values);
+		index.add(std::to_string(person), values.data(), values.size());
+		reference.add(std::to_string(person), values.data(),
+			      values.size());
+	}
+	size_t bytes = index.memory();
+
+	/* New photos of enrolled people */
+	std::vector<std::vector<float> > queries(queries_count);
+	for (auto &q : queries) {
+		gallery.sample(gallery.rng() % gallery.people.size(), q);
+	}
+
+	std::vector<std::vector<FaceMatch> > truth, unchecked;
+	for (auto &q : queries) {
+		truth.push_back(reference.search_exact(q.data(), 10));
+	}
+	Run exact = measure(queries, unchecked, [&](const float *q) {
+		return reference.search_exact(q, 10);
+	});
+	Run scan = measure(queries, truth, [&](const float *q) {
+		return index.search(q, 10);
+	});
+
+	auto start = Clock::now();
+	index.build_graph(options);
+	double build_s = elapsed_us(start) / 1e6;
+
+	std::cout << "faces        " << count << " (" << gallery.people.size()
+		  << " people), " << queries_count << " queries\n"
+		  << "graph        m " << options.m << ", ef_construction "
+		  << options.ef_construction << ", built in " << build_s
+		  << " s (" << count / build_s << " faces/s)\n"
+		  << "memory       " << (double)bytes / count
+		  << " bytes per face in " << mode << ", "
+		  << (double)(index.memory() - bytes) / count
+		  << " for the graph\n"
+		  << "exact        " << exact.avg_us << " us avg, "
+		  << exact.p99_us << " us p99\n"
+		  << "scan " << mode << std::string(8 - std::min<size_t>(mode.size(), 7), ' ')
+		  << scan.avg_us << " us avg, " << scan.p99_us
+		  << " us p99, recall@1 " << scan.recall1 << ", recall@10 "
+		  << scan.recall10 << "\n";
+
+	for (size_t ef : { 16, 32, 64, 128, 256 }) {
+		index.set_ef(ef);
+		Run run = measure(queries, truth, [&](const float *q) {
+			return index.search(q, 10);
+		});
+		std::cout << "ef " << ef << (ef < 100 ? "  " : " ")
+			  << "     " << run.avg_us << " us avg, " << run.p99_us
+			  << " us p99, recall@1 " << run.recall1
+			  << ", recall@10 " << run.recall10 << "\n";
+	}
+	std::cout << std::flush;
+	return 0;
+}
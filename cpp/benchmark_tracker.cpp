@@ -0,0 +1,207 @@
+/**
+ * @brief      Per-frame cost and identity stability of the tracker.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "tracker.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * @brief      Synthetic scene of objects moving at constant speed.
+ */
+struct Scene {
+	struct Object {
+		BoundingBox box;
+		float vx, vy;
+	};
+
+	std::vector<Object> objects;
+	float width = 3840, height = 2160;
+	std::minstd_rand rng{ 42 };
+
+	explicit Scene(int count)
+	{
+		/* Lanes of traffic, each lane at its own speed */
+		int columns = std::max(1, (int)std::sqrt(count * 16.0 / 9));
+		int rows = (count + columns - 1) / columns;
+		for (int i = 0; i < count; i++) {
+			int lane = i / columns;
+			Object o;
+			o.box.width = 30 + rng() % 40;
+			o.box.height = 30 + rng() % 40;
+			o.box.left = (i % columns) * width / columns;
+			o.box.top = lane * height / rows;
+			o.vx = (lane % 2 ? 1 : -1) * (1 + lane % 4);
+			o.vy = 0;
+			objects.push_back(o);
+		}
+	}
+
+	/**
+	 * @brief      Move every object by one frame.
+	 *
+	 * @param[out] wrapped  Objects that left and re-entered the frame
+	 */
+	void step(std::vector<int> &wrapped)
+	{
+		wrapped.clear();
+		for (size_t i = 0; i < objects.size(); i++) {
+			Object &o = objects[i];
+			o.box.left += o.vx;
+			o.box.top += o.vy;
+			if (o.box.left < -o.box.width || o.box.left > width) {
+				o.box.left = o.vx > 0 ? -o.box.width : width;
+				wrapped.push_back(i);
+			}
+		}
+	}
+
+	/**
+	 * @brief      Noisy detections, some objects missed.
+	 *
+	 * @param[out] truth  Object of each detection
+	 */
+	void detect(std::vector<TrackInput> &out, std::vector<int> &truth)
+	{
+		std::normal_distribution<float> noise(0, 2);
+
+		out.clear();
+		truth.clear();
+		for (size_t i = 0; i < objects.size(); i++) {
+			if (rng() % 100 < 5) {
+				continue;
+			}
+			TrackInput d;
+			d.label = "car";
+			d.confidence = 0.9f;
+			d.box = objects[i].box;
+			d.box.left += noise(rng);
+			d.box.top += noise(rng);
+			d.box.width += noise(rng);
+			d.box.height += noise(rng);
+			out.push_back(d);
+			truth.push_back(i);
+		}
+	}
+};
+
+static double elapsed_us(Clock::time_point since)
+{
+	return std::chrono::duration<double, std::micro>(Clock::now() - since)
+		.count();
+}
+
+/**
+ * @brief      Id of the track best covering a box, -1 below 0.5 IoU.
+ */
+static int track_at(const std::vector<Track> &tracks, const BoundingBox &box)
+{
+	float best = 0.5f;
+	int id = -1;
+
+	for (auto &t : tracks) {
+		float overlap = box_iou(t.box, box);
+		if (overlap >= best) {
+			best = overlap;
+			id = t.id;
+		}
+	}
+	return id;
+}
+
+int main(int argc, char **argv)
+{
+	int count = argc > 1 ? std::atoi(argv[1]) : 300;
+	int frames = argc > 2 ? std::atoi(argv[2]) : 900;
+	int every = argc > 3 ? std::max(1, std::atoi(argv[3])) : 6;
+
+	if (count <= 0 || frames <= 0) {
+		std::cerr << "Usage: " << argv[0]
+			  << " [objects] [frames] [inference every N frames]"
+			  << std::endl;
+		return 1;
+	}
+
+	Scene scene(count);
+	Tracker tracker;
+	std::vector<TrackInput> detections;
+	std::vector<int> truth;
+	std::vector<Track> tracks;
+	std::vector<double> predict_us, update_us;
+	std::vector<int> wrapped;
+	std::map<int, int> first_id; /* Object -> track id */
+	size_t checked = 0, switches = 0, lost = 0;
+
+	for (int frame = 0; frame < frames; frame++) {
+		scene.step(wrapped);
+		for (int i : wrapped) {
+			/* A new object as far as the tracker can tell */
+			first_id.erase(i);
+		}
+
+		auto start = Clock::now();
+		tracker.predict();
+		predict_us.push_back(elapsed_us(start));
+
+		if (frame % every == 0) {
+			scene.detect(detections, truth);
+			start = Clock::now();
+			tracker.update(detections);
+			update_us.push_back(elapsed_us(start));
+		}
+
+		/* Score the predicted boxes on every frame after warm-up */
+		tracker.tracks(tracks);
+		if (frame < 2 * every) {
+			continue;
+		}
+		for (int i = 0; i < count; i++) {
+			int id = track_at(tracks, scene.objects[i].box);
+			checked++;
+			if (id < 0) {
+				lost++;
+				continue;
+			}
+			auto it = first_id.emplace(i, id).first;
+			if (it->second != id) {
+				switches++;
+				it->second = id;
+			}
+		}
+	}
+
+	std::sort(predict_us.begin(), predict_us.end());
+	std::sort(update_us.begin(), update_us.end());
+	auto avg = [](const std::vector<double> &v) {
+		double sum = 0;
+		for (double x : v) {
+			sum += x;
+		}
+		return v.empty() ? 0 : sum / v.size();
+	};
+
+	std::cout << "objects      " << count << ", inference every " << every
+		  << " frames\n"
+		  << "tracks       " << tracker.size() << "\n"
+		  << "predict      " << avg(predict_us) << " us avg, "
+		  << predict_us.back() << " us max per frame\n"
+		  << "update       " << avg(update_us) << " us avg, "
+		  << (update_us.empty() ? 0 : update_us.back())
+		  << " us max per result\n"
+		  << "covered      " << 100.0 * (checked - lost) / checked
+		  << "% of object frames\n"
+		  << "id switches  " << switches << std::endl;
+	return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ *
+ * @brief      Bounded multi-producer multi-consumer queue used between
+ *             pipeline stages.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/**
+ * @brief      Fixed capacity FIFO queue.
+ *
+ *             push() waits while the queue is full, try_push() fails
+ *             instead, so a stage can choose between back-pressure and
+ *             dropping. force_push() ignores the capacity, for producers
+ *             that must never wait. close() wakes every waiter; pop() keeps returning
+ *             queued items until the queue is empty.
+ */
+template <typename T> class BoundedQueue {
+public:
+	explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+	/**
+	 * @brief      Append an item, waiting for space.
+	 *
+	 * @return     false if the queue was closed
+	 */
+	bool push(T item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_full_.wait(lock, [this] {
+			return closed_ || items_.size() < capacity_;
+		});
+		if (closed_) {
+			return false;
+		}
+		items_.push_back(std::move(item));
+		lock.unlock();
+		not_empty_.notify_one();
+		return true;
+	}
+
+	/**
+	 * @brief      Append an item if there is space.
+	 *
+	 * @return     false if the queue is full or closed
+	 */
+	bool try_push(T item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (closed_ || items_.size() >= capacity_) {
+			return false;
+		}
+		items_.push_back(std::move(item));
+		lock.unlock();
+		not_empty_.notify_one();
+		return true;
+	}
+
+	/**
+	 * @brief      Append an item even if the queue is full.
+	 *
+	 *             For callbacks on I/O threads, which must not block. The
+	 *             caller bounds the overshoot, e.g. by the number of
+	 *             requests in flight.
+	 *
+	 * @return     false if the queue was closed
+	 */
+	bool force_push(T item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (closed_) {
+			return false;
+		}
+		items_.push_back(std::move(item));
+		lock.unlock();
+		not_empty_.notify_one();
+		return true;
+	}
+
+	/**
+	 * @brief      Remove the oldest item, waiting for one.
+	 *
+	 * @return     false once the queue is closed and empty
+	 */
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_empty_.wait(lock,
+				[this] { return closed_ || !items_.empty(); });
+		if (items_.empty()) {
+			return false;
+		}
+		item = std::move(items_.front());
+		items_.pop_front();
+		lock.unlock();
+		not_full_.notify_one();
+		return true;
+	}
+
+	/**
+	 * @brief      Remove the oldest item if there is one.
+	 */
+	bool try_pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (items_.empty()) {
+			return false;
+		}
+		item = std::move(items_.front());
+		items_.pop_front();
+		lock.unlock();
+		not_full_.notify_one();
+		return true;
+	}
+
+	/**
+	 * @brief      Stop accepting items and wake all waiters.
+	 */
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			closed_ = true;
+		}
+		not_full_.notify_all();
+		not_empty_.notify_all();
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return items_.size();
+	}
+
+private:
+	std::mutex mutex_;
+	std::condition_variable not_full_;
+	std::condition_variable not_empty_;
+	std::deque<T> items_;
+	size_t capacity_;
+	bool closed_ = false;
+};
+
+#endif
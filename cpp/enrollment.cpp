@@ -0,0 +1,238 @@
+/**
+ *
+ * @brief      Aggregation of the face samples of one person into a few
+ *             gallery entries.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <algorithm>
+#include <cmath>
+
+#include "enrollment.hpp"
+
+/* Rounds of k-medoids, it settles in a few for the sizes of a person */
+#define KMEDOIDS_ROUNDS 20
+
+typedef std::vector<float> Embedding;
+
+static float similarity(const Embedding &a, const Embedding &b)
+{
+	float sum = 0;
+
+	for (size_t i = 0; i < a.size(); i++) {
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+static bool normalise(Embedding &v, float *length = nullptr)
+{
+	float norm = std::sqrt(similarity(v, v));
+
+	if (!(norm > 0)) {
+		return false;
+	}
+	for (auto &x : v) {
+		x /= norm;
+	}
+	if (length) {
+		*length = norm;
+	}
+	return true;
+}
+
+/**
+ * @brief      Split the samples into k clusters around medoids.
+ *
+ *             Starts from the most central sample and the samples farthest
+ *             from the medoids so far, then alternates assigning samples
+ *             and moving each medoid to the member closest to the others.
+ *
+ * @param[in]  sim      Similarity of every pair of samples, n x n
+ * @param[out] cluster  Cluster of every sample
+ */
+static void kmedoids(const std::vector<float> &sim, size_t n, size_t k,
+		     std::vector<size_t> &medoids, std::vector<size_t> &cluster)
+{
+	auto closeness = [&](size_t i, size_t c) {
+		float sum = 0;
+		for (size_t j = 0; j < n; j++) {
+			if (cluster[j] == c) {
+				sum += sim[i * n + j];
+			}
+		}
+		return sum;
+	};
+
+	cluster.assign(n, 0);
+	medoids.clear();
+	size_t centre = 0;
+	for (size_t i = 1; i < n; i++) {
+		if (closeness(i, 0) > closeness(centre, 0)) {
+			centre = i;
+		}
+	}
+	medoids.push_back(centre);
+	while (medoids.size() < k) {
+		size_t far = 0;
+		float far_sim = 2;
+		for (size_t i = 0; i < n; i++) {
+			float best = -2;
+			for (size_t m : medoids) {
+				best = std::max(best, sim[i * n + m]);
+			}
+			if (best < far_sim) {
+				far_sim = best;
+				far = i;
+			}
+		}
+		medoids.push_back(far);
+	}
+
+	for (int round = 0; round < KMEDOIDS_ROUNDS; round++) {
+		for (size_t i = 0; i < n; i++) {
+			cluster[i] = 0;
+			for (size_t c = 1; c < k; c++) {
+				if (sim[i * n + medoids[c]] >
+				    sim[i * n + medoids[cluster[i]]]) {
+					cluster[i] = c;
+				}
+			}
+		}
+		bool moved = false;
+		for (size_t c = 0; c < k; c++) {
+			size_t best = medoids[c];
+			for (size_t i = 0; i < n; i++) {
+				if (cluster[i] == c &&
+				    closeness(i, c) > closeness(best, c)) {
+					best = i;
+				}
+			}
+			moved |= best != medoids[c];
+			medoids[c] = best;
+		}
+		if (!moved) {
+			break;
+		}
+	}
+}
+
+EnrollmentStats aggregate_samples(const std::vector<Embedding> &samples,
+				  const EnrollmentOptions &options,
+				  std::vector<Embedding> &entries)
+{
+	EnrollmentStats stats;
+	std::vector<Embedding> kept;
+	std::vector<float> lengths; /* Of the kept samples */
+
+	stats.samples = samples.size();
+	entries.clear();
+	for (auto &s : samples) {
+		Embedding v = s;
+		float length;
+		if (v.empty() || (!kept.empty() && v.size() != kept[0].size()) ||
+		    !normalise(v, &length)) {
+			stats.outliers++;
+			continue;
+		}
+		bool duplicate = false;
+		for (auto &k : kept) {
+			if (similarity(v, k) >= options.duplicate) {
+				duplicate = true;
+				break;
+			}
+		}
+		if (duplicate) {
+			stats.duplicates++;
+		} else {
+			kept.push_back(std::move(v));
+			lengths.push_back(length);
+		}
+	}
+
+	size_t n = kept.size();
+	if (n == 0) {
+		return stats;
+	}
+	std::vector<float> sim(n * n);
+	for (size_t i = 0; i < n; i++) {
+		for (size_t j = i; j < n; j++) {
+			sim[i * n + j] = sim[j * n + i] =
+				similarity(kept[i], kept[j]);
+		}
+	}
+
+	std::vector<size_t> medoids, cluster, members;
+	size_t max_k = std::min(n, std::max<size_t>(options.max_entries, 1));
+	for (size_t k = 1; k <= max_k; k++) {
+		kmedoids(sim, n, k, medoids, cluster);
+
+		/* Groups too small for the number of samples are outliers */
+		members.assign(k, 0);
+		for (size_t c : cluster) {
+			members[c]++;
+		}
+		bool any_large = *std::max_element(members.begin(),
+						   members.end()) >=
+				 options.min_cluster;
+
+		entries.assign(k, Embedding(kept[0].size(), 0.0f));
+		stats.outliers = samples.size() - n - stats.duplicates;
+		stats.worst = 1.0f;
+		for (size_t i = 0; i < n; i++) {
+			if (any_large && members[cluster[i]] < options.min_cluster) {
+				stats.outliers++;
+				continue;
+			}
+			for (size_t d = 0; d < kept[i].size(); d++) {
+				entries[cluster[i]][d] += kept[i][d];
+			}
+		}
+		for (size_t c = 0; c < k; c++) {
+			if (options.medoids) {
+				entries[c] = kept[medoids[c]];
+			} else {
+				normalise(entries[c]);
+			}
+		}
+		for (size_t i = 0; i < n; i++) {
+			if (!any_large || members[cluster[i]] >= options.min_cluster) {
+				stats.worst = std::min(
+					stats.worst,
+					similarity(kept[i], entries[cluster[i]]));
+			}
+		}
+
+		/* Back to the length of the samples, so the entries score
+		 * like a registered face on /v1/compareface */
+		std::vector<float> length(k, 0.0f);
+		for (size_t i = 0; i < n; i++) {
+			length[cluster[i]] += lengths[i] / members[cluster[i]];
+		}
+		for (size_t c = 0; c < k; c++) {
+			float scale = options.medoids ? lengths[medoids[c]] :
+							length[c];
+			for (auto &x : entries[c]) {
+				x *= scale;
+			}
+		}
+
+		/* Outlier groups have no entry */
+		size_t out = 0;
+		for (size_t c = 0; c < k; c++) {
+			if (!any_large || members[c] >= options.min_cluster) {
+				if (out != c) {
+					entries[out] = std::move(entries[c]);
+				}
+				out++;
+			}
+		}
+		entries.resize(out);
+
+		if (stats.worst >= options.cover) {
+			break;
+		}
+	}
+	return stats;
+}
@@ -0,0 +1,66 @@
+/**
+ *
+ * @brief      Aggregation of the face samples of one person into a few
+ *             gallery entries.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef ENROLLMENT_HPP
+#define ENROLLMENT_HPP
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief      How the samples of a person are reduced.
+ */
+struct EnrollmentOptions {
+	float duplicate = 0.97f; /* Samples this similar count once */
+	float cover = 0.8f;	 /* Similarity every sample must keep to its
+				  * entry, otherwise another entry is added */
+	size_t max_entries = 3;	 /* Entries per person */
+	size_t min_cluster = 2;	 /* Smaller groups are outliers, e.g. a
+				  * photo of somebody else, when the person
+				  * has more samples than that */
+	bool medoids = false;	 /* Store real samples instead of means */
+};
+
+/**
+ * @brief      Outcome of enrolling one person.
+ */
+struct EnrollmentStats {
+	size_t samples = 0;    /* Embeddings given */
+	size_t duplicates = 0; /* Dropped as near duplicates */
+	size_t outliers = 0;   /* Dropped as not fitting any entry */
+	float worst = 1.0f;    /* Lowest similarity of a kept sample to its
+				* entry */
+};
+
+/**
+ * @brief      Reduce the embeddings of one person to representative entries.
+ *
+ *             The samples are normalised and near duplicates dropped (a
+ *             burst of the same photo would otherwise outweigh the rest).
+ *             The remaining ones are clustered with k-medoids, k growing
+ *             from 1 until every sample is within cover of its cluster's
+ *             entry or max_entries is reached. Each cluster yields one
+ *             entry, the normalised mean of its samples or its medoid,
+ *             at the mean length of its samples.
+ *
+ *             Search cost then grows with people rather than photos, and
+ *             a mean of several photos matches new photos better than
+ *             any single one.
+ *
+ * @param[in]  samples  Embeddings of one person, all of the same size
+ * @param[in]  options  Thresholds
+ * @param[out] entries  Entries to enroll, empty if no samples
+ *
+ * @return     What was dropped and how well the entries fit
+ */
+EnrollmentStats aggregate_samples(
+	const std::vector<std::vector<float> > &samples,
+	const EnrollmentOptions &options,
+	std::vector<std::vector<float> > &entries);
+
+#endif
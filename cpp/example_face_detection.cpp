@@ -24,7 +24,11 @@
 #include <rapidjson/prettywriter.h>
 #include <rapidjson/istreamwrapper.h>
 #include <rapidjson/ostreamwrapper.h>
+#include "api_result.hpp"
+#include "batch.hpp"
 #include "helper.hpp"
+#include "output.hpp"
+#include "tiling.hpp"
 
 #define MIN_FACE_DET_CONFIDENCE 0.5f
 
@@ -34,7 +38,7 @@ using namespace std;
 /**
  * @brief      Processes the input images and detects objects in them.
  *
- * @param      url        - The URL of the API server
+ * @param      session    - Connection to the API server
  * @param      image_dir  - The directory where the input images are stored.
  * @param      out_dir    - The directory where the output images with objects
  *                        detected will be saved.
@@ -43,79 +47,67 @@ using namespace std;
  *
  * @return     void
  */
-void detect_face(std::string &url, std::string &image_path,
+void detect_face(ApiSession &session, std::string &image_path,
 		 const std::string out_dir, const bool save, const bool display)
 {
-	rapidjson::Document output_json;
-	Http::Experimental::Client client;
-	std::vector<Async::Promise<Http::Response> > responses;
-	auto opts = Http::Experimental::Client::options()
-			    .threads(8)
-			    .maxConnectionsPerHost(1)
-			    .maxResponseSize(1024 * 1024 * 100);
-
-	client.init(opts);
-
-	// Read the image using OpenCV
-	cv::Mat image = cv::imread(image_path);
-
-	// Send the image as a request to the specified web page
-	std::string result =
-		send_request_to_api_server(image, client, url, responses);
+	ApiResult output;
+	TileOptions tiles;
+	cv::Mat frame;
+
+	if (load_for_tiling(image_path, tiles, frame)) {
+		/* Too large to downscale without losing small faces */
+		if (!detect_tiled(session, API_DETECT_FACE, frame, tiles,
+				  output)) {
+			return;
+		}
+	} else {
+		// Send the image as a request to the specified web page
+		double scale = 1.0;
+		/* Other images were decoded by load_for_tiling() */
+		std::future<ApiResponse> response =
+			frame.empty() ?
+				session.detect_face(image_path, &scale) :
+				session.detect_face(frame, &scale);
+		std::string result = response_body(response.get());
+
+		if (!parse_api_result_or_report(result, output)) {
+			return;
+		}
+		output.rescale(scale);
+	}
 
-	if (output_json.Parse(result.c_str()).HasParseError()) {
-		std::cerr
-			<< "Error: Failed to parse JSON output from API server. "
-			<< result << std::endl;
+	if (output.faces.size() < 1) {
+		std::cerr << "Error: No face Detected in input image."
+			  << std::endl;
 		return;
 	}
 
-	if (output_json.HasMember("error")) {
-		// Print error and return
-		std::cerr << "Error: Server returned error\nCode: "
-			  << output_json["error"]["code"].GetInt()
-			  << "\nReason: "
-			  << output_json["error"]["message"].GetString()
-			  << std::endl;
+	if (!display && !save) {
+		/* Nothing to render, the image is never decoded */
 		return;
 	}
 
-	if (output_json["result"]["faces"].Size() < 1) {
-		std::cerr << "Error: No face Detected in input image."
+	// Read the image using OpenCV and draw on it in place
+	if (frame.empty()) {
+		frame = read_image(image_path);
+	}
+	if (frame.empty()) {
+		std::cerr << "Error: Cannot read image " << image_path
 			  << std::endl;
 		return;
 	}
-
-	cv::Mat frame = image.clone();
-	for (auto i = 0; i < output_json["result"]["faces"].Size(); i++) {
-		float confidence =
-			output_json["result"]["faces"][i]["confidence"]
-				.GetFloat();
+	for (size_t i = 0; i < output.faces.size(); i++) {
+		const Face &face = output.faces[i];
 		/*Check if the confidence is above threshold*/
-		if (confidence < MIN_FACE_DET_CONFIDENCE) {
+		if (face.confidence < MIN_FACE_DET_CONFIDENCE) {
 			continue;
 		}
-		int top = (int)output_json["result"]["faces"][i]["boundingBox"]
-					  ["top"]
-						  .GetFloat();
-
-		int left = (int)output_json["result"]["faces"][i]["boundingBox"]
-					   ["left"]
-						   .GetFloat();
-
-		int width = (int)output_json["result"]["faces"][i]
-					    ["boundingBox"]["width"]
-						    .GetFloat();
-
-		int height = (int)output_json["result"]["faces"][i]
-					     ["boundingBox"]["height"]
-						     .GetFloat();
-
 		std::string label = "face#" + std::to_string(i + 1) + " " +
-				    std::to_string(confidence);
-		draw_bounding_box(frame, left, top, width, height);
+				    std::to_string(face.confidence);
+		draw_bounding_box(frame, (int)face.box.left, (int)face.box.top,
+				  (int)face.box.width, (int)face.box.height);
 		/* Uncomment if you want to draw labels */
-		//draw_label(frame, label, left, top);
+		//draw_label(frame, label, (int)face.box.left, (int)face.box.top);
 	}
 	if (display) {
 		display_output_image(frame);
@@ -123,20 +115,20 @@ void detect_face(std::string &url, std::string &image_path,
 	if (save) {
 		save_to_disk(frame, image_path, out_dir);
 	}
-
-	client.shutdown();
 }
 
 int main(int argc, char **argv)
 {
-	std::string url = "http://localhost:9900/v1/detectface";
+	std::string url = api_servers("http://localhost:9900");
 	std::string input_img = "../sample_inputs/images/faces.jpg";
 	std::string output_dir = "./output";
 	bool save = true;
-	bool display = true;
-
-	cout << "Starting client...\n";
-	detect_face(url, input_img, output_dir, save, display);
-
-	return 0;
+	bool display = display_enabled();
+
+	return run_image_example(
+		argc, argv, url, input_img,
+		[&](ApiSession &session, std::string &image_path, bool) {
+			detect_face(session, image_path, output_dir, save,
+				    display);
+		});
 }
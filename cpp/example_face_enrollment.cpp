@@ -0,0 +1,222 @@
+/**
+ * @brief      Enroll many people at once from a directory of their photos.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+
+#include <pistache/client.h>
+#include <pistache/http.h>
+#include <pistache/net.h>
+
+#include "api_result.hpp"
+#include "batch.hpp"
+#include "enrollment.hpp"
+#include "face_store.hpp"
+#include "helper.hpp"
+
+#define MIN_FACE_DET_CONFIDENCE 0.5f
+
+/**
+ * @brief      Photos of one person and the embeddings found in them.
+ */
+struct Person {
+	std::string name;
+	std::vector<std::string> images;
+	std::vector<std::vector<float> > samples;
+	size_t no_face = 0; /* Photos without a usable face */
+};
+
+/**
+ * @brief      Get the embedding of the main face of an enrollment photo.
+ *
+ *             Photos of a person may show somebody else in the background,
+ *             so only the largest face is taken.
+ *
+ * @return     false if no face was detected
+ */
+static bool main_face_embedding(ApiSession &session,
+				const std::string &image_path,
+				std::vector<float> &embedding)
+{
+	ApiResult output;
+	double scale = 1.0;
+	std::string result = response_body(
+		session.face_to_embedding(image_path, &scale).get());
+
+	if (!parse_api_result_or_report(result, output)) {
+		return false;
+	}
+	output.rescale(scale);
+
+	const FaceEmbedding *best = nullptr;
+	for (auto &e : output.embeddings) {
+		if (e.face.confidence < MIN_FACE_DET_CONFIDENCE) {
+			continue;
+		}
+		if (!best || e.face.box.width * e.face.box.height >
+				     best->face.box.width *
+					     best->face.box.height) {
+			best = &e;
+		}
+	}
+	if (!best || best->embeddings.size() != FACE_EMBEDDING_DIM) {
+		return false;
+	}
+	embedding = best->embeddings;
+	return true;
+}
+
+/**
+ * @brief      List the people of a directory, one sub-directory each.
+ */
+static std::vector<Person> list_people(const std::string &root)
+{
+	std::vector<Person> people;
+
+	for (auto &entry : std::filesystem::directory_iterator(root)) {
+		if (!entry.is_directory()) {
+			continue;
+		}
+		Person person;
+		person.name = entry.path().filename().string();
+		person.images = list_images(entry.path().string());
+		if (!person.images.empty()) {
+			people.push_back(std::move(person));
+		}
+	}
+	std::sort(people.begin(), people.end(),
+		  [](const Person &a, const Person &b) {
+			  return a.name < b.name;
+		  });
+	return people;
+}
+
+/**
+ * @brief      Names already in a face store, so a second run only adds
+ *             the new people.
+ */
+static std::set<std::string> enrolled_names(const std::string &base)
+{
+	std::set<std::string> names;
+	FaceStoreView view;
+
+	if (view.open(base)) {
+		for (size_t i = 0; i < view.size(); i++) {
+			names.insert(view.name(i));
+		}
+	}
+	return names;
+}
+
+int main(int argc, char **argv)
+{
+	std::string url = api_servers("http://localhost:9900");
+	std::string output_dir = "./output";
+	std::string store_base = output_dir + "/" + FACE_STORE;
+	size_t workers = argc > 2 ? std::max(1, std::atoi(argv[2])) :
+				    BATCH_DEFAULT_WORKERS;
+	EnrollmentOptions options;
+
+	if (argc < 2 || !std::filesystem::is_directory(argv[1])) {
+		std::cerr << "Usage: " << argv[0] << " <people_dir> [workers]\n"
+			  << "       people_dir/<name>/<photos> enrolls each "
+			  << "sub-directory as one person" << std::endl;
+		return 1;
+	}
+
+	std::set<std::string> enrolled = enrolled_names(store_base);
+	std::vector<Person> people;
+	for (auto &person : list_people(argv[1])) {
+		if (enrolled.count(person.name)) {
+			std::cout << person.name << ": already enrolled, skipped"
+				  << std::endl;
+		} else {
+			people.push_back(std::move(person));
+		}
+	}
+
+	/* All photos of all people go through one worker pool */
+	std::vector<std::string> images;
+	std::map<std::string, Person *> owner;
+	for (auto &person : people) {
+		for (auto &image : person.images) {
+			images.push_back(image);
+			owner[image] = &person;
+		}
+	}
+	if (images.empty()) {
+		std::cerr << "Error: No new people found in " << argv[1]
+			  << std::endl;
+		return 1;
+	}
+
+	ApiSessionOptions session_options;
+	session_options.max_in_flight = workers;
+	session_options.max_connections_per_host = std::max<int>(
+		session_options.max_connections_per_host, workers);
+	ApiSession session(url, session_options);
+	std::mutex mutex;
+
+	std::cout << "Enrolling " << people.size() << " people from "
+		  << images.size() << " photos..." << std::endl;
+	run_batch(session, images, workers,
+		  [&](ApiSession &client, std::string &image_path, bool) {
+			  std::vector<float> embedding;
+			  bool found = main_face_embedding(client, image_path,
+							   embedding);
+			  std::lock_guard<std::mutex> lock(mutex);
+			  Person *person = owner[image_path];
+			  if (found) {
+				  person->samples.push_back(
+					  std::move(embedding));
+			  } else {
+				  person->no_face++;
+			  }
+		  });
+
+	FaceStore store;
+	std::filesystem::create_directories(output_dir);
+	if (!store.open(store_base, FACE_EMBEDDING_DIM)) {
+		std::cerr << "Error: Cannot open the face store" << std::endl;
+		return 1;
+	}
+
+	size_t photos = 0, entries_total = 0;
+	std::vector<std::vector<float> > entries;
+	for (auto &person : people) {
+		EnrollmentStats stats =
+			aggregate_samples(person.samples, options, entries);
+		for (auto &entry : entries) {
+			if (!store.append(person.name, entry.data(),
+					  entry.size())) {
+				std::cerr << "Error: Failed to save embeddings of "
+					  << person.name << std::endl;
+			}
+		}
+		std::cout << person.name << ": " << person.images.size()
+			  << " photos, " << person.no_face << " without a face, "
+			  << stats.duplicates << " duplicates, "
+			  << stats.outliers << " outliers, " << entries.size()
+			  << " entries (worst similarity " << stats.worst << ")"
+			  << std::endl;
+		photos += person.images.size();
+		entries_total += entries.size();
+	}
+	if (!store.flush()) {
+		std::cerr << "Error: Failed to write the face store" << std::endl;
+		return 1;
+	}
+	std::cout << "Enrolled " << people.size() << " people as "
+		  << entries_total << " gallery entries from " << photos
+		  << " photos" << std::endl;
+	return 0;
+}
@@ -26,7 +26,11 @@
 #include <rapidjson/istreamwrapper.h>
 #include <rapidjson/ostreamwrapper.h>
 
+#include "api_result.hpp"
+#include "batch.hpp"
+#include "face_store.hpp"
 #include "helper.hpp"
+#include "output.hpp"
 
 #define MIN_FACE_DET_CONFIDENCE 0.5f
 
@@ -36,118 +40,111 @@ using namespace std;
 /**
  * @brief      Processes the input images and detects objects in them.
  *
- * @param      url        - The URL of the API server
+ * @param      session    - Connection to the API server
  * @param      image_dir  - The directory where the input images are stored.
  * @param      out_dir    - The directory where the output images with objects
  *                        detected will be saved.
  * @param      save       - Boolean indicating if the output images with objects
  *                        detected will be saved or not.
+ * @param      name       - Name of the person
+ * @param      store      - Face store the embeddings are appended to
  *
  * @return     void
  */
-void register_face(std::string &url, std::string &image_path, 
+void register_face(ApiSession &session, std::string &image_path, 
 			 const std::string out_dir, const bool save, 
-			 const bool display, const std::string &name)
+			 const bool display, const std::string &name,
+			 FaceStore &store)
 {
-	rapidjson::Document output_json;
-	Http::Experimental::Client client;
-	std::vector<Async::Promise<Http::Response> > responses;
-	auto opts = Http::Experimental::Client::options()
-			    .threads(8)
-			    .maxConnectionsPerHost(1)
-			    .maxResponseSize(1024 * 1024 * 100);
+	ApiResult output;
 
-	client.init(opts);
+	double scale = 1.0;
+	std::string result = response_body(
+		session.face_to_embedding(image_path, &scale).get());
 
-	cv::Mat image = cv::imread(image_path);
-
-	std::string result =
-		send_request_to_api_server(image, client, url, responses);
-
-	if (output_json.Parse(result.c_str()).HasParseError()) {
-		std::cerr
-			<< "Error: Failed to parse JSON output from API server. "
-			<< result << std::endl;
+	if (!parse_api_result_or_report(result, output)) {
 		return;
 	}
+	output.rescale(scale);
 
-	if (output_json.HasMember("error")) {
-		// Print error and return
-		std::cerr << "Error: Server returned error\nCode: "
-			  << output_json["error"]["code"].GetInt()
-			  << "\nReason: "
-			  << output_json["error"]["message"].GetString()
-			  << std::endl;
-		return;
-	}
-
-	if (output_json["result"]["faces"].Size() < 1) {
+	if (output.embeddings.size() < 1) {
 		std::cerr << "Error: No face Detected in input image."
 			  << std::endl;
 		return;
 	}
 
-        std::cout << result<< std::endl;
-	cv::Mat frame = image.clone();
+	/* Decode only if there is something to render, and draw in place */
+	cv::Mat frame;
+	if (display || save) {
+		frame = read_image(image_path);
+	}
 
-	for (auto i = 0; i < output_json["result"]["faces"].Size(); i++) {
-		float confidence =
-			output_json["result"]["faces"][i]["confidence"]
-				.GetFloat();
+	for (size_t i = 0; i < output.embeddings.size(); i++) {
+		const Face &face = output.embeddings[i].face;
 		/* Check if the confidence is above threshold */
-		if (confidence < MIN_FACE_DET_CONFIDENCE) {
+		if (face.confidence < MIN_FACE_DET_CONFIDENCE) {
 			continue;
 		}
-		int top = (int)output_json["result"]["faces"][i]["boundingBox"]
-					  ["top"]
-						  .GetFloat();
-
-		int left = (int)output_json["result"]["faces"][i]["boundingBox"]
-					   ["left"]
-						   .GetFloat();
-
-		int width = (int)output_json["result"]["faces"][i]
-					    ["boundingBox"]["width"]
-						    .GetFloat();
-
-		int height = (int)output_json["result"]["faces"][i]
-					     ["boundingBox"]["height"]
-						     .GetFloat();
+		int top = (int)face.box.top;
+		int left = (int)face.box.left;
+		int width = (int)face.box.width;
+		int height = (int)face.box.height;
 
 		std::string label = name + std::to_string(i + 1) + " " +
-				    std::to_string(confidence);
+				    std::to_string(face.confidence);
 
-		draw_bounding_box(frame, left, top, width, height);
+		if (!frame.empty()) {
+			draw_bounding_box(frame, left, top, width, height);
+		}
 
 		/* Uncomment if you want to draw labels */
 		//draw_label(frame, label, left, top);
 	
 		/* Save embeddings to disk */
-		save_embeddings_to_disk(name, 
-				output_json["result"]["faces"][i]["embeddings"], 
-				out_dir, "face_embeddings.json");
+		const std::vector<float> &values =
+			output.embeddings[i].embeddings;
+		if (!store.append(name, values.data(), values.size())) {
+			std::cerr << "Error: Failed to save embeddings of "
+				  << name << std::endl;
+		}
 	}
 
+	if (frame.empty()) {
+		return;
+	}
 	if (display) {
 		display_output_image(frame);
 	}
 	if (save) {
 		save_to_disk(frame, image_path, out_dir);
 	}
-
-	client.shutdown();
 }
 
 int main(int argc, char **argv)
 {
-	std::string url = "http://localhost:9900/v1/face2embedding";
+	std::string url = api_servers("http://localhost:9900");
 	std::string input_img = "../sample_inputs/images/face.jpg";
 	std::string output_dir = "./output";
 	bool save = true;
-	bool display = true;
+	bool display = display_enabled();
 	std::string name = "Person1";	
-	std::cout << "Starting client..." << std::endl;
-	register_face(url, input_img, output_dir, save, display, name);
+	FaceStore store;
+
+	filesystem::create_directories(output_dir);
+	if (!store.open(output_dir + "/" + FACE_STORE, FACE_EMBEDDING_DIM)) {
+		std::cerr << "Error: Cannot open the face store" << std::endl;
+		return 1;
+	}
 
-	return 0;
+	/* In batch mode every image is named after its file */
+	return run_image_example(
+		argc, argv, url, input_img,
+		[&](ApiSession &session, std::string &image_path, bool batch) {
+			std::string person = name;
+			if (batch) {
+				person = filesystem::path(image_path).stem().string();
+			}
+			register_face(session, image_path, output_dir, save,
+				      display, person, store);
+		});
 }
@@ -5,6 +5,7 @@
  * @date       2023
  */
 
+#include <cctype>
 #include <iostream>
 #include <filesystem>
 #include <fstream>
@@ -12,6 +13,7 @@
 #include <opencv2/dnn.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
+#include <opencv2/videoio.hpp>
 
 #include <pistache/client.h>
 #include <pistache/http.h>
@@ -26,9 +28,17 @@
 #include <rapidjson/istreamwrapper.h>
 #include <rapidjson/ostreamwrapper.h>
 
+#include "api_result.hpp"
+#include "batch.hpp"
 #include "helper.hpp"
+#include "face_gallery.hpp"
+#include "identity_cache.hpp"
+#include "output.hpp"
+#include "trace.hpp"
+#include "tracker.hpp"
 
 #define MIN_FACE_DET_CONFIDENCE 0.5f
+#define MIN_FACE_MATCH_CONFIDENCE 0.8f
 
 #define EMBEDDINGS_DB "face_embeddings.json"
 
@@ -36,239 +46,376 @@ using namespace Pistache;
 using namespace std;
 
 /**
- * @brief  
- * 
- * @param url 
- * @param embeddings1 
- * @param embeddings2 
- * @return float 
+ * @brief      Confidence on the scale of the match thresholds.
+ *
+ * @param      server  - Confidence as /v1/compareface reports it
+ *
+ * @return     Server confidence scaled by 10
  */
-float compare_face(const std::string &url, rapidjson::Value &embeddings1,
-		   rapidjson::Value &embeddings2)
+static float scaled_confidence(float server)
 {
-	Http::Experimental::Client client;
-	std::vector<Async::Promise<Http::Response> > responses;
-	auto opts = Http::Experimental::Client::options()
-			    .threads(8)
-			    .maxConnectionsPerHost(1)
-			    .maxResponseSize(1024 * 1024 * 100);
-
-	client.init(opts);
-
-	std::string url2 = url + "/v1/compareface";
-
-	/* Convert the embeddings into input json */
-	rapidjson::Document input_json;
-	rapidjson::Document output_json;
-	rapidjson::Value face1(rapidjson::kObjectType);
-	rapidjson::Value face2(rapidjson::kObjectType);
-
-	input_json.SetObject();
-
-        rapidjson::Value embeddings1Copy(embeddings1,
-					input_json.GetAllocator());
-
-        rapidjson::Value embeddings2Copy(embeddings2,
-					input_json.GetAllocator());
-
-	face1.AddMember("embeddings", embeddings1Copy, input_json.GetAllocator());
-	face2.AddMember("embeddings", embeddings2Copy, input_json.GetAllocator());
-
-	input_json.AddMember("face1", face1, input_json.GetAllocator());
-	input_json.AddMember("face2", face2, input_json.GetAllocator());
-
-	/* Convert JSON to string */
-	rapidjson::StringBuffer buffer;
-	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-	writer.SetMaxDecimalPlaces(2);
-	input_json.Accept(writer);
-
-	std::string input_json_str(buffer.GetString(), buffer.GetSize());
+	return server * 10;
+}
 
-	std::string result = send_json_request_to_api_server(
-		input_json_str, client, url2, responses);
+/**
+ * @brief      Compare two face embeddings on the API server.
+ *
+ * @param      session      - Connection to the API server
+ * @param      embeddings1  - First embedding
+ * @param      embeddings2  - Second embedding
+ *
+ * @return     Server confidence scaled by 10
+ */
+float compare_face(ApiSession &session, const std::vector<float> &embeddings1,
+		   const std::vector<float> &embeddings2)
+{
+	ApiResult output;
 
-	if (output_json.Parse(result.c_str()).HasParseError()) {
-		std::cerr
-			<< "Error: Failed to parse JSON output from API server. "
-			<< result << std::endl;
-		return 0;
-	}
+	std::string result = response_body(
+		session.compare_face(embeddings1, embeddings2).get());
 
-	if (output_json.HasMember("error")) {
-		// Print error and return
-		std::cerr << "Error: Server returned error\nCode: "
-			  << output_json["error"]["code"].GetInt()
-			  << "\nReason: "
-			  << output_json["error"]["message"].GetString()
-			  << std::endl;
+	if (!parse_api_result_or_report(result, output)) {
 		return 0;
 	}
 
-        float out = output_json["result"]["confidence"].GetFloat();
-
-        client.shutdown();
-	return out * 10;
+	return scaled_confidence(output.confidence);
 }
 
 /**
- * @brief 
- * 
- * @param url 
- * @param input_embeddings 
- * @param output_dir 
- * @param json_path 
- * @return std::string 
+ * @brief      Find the best matching enrolled person for a face.
+ *
+ * @param      session      - Connection to the API server
+ * @param      index        - Gallery of enrolled faces
+ * @param      embeddings   - Embedding of the detected face
+ * @param      cross_check  - Also compare the best match on the server and
+ *                          print both confidences
+ * @param      confidence   - Set to the confidence of the best match
+ *
+ * @return     Name of the person or "Unknown"
  */
-std::string find_face(const std::string &url, rapidjson::Value &input_embeddings,
-		      const std::string &output_dir,
-		      const std::string &json_path)
+std::string find_face(ApiSession &session, const GallerySnapshot &index,
+		      const std::vector<float> &embeddings,
+		      const bool cross_check, float *confidence = nullptr)
 {
-	rapidjson::Document embedings_db;
-	std::string name = "Unknown";
-
-	/* Check if the file exists */
-	std::string output_file = output_dir + json_path;
-
-	if (!filesystem::exists(output_dir)) {
-		/* Create directory */
-		filesystem::create_directory(output_dir);
+	if (confidence) {
+		*confidence = 0;
 	}
-	if (!filesystem::exists(output_file)) {
-		return name;
+	if (index.size() == 0 || embeddings.size() != index.dim()) {
+		return "Unknown";
 	}
 
-	/* Read existing db file */
-	std::ifstream ifs(output_file);
-	rapidjson::IStreamWrapper isw(ifs);
+	std::vector<FaceMatch> matches = index.search(embeddings.data(), 1);
+	float local = scaled_confidence(matches[0].confidence);
 
-	embedings_db.ParseStream(isw);
-
-	/* Compare face embeddings */
-	for (auto i = 0; i < embedings_db.Size(); i++) {
-		float confidence = compare_face(url, input_embeddings,
-						embedings_db[i]["embeddings"]);
-
-		if (confidence > 0.8f) {
-			/* Face found */
-			name = embedings_db[i]["name"].GetString();
-		}
+	if (cross_check) {
+		std::vector<float> enrolled;
+		index.embedding(matches[0].id, enrolled);
+		float remote = compare_face(session, embeddings, enrolled);
+		std::cout << "Cross-check " << index.name(matches[0].id)
+			  << ": local = " << local << ", server = " << remote
+			  << std::endl;
 	}
 
-	return name;
+	if (confidence) {
+		*confidence = local;
+	}
+	if (local > MIN_FACE_MATCH_CONFIDENCE) {
+		/* Face found */
+		return index.name(matches[0].id);
+	}
+	return "Unknown";
 }
 
 /**
  * @brief      Processes the input images and detects objects in them.
  *
- * @param      url        - The URL of the API server
+ * @param      session    - Connection to the API server
  * @param      image_dir  - The directory where the input images are stored.
  * @param      out_dir    - The directory where the output images with objects
  *                        detected will be saved.
  * @param      save       - Boolean indicating if the output images with objects
  *                        detected will be saved or not.
+ * @param      gallery    - Gallery of enrolled faces
+ * @param      cross_check - Verify local matches against /v1/compareface
  *
  * @return     void
  */
-void verify_face(const std::string &url, std::string &image_path,
-		 const std::string out_dir, const bool save, const bool display)
+void verify_face(ApiSession &session, std::string &image_path,
+		 const std::string out_dir, const bool save, const bool display,
+		 const FaceGallery &gallery, const bool cross_check)
 {
-	rapidjson::Document output_json;
-	Http::Experimental::Client client;
-	std::vector<Async::Promise<Http::Response> > responses;
-	auto opts = Http::Experimental::Client::options()
-			    .threads(8)
-			    .maxConnectionsPerHost(1)
-			    .maxResponseSize(1024 * 1024 * 100);
-
-	client.init(opts);
-
-	cv::Mat image = cv::imread(image_path);
-
-	std::string url2 = url + "/v1/face2embedding";
-
-	std::string result =
-		send_request_to_api_server(image, client, url2, responses);
+	ApiResult output;
 
-	if (output_json.Parse(result.c_str()).HasParseError()) {
-		std::cerr
-			<< "Error: Failed to parse JSON output from API server. "
-			<< result << std::endl;
-		return;
-	}
+	double scale = 1.0;
+	std::string result = response_body(
+		session.face_to_embedding(image_path, &scale).get());
 
-	if (output_json.HasMember("error")) {
-		// Print error and return
-		std::cerr << "Error: Server returned error\nCode: "
-			  << output_json["error"]["code"].GetInt()
-			  << "\nReason: "
-			  << output_json["error"]["message"].GetString()
-			  << std::endl;
+	if (!parse_api_result_or_report(result, output)) {
 		return;
 	}
+	output.rescale(scale);
 
-	if (output_json["result"]["faces"].Size() < 1) {
+	if (output.embeddings.size() < 1) {
 		std::cerr << "Error: No face Detected in input image."
 			  << std::endl;
 		return;
 	}
 
-	cv::Mat frame = image.clone();
+	/* Faces enrolled meanwhile are matched from the next image on */
+	std::shared_ptr<const GallerySnapshot> index = gallery.snapshot();
+
+	/* Decode only if there is something to render, and draw in place */
+	cv::Mat frame;
+	if (display || save) {
+		frame = read_image(image_path);
+	}
 
-	for (auto i = 0; i < output_json["result"]["faces"].Size(); i++) {
-		float confidence =
-			output_json["result"]["faces"][i]["confidence"]
-				.GetFloat();
+	for (size_t i = 0; i < output.embeddings.size(); i++) {
+		const Face &face = output.embeddings[i].face;
 		/* Check if the confidence is above threshold */
-		if (confidence < MIN_FACE_DET_CONFIDENCE) {
+		if (face.confidence < MIN_FACE_DET_CONFIDENCE) {
 			continue;
 		}
-		int top = (int)output_json["result"]["faces"][i]["boundingBox"]
-					  ["top"]
-						  .GetFloat();
+		int top = (int)face.box.top;
+		int left = (int)face.box.left;
+		int width = (int)face.box.width;
+		int height = (int)face.box.height;
 
-		int left = (int)output_json["result"]["faces"][i]["boundingBox"]
-					   ["left"]
-						   .GetFloat();
-
-		int width = (int)output_json["result"]["faces"][i]
-					    ["boundingBox"]["width"]
-						    .GetFloat();
-
-		int height = (int)output_json["result"]["faces"][i]
-					     ["boundingBox"]["height"]
-						     .GetFloat();
-
-		draw_bounding_box(frame, left, top, width, height);
+		if (!frame.empty()) {
+			draw_bounding_box(frame, left, top, width, height);
+		}
 
-		std::string name = find_face(
-			url, output_json["result"]["faces"][i]["embeddings"],
-			out_dir, EMBEDDINGS_DB);
+		std::string name = find_face(session, *index,
+					     output.embeddings[i].embeddings,
+					     cross_check);
 		std::string label = name + std::to_string(i + 1) + " " +
-				    std::to_string(confidence);
-		/* Uncomment if you want to draw labels */
-		draw_label(frame, label, left, top);
+				    std::to_string(face.confidence);
+		std::cout << "Face " << i + 1 << ": " << name << std::endl;
+		if (!frame.empty()) {
+			draw_label(frame, label, left, top);
+		}
 	}
 
+	if (frame.empty()) {
+		return;
+	}
 	if (display) {
 		display_output_image(frame);
 	}
 	if (save) {
 		save_to_disk(frame, image_path, out_dir);
 	}
+}
 
-	client.shutdown();
+/**
+ * @brief      Whether an input is a video file or a camera number.
+ */
+static bool is_stream_input(const std::string &input)
+{
+	std::string ext = filesystem::path(input).extension().string();
+
+	for (auto &c : ext) {
+		c = std::tolower(c);
+	}
+	return (!input.empty() &&
+		input.find_first_not_of("0123456789") == std::string::npos) ||
+	       ext == ".mp4" || ext == ".avi" || ext == ".mkv" ||
+	       ext == ".mov";
+}
+
+/**
+ * @brief      Verify the faces of a video or camera, once per face track.
+ *
+ *             Every frame goes to /v1/detectface and the faces are
+ *             tracked. Only tracks the IdentityCache does not trust yet
+ *             cost a /v1/face2embedding request (on the same encoded
+ *             frame) and a gallery search; the other tracks keep their
+ *             name. The annotated video is written to out_dir.
+ *
+ * @param      session  - Connection to the API server
+ * @param      input    - Video file or camera number
+ * @param      out_dir  - Directory of the result video
+ * @param      display  - Show the frames while processing
+ * @param      gallery  - Gallery of enrolled faces, followed while the
+ *                        video plays
+ */
+void verify_stream(ApiSession &session, const std::string &input,
+		   const std::string &out_dir, const bool display,
+		   const FaceGallery &gallery)
+{
+	cv::VideoCapture capture;
+	bool camera =
+		input.find_first_not_of("0123456789") == std::string::npos;
+
+	if (!(camera ? capture.open(std::stoi(input)) : capture.open(input))) {
+		std::cerr << "Error: Failed to open " << input << std::endl;
+		return;
+	}
+	double fps = capture.get(cv::CAP_PROP_FPS) > 0 ?
+			     capture.get(cv::CAP_PROP_FPS) :
+			     25;
+
+	if (!filesystem::exists(out_dir)) {
+		filesystem::create_directory(out_dir);
+	}
+	std::string output_video =
+		out_dir + "/result_" +
+		(camera ? "camera" + input :
+			  filesystem::path(input).stem().string()) +
+		".avi";
+	cv::VideoWriter writer;
+
+	Tracker tracker;
+	IdentityCache cache;
+	ApiResult detected, embedded;
+	std::vector<TrackInput> inputs;
+	std::vector<Track> tracks;
+	std::vector<const Track *> pending;
+	cv::Mat frame;
+	std::string jpeg;
+	long n = 0, shown = 0, cached = 0, unknown = 0;
+
+	for (;; n++) {
+		{
+			TraceSpan span(TRACE_DECODE);
+			if (!capture.read(frame) || frame.empty()) {
+				break;
+			}
+		}
+		double scale = encode_upload(frame, session.upload_options(),
+					     jpeg);
+		std::string result =
+			session.post(API_DETECT_FACE, jpeg).get().body;
+		tracker.predict();
+		if (parse_api_result(result, detected) && !detected.has_error) {
+			detected.rescale(scale);
+			track_inputs(detected, MIN_FACE_DET_CONFIDENCE, inputs);
+			tracker.update(inputs);
+		}
+		tracker.tracks(tracks);
+		cache.observe(tracks);
+
+		/* Embeddings only for detected tracks without a trusted name */
+		pending.clear();
+		for (auto &track : tracks) {
+			if (track.misses == 0 &&
+			    cache.needs_verification(track, n)) {
+				pending.push_back(&track);
+			}
+		}
+		if (!pending.empty()) {
+			result = session.post(API_FACE_TO_EMBEDDING,
+					      std::move(jpeg))
+					 .get()
+					 .body;
+			if (parse_api_result(result, embedded) &&
+			    !embedded.has_error) {
+				embedded.rescale(scale);
+			}
+			std::shared_ptr<const GallerySnapshot> index =
+				gallery.snapshot();
+			for (auto track : pending) {
+				const FaceEmbedding *best = nullptr;
+				float best_iou = 0.3f;
+				for (auto &e : embedded.embeddings) {
+					float overlap =
+						box_iou(track->box, e.face.box);
+					if (overlap >= best_iou) {
+						best_iou = overlap;
+						best = &e;
+					}
+				}
+				if (!best) {
+					continue;
+				}
+				float confidence;
+				std::string name =
+					find_face(session, *index,
+						  best->embeddings, false,
+						  &confidence);
+				cache.store(track->id, name, confidence, n);
+			}
+		}
+
+		for (auto &track : tracks) {
+			const IdentityCache::Identity *identity =
+				cache.find(track.id);
+			std::string name = identity ? identity->name : "...";
+			shown++;
+			/* Reused from an earlier frame */
+			if (identity && identity->verified != n) {
+				if (identity->name == "Unknown") {
+					unknown++;
+				} else {
+					cached++;
+				}
+			}
+			draw_bounding_box(frame, track.box.left, track.box.top,
+					  track.box.width, track.box.height);
+			draw_label(frame,
+				   "#" + std::to_string(track.id) + " " + name,
+				   track.box.left, track.box.top);
+		}
+
+		if (!writer.isOpened()) {
+			writer.open(output_video,
+				    cv::VideoWriter::fourcc('M', 'J', 'P', 'G'),
+				    fps, frame.size());
+		}
+		writer.write(frame);
+		if (display) {
+			preview_window().show(frame);
+			if (preview_window().closed()) {
+				break;
+			}
+		}
+	}
+
+	std::cout << "Processed " << n << " frames, " << shown
+		  << " faces shown, " << cache.verifications()
+		  << " verified, " << cached << " named from the track cache, "
+		  << unknown << " kept as unknown until the next retry"
+		  << std::endl;
 }
 
 int main(int argc, char **argv)
 {
-	std::string url = "http://localhost:9900";
+	std::string url = api_servers("http://localhost:9900");
 	std::string input_img = "../sample_inputs/images/faces.jpg";
 	std::string output_dir = "./output";
 	bool save = true;
-	bool display = true;
-	std::cout << "Starting client..." << std::endl;
-	verify_face(url, input_img, output_dir, save, display);
+	bool display = display_enabled();
+	bool cross_check = false;
+	FaceGalleryOptions options;
+
+	/* Every face is matched in memory. The binary store is followed, so
+	 * faces registered while this runs are found within a second; the
+	 * JSON gallery is only read if there is no store. */
+	FaceGallery gallery(options);
+	std::string store = output_dir + "/" + FACE_STORE;
+	if (!gallery.open(store)) {
+		/* Still followed, registered faces appear once it exists */
+		std::string json = output_dir + "/" + EMBEDDINGS_DB;
+		if (filesystem::exists(json)) {
+			gallery.open_json(json);
+		}
+	} else if (gallery.snapshot()->base()->has_graph()) {
+		std::cout << "Searching with the graph " << store
+			  << FACE_GRAPH_EXT << std::endl;
+	}
+	std::cout << "Loaded " << gallery.snapshot()->size()
+		  << " enrolled faces" << std::endl;
+
+	if (argc > 1 && is_stream_input(argv[1])) {
+		ApiSession session(url);
+		verify_stream(session, argv[1], output_dir, display, gallery);
+		return 0;
+	}
 
-	return 0;
+	return run_image_example(
+		argc, argv, url, input_img,
+		[&](ApiSession &session, std::string &image_path, bool) {
+			verify_face(session, image_path, output_dir, save,
+				    display, gallery, cross_check);
+		});
 }
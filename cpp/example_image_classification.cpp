@@ -24,7 +24,10 @@
 #include <rapidjson/prettywriter.h>
 #include <rapidjson/istreamwrapper.h>
 #include <rapidjson/ostreamwrapper.h>
+#include "api_result.hpp"
+#include "batch.hpp"
 #include "helper.hpp"
+#include "output.hpp"
 
 #define MIN_CLASS_CONFIDENCE 0.5f
 
@@ -34,7 +37,7 @@ using namespace std;
 /**
  * @brief      Processes the input images and detects objects in them.
  *
- * @param      url        - The URL of the API server
+ * @param      session    - Connection to the API server
  * @param      image_dir  - The directory where the input images are stored.
  * @param      out_dir    - The directory where the output images with objects
  *                        detected will be saved.
@@ -43,62 +46,44 @@ using namespace std;
  *
  * @return     void
  */
-void detect_face(std::string &url, std::string &image_path,
+void detect_face(ApiSession &session, std::string &image_path,
 		 const std::string out_dir, const bool save, const bool display)
 {
-	rapidjson::Document output_json;
-	Http::Experimental::Client client;
-	std::vector<Async::Promise<Http::Response> > responses;
-	auto opts = Http::Experimental::Client::options()
-			    .threads(8)
-			    .maxConnectionsPerHost(1)
-			    .maxResponseSize(1024 * 1024 * 100);
-
-	client.init(opts);
-
-	// Read the image using OpenCV
-	cv::Mat image = cv::imread(image_path);
+	ApiResult output;
 
 	// Send the image as a request to the specified web page
 	std::string result =
-		send_request_to_api_server(image, client, url, responses);
+		response_body(session.classify_image(image_path).get());
 
-	if (output_json.Parse(result.c_str()).HasParseError()) {
-		std::cerr
-			<< "Error: Failed to parse JSON output from API server. "
-			<< result << std::endl;
+	if (!parse_api_result_or_report(result, output)) {
 		return;
 	}
 
-	if (output_json.HasMember("error")) {
-		// Print error and return
-		std::cerr << "Error: Server returned error\nCode: "
-			  << output_json["error"]["code"].GetInt()
-			  << "\nReason: "
-			  << output_json["error"]["message"].GetString()
+	if (output.classes.size() < 1) {
+		std::cerr << "Error: No class detected in input image."
 			  << std::endl;
 		return;
 	}
 
-	if (output_json["result"]["classes"].Size() < 1) {
-		std::cerr << "Error: No class detected in input image."
-			  << std::endl;
+	if (!display && !save) {
+		/* Nothing to render, the image is never decoded */
 		return;
 	}
 
-	cv::Mat frame = image.clone();
-	for (auto i = 0; i < output_json["result"]["classes"].Size(); i++) {
-		float confidence =
-			output_json["result"]["classes"][i]["confidence"]
-				.GetFloat();
+	// Read the image using OpenCV and draw on it in place
+	cv::Mat frame = read_image(image_path);
+	if (frame.empty()) {
+		std::cerr << "Error: Cannot read image " << image_path
+			  << std::endl;
+		return;
+	}
+	for (auto &cls : output.classes) {
 		/*Check if the confidence is above threshold*/
-		if (confidence < MIN_CLASS_CONFIDENCE) {
+		if (cls.confidence < MIN_CLASS_CONFIDENCE) {
 			continue;
 		}
 
-		std::string obj =
-			output_json["result"]["classes"][i]["class"].GetString();
-		string label = obj + " " + std::to_string(confidence);
+		string label = cls.label + " " + std::to_string(cls.confidence);
 		draw_label(frame, label, 0, 0);
 	}
 	if (display) {
@@ -107,20 +92,20 @@ void detect_face(std::string &url, std::string &image_path,
 	if (save) {
 		save_to_disk(frame, image_path, out_dir);
 	}
-
-	client.shutdown();
 }
 
 int main(int argc, char **argv)
 {
-	std::string url = "http://localhost:9900/v1/classifyimage";
+	std::string url = api_servers("http://localhost:9900");
 	std::string input_img = "../sample_inputs/images/cat.jpg";
 	std::string output_dir = "./output";
 	bool save = true;
-	bool display = true;
-
-	cout << "Starting client...\n";
-	detect_face(url, input_img, output_dir, save, display);
-
-	return 0;
+	bool display = display_enabled();
+
+	return run_image_example(
+		argc, argv, url, input_img,
+		[&](ApiSession &session, std::string &image_path, bool) {
+			detect_face(session, image_path, output_dir, save,
+				    display);
+		});
 }
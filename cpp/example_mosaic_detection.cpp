@@ -0,0 +1,173 @@
+/**
+ * @brief      This file implements api client example detecting on many
+ *             small images packed into mosaics.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+
+#include <chrono>
+#include <future>
+#include <iostream>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "api_result.hpp"
+#include "batch.hpp"
+#include "helper.hpp"
+#include "mosaic.hpp"
+#include "output.hpp"
+
+#define MIN_DET_CONFIDENCE 0.5f
+
+/* Images decoded and sent at a time */
+#define MOSAIC_CHUNK 64
+
+using namespace std;
+
+/**
+ * @brief      Throughput of sending the same images one per request, to
+ *             compare the mosaics with.
+ *
+ * @return     Images per second
+ */
+static double single_image_rate(ApiSession &session,
+				const std::string &endpoint,
+				const std::vector<std::string> &paths)
+{
+	std::vector<std::future<ApiResponse> > responses;
+	std::vector<double> scales;
+	auto start = std::chrono::steady_clock::now();
+
+	for (auto &path : paths) {
+		cv::Mat image = read_image(path);
+		if (image.empty()) {
+			continue;
+		}
+		std::string body;
+		scales.push_back(
+			encode_upload(image, session.upload_options(), body));
+		responses.push_back(session.post(endpoint, std::move(body)));
+	}
+	ApiResult result;
+	for (size_t i = 0; i < responses.size(); i++) {
+		std::string body = responses[i].get().body;
+		if (parse_api_result(body, result) && !result.has_error) {
+			result.rescale(scales[i]);
+		}
+	}
+	double seconds = std::chrono::duration<double>(
+				 std::chrono::steady_clock::now() - start)
+				 .count();
+	return seconds > 0 ? responses.size() / seconds : 0;
+}
+
+int main(int argc, char **argv)
+{
+	std::string url = api_servers("http://localhost:9900");
+	std::string input = "../sample_inputs/images";
+	std::string endpoint = API_DETECT_OBJECTS;
+	std::string output_dir = "./output";
+	bool save = true;
+	ApiSessionOptions options;
+	MosaicOptions mosaic;
+
+	if (argc > 1) {
+		input = argv[1];
+	}
+	if (argc > 2 && std::string(argv[2]) == "faces") {
+		endpoint = API_DETECT_FACE;
+	}
+
+	std::vector<std::string> paths = list_images(input);
+	if (paths.empty()) {
+		std::cerr << "Usage: " << argv[0]
+			  << " [directory | list.txt] [objects | faces]"
+			  << std::endl;
+		return 1;
+	}
+
+	ApiSession session(url, options);
+	MosaicBatcher batcher(mosaic);
+	std::vector<cv::Mat> images;
+	std::vector<ApiResult> results;
+	size_t boxes = 0;
+
+	/* Baseline on the first chunk, timed like the mosaics: decode,
+	 * encode, requests and parsing */
+	std::vector<std::string> sample(
+		paths.begin(),
+		paths.begin() + std::min<size_t>(MOSAIC_CHUNK, paths.size()));
+	double single_rate = single_image_rate(session, endpoint, sample);
+	cout << "One image per request: " << single_rate << " images/s on "
+	     << sample.size() << " images" << std::endl;
+
+	cout << "Starting client on " << paths.size() << " images...\n";
+	auto start = std::chrono::steady_clock::now();
+	for (size_t first = 0; first < paths.size(); first += MOSAIC_CHUNK) {
+		size_t count = std::min<size_t>(MOSAIC_CHUNK,
+						paths.size() - first);
+		images.clear();
+		for (size_t i = 0; i < count; i++) {
+			images.push_back(read_image(paths[first + i]));
+		}
+
+		batcher.detect(session, endpoint, images, results);
+
+		for (size_t i = 0; i < count; i++) {
+			size_t found = 0;
+			for (auto &object : results[i].objects) {
+				if (object.confidence < MIN_DET_CONFIDENCE) {
+					continue;
+				}
+				found++;
+				draw_bounding_box(images[i], object.box.left,
+						  object.box.top,
+						  object.box.width,
+						  object.box.height);
+				draw_label(images[i], object.object,
+					   object.box.left, object.box.top);
+			}
+			for (auto &face : results[i].faces) {
+				if (face.confidence < MIN_DET_CONFIDENCE) {
+					continue;
+				}
+				found++;
+				draw_bounding_box(images[i], face.box.left,
+						  face.box.top, face.box.width,
+						  face.box.height);
+			}
+			boxes += found;
+			std::cout << paths[first + i] << ": " << found
+				  << " detections" << std::endl;
+			if (save && !images[i].empty()) {
+				save_to_disk(images[i], paths[first + i],
+					     output_dir);
+			}
+		}
+	}
+	double seconds = std::chrono::duration<double>(
+				 std::chrono::steady_clock::now() - start)
+				 .count();
+
+	/* Report writes that failed before the summary */
+	finish_outputs(false);
+
+	std::cout << "Processed " << batcher.images() << " images with "
+		  << batcher.requests() << " requests ("
+		  << (double)batcher.images() / std::max<size_t>(
+							batcher.requests(), 1)
+		  << " images per request, " << boxes << " detections) in "
+		  << seconds << " s, " << batcher.images() / seconds
+		  << " images/s";
+	if (single_rate > 0) {
+		std::cout << ", " << batcher.images() / seconds / single_rate
+			  << "x one image per request";
+	}
+	std::cout << std::endl;
+	std::cout << "Grid settled at " << batcher.grid() << "x"
+		  << batcher.grid() << ", " << batcher.latency_ms()
+		  << " ms per mosaic" << std::endl;
+	return 0;
+}
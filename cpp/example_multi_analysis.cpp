@@ -0,0 +1,137 @@
+/**
+ * @brief      This file implements api client example running every
+ *             image endpoint on the same image.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/highgui.hpp>
+
+#include "api_result.hpp"
+#include "batch.hpp"
+#include "helper.hpp"
+#include "output.hpp"
+
+#define MIN_FACE_DET_CONFIDENCE 0.5f
+#define MIN_OBJ_DET_CONFIDENCE 0.5f
+#define MIN_POSE_DET_CONFIDENCE 0.2f
+
+using namespace std;
+
+/**
+ * @brief      Runs face, object, pose detection and classification on an
+ *             image and combines the results.
+ *
+ *             The image is uploaded once per endpoint from a single
+ *             encoded buffer and the four requests are in flight at the
+ *             same time. The merged result is saved as
+ *             <out_dir>/result_<image>.json next to one overlay image.
+ *
+ * @param      session    - Connection to the API server
+ * @param      image_path - Image to analyse
+ * @param      out_dir    - The directory where the results are saved
+ * @param      save       - Save the merged result and the overlay
+ * @param      display    - Show the overlay
+ */
+void analyze_image(ApiSession &session, std::string &image_path,
+		   const std::string out_dir, const bool save,
+		   const bool display)
+{
+	static const std::vector<std::string> endpoints = {
+		API_DETECT_OBJECTS, API_ESTIMATE_POSE, API_DETECT_FACE,
+		API_CLASSIFY_IMAGE
+	};
+	ApiResult merged, output;
+	double scale = 1.0;
+
+	auto start = std::chrono::steady_clock::now();
+	auto responses = session.analyze(endpoints, image_path, &scale);
+	for (size_t i = 0; i < responses.size(); i++) {
+		std::string result = responses[i].get().body;
+		if (!parse_api_result(result, output) || output.has_error) {
+			std::cerr << "Error: " << endpoints[i] << " failed "
+				  << output.error.message << std::endl;
+			continue;
+		}
+		output.rescale(scale);
+		merged.merge(output);
+	}
+	double ms = std::chrono::duration<double, std::milli>(
+			    std::chrono::steady_clock::now() - start)
+			    .count();
+
+	std::cout << image_path << ": " << merged.objects.size()
+		  << " objects, " << merged.poses.size() << " poses, "
+		  << merged.faces.size() << " faces, "
+		  << (merged.classes.empty() ? "unclassified" :
+					       merged.classes[0].label)
+		  << " (" << endpoints.size() << " endpoints in " << ms
+		  << " ms)" << std::endl;
+
+	if (save) {
+		output_writer().write_text(
+			api_result_to_json(merged) + "\n",
+			out_dir + "/result_" +
+				filesystem::path(image_path).stem().string() +
+				".json");
+	}
+
+	if (!display && !save) {
+		return;
+	}
+	cv::Mat frame = read_image(image_path);
+	if (frame.empty()) {
+		std::cerr << "Error: Cannot read image " << image_path
+			  << std::endl;
+		return;
+	}
+	for (auto &object : merged.objects) {
+		if (object.confidence < MIN_OBJ_DET_CONFIDENCE) {
+			continue;
+		}
+		draw_bounding_box(frame, object.box.left, object.box.top,
+				  object.box.width, object.box.height);
+		draw_label(frame, object.object, object.box.left,
+			   object.box.top);
+	}
+	for (auto &face : merged.faces) {
+		if (face.confidence < MIN_FACE_DET_CONFIDENCE) {
+			continue;
+		}
+		draw_bounding_box(frame, face.box.left, face.box.top,
+				  face.box.width, face.box.height);
+	}
+	draw_poses(frame, merged.poses, MIN_POSE_DET_CONFIDENCE);
+	if (!merged.classes.empty()) {
+		draw_label(frame, merged.classes[0].label, 0, 0);
+	}
+
+	if (display) {
+		display_output_image(frame);
+	}
+	if (save) {
+		save_to_disk(frame, image_path, out_dir);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::string url = api_servers("http://localhost:9900");
+	std::string input_img = "../sample_inputs/images/pose2.jpg";
+	std::string output_dir = "./output";
+	bool save = true;
+	bool display = display_enabled();
+
+	return run_image_example(
+		argc, argv, url, input_img,
+		[&](ApiSession &session, std::string &image_path, bool) {
+			analyze_image(session, image_path, output_dir, save,
+				      display);
+		});
+}
@@ -25,7 +25,11 @@
 #include <rapidjson/prettywriter.h>
 #include <rapidjson/istreamwrapper.h>
 #include <rapidjson/ostreamwrapper.h>
+#include "api_result.hpp"
+#include "batch.hpp"
 #include "helper.hpp"
+#include "output.hpp"
+#include "tiling.hpp"
 
 #define MIN_OBJ_DET_CONFIDENCE 0.5f
 
@@ -35,7 +39,7 @@ using namespace std;
 /**
  * @brief      Processes the input images and detects objects in them.
  *
- * @param      url        - The URL of the API server
+ * @param      session    - Connection to the API server
  * @param      image_dir  - The directory where the input images are stored.
  * @param      out_dir    - The directory where the output images with objects
  *                        detected will be saved.
@@ -44,76 +48,68 @@ using namespace std;
  *
  * @return     void
  */
-void detect_objects(std::string &url, std::string &image_path,
+void detect_objects(ApiSession &session, std::string &image_path,
 		    const std::string out_dir, const bool save,
 		    const bool display)
 {
-	rapidjson::Document output_json;
-	Http::Experimental::Client client;
-	std::vector<Async::Promise<Http::Response> > responses;
-	auto opts = Http::Experimental::Client::options()
-			    .threads(8)
-			    .maxConnectionsPerHost(1)
-			    .maxResponseSize(1024 * 1024 * 100);
-
-	client.init(opts);
-
-	// Read the image using OpenCV
-	cv::Mat image = cv::imread(image_path);
-
-	// Send the image as a request to the specified web page
-	std::string result =
-		send_request_to_api_server(image, client, url, responses);
-
-	if (output_json.Parse(result.c_str()).HasParseError())
-		std::cerr
-			<< "Error: Failed to parse JSON output from API server. "
-			<< result << std::endl;
+	ApiResult output;
+	TileOptions tiles;
+	cv::Mat frame;
+
+	if (load_for_tiling(image_path, tiles, frame)) {
+		/* Too large to downscale without losing small objects */
+		if (!detect_tiled(session, API_DETECT_OBJECTS, frame, tiles,
+				  output)) {
+			return;
+		}
+	} else {
+		// Send the image as a request to the specified web page
+		double scale = 1.0;
+		/* Other images were decoded by load_for_tiling() */
+		std::future<ApiResponse> response =
+			frame.empty() ?
+				session.detect_objects(image_path, &scale) :
+				session.detect_objects(frame, &scale);
+		std::string result = response_body(response.get());
+
+		if (!parse_api_result_or_report(result, output)) {
+			return;
+		}
+		output.rescale(scale);
+	}
 
-	if (output_json.HasMember("error")) {
-		// Print error and return
-		std::cerr << "Error: Server returned error\nCode: "
-			  << output_json["error"]["code"].GetInt()
-			  << "\nReason: "
-			  << output_json["error"]["message"].GetString()
+	if (output.objects.size() < 1) {
+		std::cerr << "Error: No objects Detected in input image."
 			  << std::endl;
 		return;
 	}
 
-	if (output_json["result"]["objects"].Size() < 1) {
-		std::cerr << "Error: No objects Detected in input image."
-			  << std::endl;
+	if (!display && !save) {
+		/* Nothing to render, the image is never decoded */
 		return;
 	}
 
-	cv::Mat frame = image.clone();
-	for (auto i = 0; i < output_json["result"]["objects"].Size(); i++) {
-		float confidence =
-			output_json["result"]["objects"][i]["confidence"]
-				.GetFloat();
+	// Read the image using OpenCV and draw on it in place
+	if (frame.empty()) {
+		frame = read_image(image_path);
+	}
+	if (frame.empty()) {
+		std::cerr << "Error: Cannot read image " << image_path
+			  << std::endl;
+		return;
+	}
+	for (auto &object : output.objects) {
 		/*Check if the confidence is above threshold*/
-		if (confidence < MIN_OBJ_DET_CONFIDENCE) {
+		if (object.confidence < MIN_OBJ_DET_CONFIDENCE) {
 			continue;
 		}
-		int top = (int)output_json["result"]["objects"][i]
-					  ["boundingBox"]["top"]
-						  .GetFloat();
-
-		int left = (int)output_json["result"]["objects"][i]
-					   ["boundingBox"]["left"]
-						   .GetFloat();
+		int top = (int)object.box.top;
+		int left = (int)object.box.left;
+		int width = (int)object.box.width;
+		int height = (int)object.box.height;
 
-		int width = (int)output_json["result"]["objects"][i]
-					    ["boundingBox"]["width"]
-						    .GetFloat();
-
-		int height = (int)output_json["result"]["objects"][i]
-					     ["boundingBox"]["height"]
-						     .GetFloat();
-
-		std::string obj = output_json["result"]["objects"][i]["object"]
-					  .GetString();
-		string label = obj + " " + std::to_string(confidence);
+		string label =
+			object.object + " " + std::to_string(object.confidence);
 		draw_bounding_box(frame, left, top, width, height);
 		draw_label(frame, label, left, top);
 	}
@@ -123,20 +119,20 @@ void detect_objects(std::string &url, std::string &image_path,
 	if (save) {
 		save_to_disk(frame, image_path, out_dir);
 	}
-
-	client.shutdown();
 }
 
 int main(int argc, char **argv)
 {
-	std::string url = "http://localhost:9900/v1/detectobjects";
+	std::string url = api_servers("http://localhost:9900");
 	std::string input_img = "../sample_inputs/images/car.jpg";
 	std::string output_dir = "./output";
 	bool save = true;
-	bool display = true;
-
-	cout << "Starting client...\n";
-	detect_objects(url, input_img, output_dir, save, display);
-
-	return 0;
+	bool display = display_enabled();
+
+	return run_image_example(
+		argc, argv, url, input_img,
+		[&](ApiSession &session, std::string &image_path, bool) {
+			detect_objects(session, image_path, output_dir, save,
+				       display);
+		});
 }
@@ -0,0 +1,597 @@
+/**
+ * @brief      This file implements api client example for video streams.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <filesystem>
+#include <map>
+#include <thread>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "api_result.hpp"
+#include "bounded_queue.hpp"
+#include "helper.hpp"
+#include "motion_gate.hpp"
+#include "trace.hpp"
+#include "tracker.hpp"
+
+#define MIN_OBJ_DET_CONFIDENCE 0.5f
+
+/* Frames buffered between two stages */
+#define QUEUE_DEPTH 4
+
+/* A request is failed after this long, its frame shown without a result */
+#define REQUEST_TIMEOUT_MS 1000
+
+/* Frames held back behind a missing one, and how long, before the missing
+ * frame is given up and shown without a result */
+#define REORDER_MAX_FRAMES (4 * QUEUE_DEPTH)
+#define REORDER_MAX_MS 2000
+
+using namespace std;
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * @brief      Milliseconds elapsed since a time point.
+ */
+static double elapsed_ms(Clock::time_point since)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - since)
+		.count();
+}
+
+/**
+ * @brief      One detected object, in original frame coordinates.
+ */
+struct Detection {
+	std::string label;
+	float confidence;
+	int left, top, width, height;
+};
+
+/**
+ * @brief      A frame travelling through the pipeline.
+ */
+struct VideoFrame {
+	size_t seq;		   /* Position in the stream */
+	cv::Mat image;		   /* Decoded frame, full resolution */
+	std::string jpeg;	   /* Resized and encoded frame */
+	double scale = 1.0;	   /* Original size / uploaded size */
+	cv::Mat motion;		   /* Reduced frame of the motion gate */
+	MotionGate::Decision gate = MotionGate::Motion;
+	bool inferred = false;	   /* A detection result arrived */
+	std::atomic<bool> claimed{ false }; /* Taken by the response, or given
+					     * up by the reorder stage */
+	std::string result;	   /* JSON response of the server */
+	double request_ms = 0;	   /* Upload + inference time */
+	Clock::time_point decoded; /* For end-to-end latency */
+};
+
+typedef std::shared_ptr<VideoFrame> FramePtr;
+
+/**
+ * @brief      Processing time statistics of one stage.
+ */
+struct StageStats {
+	const char *name;
+	size_t count = 0;
+	double total_ms = 0;
+	double max_ms = 0;
+
+	explicit StageStats(const char *stage) : name(stage) {}
+
+	void add(double ms)
+	{
+		count++;
+		total_ms += ms;
+		max_ms = std::max(max_ms, ms);
+	}
+
+	void print() const
+	{
+		std::cout << "  " << name << ": avg "
+			  << (count ? total_ms / count : 0) << " ms, max "
+			  << max_ms << " ms (" << count << " frames)"
+			  << std::endl;
+	}
+};
+
+/**
+ * @brief      Parse a /v1/detectobjects response.
+ *
+ * @param      json    The response, parsed in place
+ * @param[in]  scale   Factor from uploaded to original coordinates
+ * @param      parsed  Scratch result reused across frames
+ * @param      out     Detections above MIN_OBJ_DET_CONFIDENCE
+ *
+ * @return     false if the response holds no result
+ */
+static bool parse_objects(std::string &json, double scale, ApiResult &parsed,
+			  std::vector<Detection> &out)
+{
+	if (!parse_api_result(json, parsed) || parsed.has_error) {
+		return false;
+	}
+
+	out.clear();
+	for (auto &object : parsed.objects) {
+		if (object.confidence < MIN_OBJ_DET_CONFIDENCE) {
+			continue;
+		}
+		Detection d;
+		d.label = object.object;
+		d.confidence = object.confidence;
+		d.top = (int)(object.box.top * scale);
+		d.left = (int)(object.box.left * scale);
+		d.width = (int)(object.box.width * scale);
+		d.height = (int)(object.box.height * scale);
+		out.push_back(d);
+	}
+	return true;
+}
+
+/**
+ * @brief      Detections of the boxes a tracker currently predicts.
+ */
+static void track_detections(const std::vector<Track> &tracks,
+			     std::vector<Detection> &out)
+{
+	out.clear();
+	for (auto &t : tracks) {
+		out.push_back({ t.label, t.confidence, (int)t.box.left,
+				(int)t.box.top, (int)t.box.width,
+				(int)t.box.height });
+	}
+}
+
+/**
+ * @brief      Share of detections two results agree on.
+ *
+ *             Greedy matching of boxes with the same label and an
+ *             intersection over union of at least 0.5.
+ *
+ * @return     2 x matches / (old + new), 1 when both are empty
+ */
+static double agreement(const std::vector<Detection> &old_detections,
+			const std::vector<Detection> &new_detections)
+{
+	size_t total = old_detections.size() + new_detections.size();
+	std::vector<bool> used(new_detections.size(), false);
+	size_t matches = 0;
+
+	if (total == 0) {
+		return 1;
+	}
+	for (auto &a : old_detections) {
+		cv::Rect ra(a.left, a.top, a.width, a.height);
+		for (size_t i = 0; i < new_detections.size(); i++) {
+			auto &b = new_detections[i];
+			cv::Rect rb(b.left, b.top, b.width, b.height);
+			double overlap = (ra & rb).area();
+			if (used[i] || a.label != b.label ||
+			    overlap < 0.5 * (ra.area() + rb.area() - overlap)) {
+				continue;
+			}
+			used[i] = true;
+			matches++;
+			break;
+		}
+	}
+	return 2.0 * matches / total;
+}
+
+/**
+ * @brief      Multi-threaded object detection pipeline for a video.
+ *
+ *             decode -> resize/encode -> submit -> reorder -> overlay ->
+ *             write, each stage on its own thread with a bounded queue in
+ *             between. When the request window is full the frame is not
+ *             sent and the last detections are drawn on it instead, so a
+ *             slow server never builds up a backlog. A frame whose answer
+ *             is late is written without it once REORDER_MAX_FRAMES frames
+ *             or REORDER_MAX_MS wait behind it.
+ *
+ *             Detections feed a tracker that keeps an id per object and
+ *             moves its box on every frame, including frames that got no
+ *             result, so boxes follow the objects between two results.
+ *
+ *             With the motion gate enabled, frames that barely differ from
+ *             the last one sent are not encoded or sent at all and reuse
+ *             the tracked boxes the same way. Refreshes forced by the
+ *             gate are compared with the boxes they replace, which tells
+ *             how much accuracy the skipped requests cost.
+ */
+class VideoPipeline {
+public:
+	VideoPipeline(ApiSession &session, const std::string &input,
+		      const std::string &output, bool realtime,
+		      const MotionGateOptions &gate)
+		: session_(session), input_(input), output_(output),
+		  realtime_(realtime), gate_options_(gate), gate_(gate),
+		  decoded_(QUEUE_DEPTH),
+		  encoded_(QUEUE_DEPTH), results_(QUEUE_DEPTH),
+		  ordered_(QUEUE_DEPTH), rendered_(QUEUE_DEPTH)
+	{
+	}
+
+	/**
+	 * @brief      Process the whole video.
+	 *
+	 * @return     false if the input could not be opened
+	 */
+	bool run();
+
+private:
+	void decode_stage();
+	void encode_stage();
+	void submit_stage();
+	void reorder_stage();
+	FramePtr give_up(size_t seq);
+	void overlay_stage();
+	void write_stage();
+
+	ApiSession &session_;
+	std::string input_;
+	std::string output_;
+	bool realtime_;
+	MotionGateOptions gate_options_;
+	MotionGate gate_;
+	cv::VideoCapture capture_;
+	double fps_ = 25;
+
+	BoundedQueue<FramePtr> decoded_;
+	BoundedQueue<FramePtr> encoded_;
+	BoundedQueue<FramePtr> results_;
+	BoundedQueue<FramePtr> ordered_;
+	BoundedQueue<FramePtr> rendered_;
+
+	std::mutex request_mutex_; /* request_stats_ is updated by I/O threads */
+	std::mutex flight_mutex_;
+	std::map<size_t, FramePtr> in_flight_; /* Sent, no response yet */
+	std::atomic<size_t> dropped_{ 0 };
+	size_t given_up_ = 0;	   /* Sent, shown without waiting for it */
+	size_t gated_ = 0;
+	size_t refreshes_ = 0;	   /* Forced refreshes with a result */
+	double agreement_ = 0;	   /* Sum over refreshes */
+	size_t written_ = 0;
+	StageStats decode_stats_{ "decode" };
+	StageStats gate_stats_{ "motion gate" };
+	StageStats encode_stats_{ "resize+encode" };
+	StageStats submit_stats_{ "submit" };
+	StageStats request_stats_{ "request" };
+	StageStats reorder_stats_{ "reorder wait" };
+	StageStats overlay_stats_{ "overlay" };
+	StageStats write_stats_{ "write" };
+	StageStats total_stats_{ "end-to-end" };
+};
+
+void VideoPipeline::decode_stage()
+{
+	auto interval = std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>(1.0 / fps_));
+	auto due = Clock::now();
+
+	for (size_t seq = 0;; seq++) {
+		if (realtime_) {
+			/* Emit frames at the video rate like a camera would */
+			std::this_thread::sleep_until(due);
+			due += interval;
+		}
+		auto start = Clock::now();
+		uint64_t traced = trace_clock();
+		FramePtr frame = std::make_shared<VideoFrame>();
+		if (!capture_.read(frame->image) || frame->image.empty()) {
+			break;
+		}
+		trace_record(TRACE_DECODE, traced, trace_clock());
+		frame->seq = seq;
+		frame->decoded = start;
+		decode_stats_.add(elapsed_ms(start));
+		if (!decoded_.push(frame)) {
+			break;
+		}
+	}
+	decoded_.close();
+}
+
+void VideoPipeline::encode_stage()
+{
+	FramePtr frame;
+
+	while (decoded_.pop(frame)) {
+		auto start = Clock::now();
+		if (gate_options_.enabled) {
+			frame->gate = gate_.check(frame->image, frame->motion);
+			gate_stats_.add(elapsed_ms(start));
+			if (frame->gate == MotionGate::Skip) {
+				encoded_.push(frame);
+				continue;
+			}
+			start = Clock::now();
+		}
+		frame->scale = encode_upload(frame->image,
+					     session_.upload_options(),
+					     frame->jpeg);
+		encode_stats_.add(elapsed_ms(start));
+		encoded_.push(frame);
+	}
+	encoded_.close();
+}
+
+void VideoPipeline::submit_stage()
+{
+	FramePtr frame;
+
+	while (encoded_.pop(frame)) {
+		if (frame->gate == MotionGate::Skip) {
+			/* Static scene, the last detections still hold */
+			gated_++;
+			results_.push(frame);
+			continue;
+		}
+		auto start = Clock::now();
+		{
+			std::lock_guard<std::mutex> lock(flight_mutex_);
+			in_flight_[frame->seq] = frame;
+		}
+		bool sent = session_.try_post(
+			API_DETECT_OBJECTS, std::move(frame->jpeg),
+			[this, frame, start](ApiResponse &response) {
+				{
+					std::lock_guard<std::mutex> lock(
+						flight_mutex_);
+					in_flight_.erase(frame->seq);
+				}
+				if (frame->claimed.exchange(true)) {
+					/* Already shown without it */
+					return;
+				}
+				frame->request_ms = elapsed_ms(start);
+				frame->inferred = response.code == 200;
+				frame->result = std::move(response.body);
+				{
+					std::lock_guard<std::mutex> lock(
+						request_mutex_);
+					request_stats_.add(frame->request_ms);
+				}
+				/* I/O thread: never wait, the request window
+				 * bounds how far this overshoots */
+				results_.force_push(frame);
+			});
+		if (!sent) {
+			/* Server is behind, skip inference for this frame */
+			{
+				std::lock_guard<std::mutex> lock(flight_mutex_);
+				in_flight_.erase(frame->seq);
+			}
+			dropped_++;
+			results_.push(frame);
+		} else if (gate_options_.enabled) {
+			gate_.sent(frame->motion);
+		}
+		submit_stats_.add(elapsed_ms(start));
+	}
+	session_.wait_idle();
+	results_.close();
+}
+
+void VideoPipeline::reorder_stage()
+{
+	std::map<size_t, std::pair<FramePtr, Clock::time_point> > pending;
+	size_t next = 0;
+	FramePtr frame;
+
+	while (results_.pop(frame)) {
+		pending[frame->seq] = std::make_pair(frame, Clock::now());
+		for (;;) {
+			while (!pending.empty() &&
+			       pending.begin()->first == next) {
+				reorder_stats_.add(elapsed_ms(
+					pending.begin()->second.second));
+				ordered_.push(pending.begin()->second.first);
+				pending.erase(pending.begin());
+				next++;
+			}
+			/* A stalled request must not hold back every later
+			 * frame */
+			if (pending.empty() ||
+			    (pending.size() <= REORDER_MAX_FRAMES &&
+			     elapsed_ms(pending.begin()->second.second) <=
+				     REORDER_MAX_MS)) {
+				break;
+			}
+			FramePtr missing = give_up(next);
+			if (!missing) {
+				/* Its response is already on the way */
+				break;
+			}
+			given_up_++;
+			ordered_.push(missing);
+			next++;
+		}
+	}
+	ordered_.close();
+}
+
+/**
+ * @brief      Take a frame whose request has not been answered yet, to
+ *             show it without a result.
+ *
+ * @return     nullptr if its response arrived meanwhile
+ */
+FramePtr VideoPipeline::give_up(size_t seq)
+{
+	FramePtr frame;
+	{
+		std::lock_guard<std::mutex> lock(flight_mutex_);
+		auto it = in_flight_.find(seq);
+		if (it == in_flight_.end()) {
+			return nullptr;
+		}
+		frame = it->second;
+		in_flight_.erase(it);
+	}
+	if (frame->claimed.exchange(true)) {
+		return nullptr;
+	}
+	return frame;
+}
+
+void VideoPipeline::overlay_stage()
+{
+	std::vector<Detection> detections;
+	std::vector<Detection> predicted;
+	std::vector<TrackInput> inputs;
+	std::vector<Track> tracks;
+	ApiResult parsed;
+	Tracker tracker;
+	FramePtr frame;
+
+	while (ordered_.pop(frame)) {
+		auto start = Clock::now();
+		/* Frames without a result show where the tracks moved to */
+		tracker.predict();
+		if (frame->inferred &&
+		    parse_objects(frame->result, frame->scale, parsed,
+				  detections)) {
+			if (frame->gate == MotionGate::Refresh) {
+				tracker.tracks(tracks);
+				track_detections(tracks, predicted);
+				agreement_ += agreement(predicted, detections);
+				refreshes_++;
+			}
+			inputs.clear();
+			for (auto &d : detections) {
+				TrackInput input;
+				input.label = d.label;
+				input.confidence = d.confidence;
+				input.box.left = d.left;
+				input.box.top = d.top;
+				input.box.width = d.width;
+				input.box.height = d.height;
+				inputs.push_back(input);
+			}
+			tracker.update(inputs);
+		}
+		tracker.tracks(tracks);
+		for (auto &t : tracks) {
+			draw_bounding_box(frame->image, t.box.left, t.box.top,
+					  t.box.width, t.box.height);
+			draw_label(frame->image,
+				   "#" + std::to_string(t.id) + " " + t.label +
+					   " " + std::to_string(t.confidence),
+				   t.box.left, t.box.top);
+		}
+		overlay_stats_.add(elapsed_ms(start));
+		rendered_.push(frame);
+	}
+	rendered_.close();
+}
+
+void VideoPipeline::write_stage()
+{
+	cv::VideoWriter writer;
+	FramePtr frame;
+
+	while (rendered_.pop(frame)) {
+		auto start = Clock::now();
+		if (!writer.isOpened()) {
+			writer.open(output_,
+				    cv::VideoWriter::fourcc('M', 'J', 'P', 'G'),
+				    fps_, frame->image.size());
+		}
+		writer.write(frame->image);
+		written_++;
+		write_stats_.add(elapsed_ms(start));
+		total_stats_.add(elapsed_ms(frame->decoded));
+	}
+}
+
+bool VideoPipeline::run()
+{
+	if (!capture_.open(input_)) {
+		std::cerr << "Error: Failed to open " << input_ << std::endl;
+		return false;
+	}
+	if (capture_.get(cv::CAP_PROP_FPS) > 0) {
+		fps_ = capture_.get(cv::CAP_PROP_FPS);
+	}
+
+	auto start = Clock::now();
+	std::vector<std::thread> stages;
+	stages.emplace_back(&VideoPipeline::decode_stage, this);
+	stages.emplace_back(&VideoPipeline::encode_stage, this);
+	stages.emplace_back(&VideoPipeline::submit_stage, this);
+	stages.emplace_back(&VideoPipeline::reorder_stage, this);
+	stages.emplace_back(&VideoPipeline::overlay_stage, this);
+	stages.emplace_back(&VideoPipeline::write_stage, this);
+	for (auto &stage : stages) {
+		stage.join();
+	}
+	double seconds = elapsed_ms(start) / 1000;
+
+	std::cout << "Processed " << written_ << " frames in " << seconds
+		  << " s (" << written_ / seconds << " FPS), "
+		  << written_ - dropped_ - gated_ << " sent, " << dropped_
+		  << " dropped, " << gated_ << " skipped as static, "
+		  << given_up_ << " shown before their late result"
+		  << std::endl;
+	if (refreshes_ > 0) {
+		std::cout << "Tracked boxes matched "
+			  << 100 * agreement_ / refreshes_ << "% of "
+			  << refreshes_ << " forced refreshes" << std::endl;
+	}
+	decode_stats_.print();
+	gate_stats_.print();
+	encode_stats_.print();
+	submit_stats_.print();
+	request_stats_.print();
+	reorder_stats_.print();
+	overlay_stats_.print();
+	write_stats_.print();
+	total_stats_.print();
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	std::string url = api_servers("http://localhost:9900");
+	std::string input_video = "../sample_inputs/video/traffic-27260.mp4";
+	std::string output_dir = "./output";
+	bool realtime = true;  /* Pace decoding at the video frame rate */
+	ApiSessionOptions options;
+	MotionGateOptions gate; /* gate.enabled = false sends every frame */
+
+	options.max_in_flight = QUEUE_DEPTH;
+	/* Each request holds a full frame until the reorder stage, so the
+	 * window may not grow past the pipeline's queues */
+	options.max_limit = QUEUE_DEPTH;
+	options.timeout_ms = REQUEST_TIMEOUT_MS;
+	options.upload.max_side = 640; /* 0 keeps the original size */
+	if (argc > 1) {
+		input_video = argv[1];
+	}
+
+	if (!filesystem::exists(output_dir)) {
+		filesystem::create_directory(output_dir);
+	}
+	std::string output_video =
+		output_dir + "/result_" +
+		filesystem::path(input_video).stem().string() + ".avi";
+
+	ApiSession session(url, options);
+	VideoPipeline pipeline(session, input_video, output_video, realtime,
+			       gate);
+
+	cout << "Starting client...\n";
+	return pipeline.run() ? 0 : 1;
+}
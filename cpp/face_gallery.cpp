@@ -0,0 +1,248 @@
+/**
+ *
+ * @brief      Face gallery that follows its store while it is searched.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "face_gallery.hpp"
+#include "trace.hpp"
+
+std::vector<FaceMatch> GallerySnapshot::search(const float *query,
+					       size_t k) const
+{
+	TraceSpan span(TRACE_SEARCH);
+	std::vector<FaceMatch> top = base_->search(query, k);
+
+	if (recent_->size() == 0) {
+		return top;
+	}
+	for (auto &m : recent_->search(query, k)) {
+		top.push_back({ base_->size() + m.id, m.confidence });
+	}
+	std::sort(top.begin(), top.end(),
+		  [](const FaceMatch &a, const FaceMatch &b) {
+			  return a.confidence > b.confidence;
+		  });
+	top.resize(std::min(k, top.size()));
+	return top;
+}
+
+const std::string &GallerySnapshot::name(size_t id) const
+{
+	if (id < base_->size()) {
+		return base_->name(id);
+	}
+	return recent_->name(id - base_->size());
+}
+
+void GallerySnapshot::embedding(size_t id, std::vector<float> &out) const
+{
+	if (id < base_->size()) {
+		base_->embedding(id, out);
+	} else {
+		recent_->embedding(id - base_->size(), out);
+	}
+}
+
+FaceGallery::FaceGallery(const FaceGalleryOptions &options)
+	: options_(options)
+{
+	publish(std::make_shared<FaceIndex>(options_.index),
+		std::make_shared<FaceIndex>(options_.index));
+}
+
+FaceGallery::~FaceGallery()
+{
+	stop();
+}
+
+std::shared_ptr<const GallerySnapshot> FaceGallery::snapshot() const
+{
+	return std::atomic_load(&current_);
+}
+
+void FaceGallery::publish(std::shared_ptr<const FaceIndex> base,
+			  std::shared_ptr<const FaceIndex> recent)
+{
+	std::atomic_store(&current_,
+			  std::shared_ptr<const GallerySnapshot>(
+				  std::make_shared<GallerySnapshot>(
+					  std::move(base), std::move(recent))));
+}
+
+bool FaceGallery::open(const std::string &base)
+{
+	stop();
+	base_ = base;
+	json_.reset();
+	loaded_ = 0;
+	merged_ = 0;
+	view_.close();
+	publish(std::make_shared<FaceIndex>(options_.index),
+		std::make_shared<FaceIndex>(options_.index));
+
+	/* Follow the store even if it does not exist yet */
+	bool found = update();
+	start();
+	return found;
+}
+
+bool FaceGallery::open_json(const std::string &json_file)
+{
+	auto index = std::make_shared<FaceIndex>(options_.index);
+
+	if (!index->load_json(json_file)) {
+		return false;
+	}
+
+	/* The watcher goes on following the store, now on top of the JSON
+	 * faces */
+	std::lock_guard<std::mutex> lock(reload_);
+	json_ = index;
+	view_.close();
+	publish(json_, std::make_shared<FaceIndex>(options_.index));
+	if (!base_.empty()) {
+		update();
+	}
+	return true;
+}
+
+void FaceGallery::start()
+{
+	std::string dir = std::filesystem::path(base_).parent_path().string();
+	inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_ >= 0 &&
+	    inotify_add_watch(inotify_, dir.empty() ? "." : dir.c_str(),
+			      IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE |
+				      IN_MOVED_TO) < 0) {
+		::close(inotify_);
+		inotify_ = -1;
+	}
+	watcher_ = std::thread(&FaceGallery::watch, this);
+}
+
+void FaceGallery::stop()
+{
+	if (!watcher_.joinable()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	wake_.notify_all();
+	watcher_.join();
+	stop_ = false;
+	if (inotify_ >= 0) {
+		::close(inotify_);
+		inotify_ = -1;
+	}
+}
+
+void FaceGallery::watch()
+{
+	char events[4096];
+	struct pollfd fd = { inotify_, POLLIN, 0 };
+	int slice = std::min(options_.poll_ms, 50);
+	int waited = 0;
+
+	for (;;) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (stop_) {
+				return;
+			}
+		}
+
+		/* Short slices so stop() does not wait for a whole poll_ms */
+		bool changed = false;
+		if (inotify_ >= 0) {
+			changed = poll(&fd, 1, slice) > 0;
+			while (read(inotify_, events, sizeof(events)) > 0) {
+			}
+		} else {
+			std::unique_lock<std::mutex> lock(mutex_);
+			wake_.wait_for(lock, std::chrono::milliseconds(slice),
+				       [this] { return stop_; });
+		}
+		waited += slice;
+		if (!changed && waited < options_.poll_ms) {
+			continue;
+		}
+		waited = 0;
+		std::lock_guard<std::mutex> lock(reload_);
+		if (update()) {
+			updates_++;
+		}
+	}
+}
+
+bool FaceGallery::update()
+{
+	std::shared_ptr<const GallerySnapshot> current = snapshot();
+	bool reloaded = false;
+
+	if (!view_.refresh()) {
+		/* First load, or the store was replaced: read it all again */
+		if (json_) {
+			/* Store records are added to the JSON faces */
+			if (!view_.open(base_)) {
+				return false;
+			}
+			current = std::make_shared<GallerySnapshot>(
+				json_, std::make_shared<FaceIndex>(options_.index));
+			loaded_ = 0;
+			merged_ = 0;
+			reloaded = true;
+		} else {
+			auto index = std::make_shared<FaceIndex>(options_.index);
+			if (!index->load_store(base_)) {
+				return false;
+			}
+			index->index_store(base_);
+			view_.open(base_);
+			loaded_ = index->size();
+			merged_ = loaded_;
+			publish(index,
+				std::make_shared<FaceIndex>(options_.index));
+			return true;
+		}
+	}
+	if (view_.size() <= loaded_) {
+		if (reloaded) {
+			publish(current->base(), current->recent());
+		}
+		return reloaded;
+	}
+
+	/* The snapshot holds the first loaded_ records of the store */
+	auto recent = std::make_shared<FaceIndex>(*current->recent());
+	for (size_t i = loaded_; i < view_.size(); i++) {
+		recent->add(view_.name(i), view_.embedding(i), view_.dim());
+	}
+	loaded_ = view_.size();
+
+	std::shared_ptr<const FaceIndex> base = current->base();
+	if (recent->size() >= options_.merge_rows) {
+		auto merged = std::make_shared<FaceIndex>(*base);
+		for (size_t i = merged_; i < loaded_; i++) {
+			merged->add(view_.name(i), view_.embedding(i),
+				    view_.dim());
+		}
+		merged_ = loaded_;
+		base = merged;
+		recent = std::make_shared<FaceIndex>(options_.index);
+	}
+	publish(base, recent);
+	return true;
+}
@@ -0,0 +1,155 @@
+/**
+ *
+ * @brief      Face gallery that follows its store while it is searched.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef FACE_GALLERY_HPP
+#define FACE_GALLERY_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "face_index.hpp"
+#include "face_store.hpp"
+
+/**
+ * @brief      How a gallery follows its store.
+ */
+struct FaceGalleryOptions {
+	FaceIndexOptions index;	  /* Storage of the embeddings */
+	int poll_ms = 250;	  /* Store checked at least this often, for
+				   * file systems without inotify */
+	size_t merge_rows = 2048; /* Recent faces folded into the main index */
+};
+
+/**
+ * @brief      Immutable state of a gallery at one point in time.
+ *
+ *             The faces loaded at startup (base) and the ones enrolled
+ *             since (recent) are searched together; match ids count the
+ *             base rows first.
+ */
+class GallerySnapshot {
+public:
+	GallerySnapshot(std::shared_ptr<const FaceIndex> base,
+			std::shared_ptr<const FaceIndex> recent)
+		: base_(std::move(base)), recent_(std::move(recent))
+	{
+	}
+
+	/**
+	 * @brief      Find the k most similar entries, best first.
+	 */
+	std::vector<FaceMatch> search(const float *query, size_t k) const;
+
+	const std::string &name(size_t id) const;
+	void embedding(size_t id, std::vector<float> &out) const;
+
+	size_t size() const { return base_->size() + recent_->size(); }
+	size_t dim() const
+	{
+		return base_->dim() ? base_->dim() : recent_->dim();
+	}
+
+	const std::shared_ptr<const FaceIndex> &base() const { return base_; }
+	const std::shared_ptr<const FaceIndex> &recent() const
+	{
+		return recent_;
+	}
+
+private:
+	std::shared_ptr<const FaceIndex> base_;
+	std::shared_ptr<const FaceIndex> recent_;
+};
+
+/**
+ * @brief      Face gallery kept in memory and updated as faces are enrolled.
+ *
+ *             A watcher thread waits on inotify for the store to grow
+ *             (and checks it every poll_ms anyway), maps the new records
+ *             and publishes a new snapshot. Snapshots are never modified:
+ *             an update builds the next one next to the current one and
+ *             swaps a pointer, so a search never waits for a reload and
+ *             never touches the disk, and a snapshot taken stays valid as
+ *             long as it is held.
+ *
+ *             New faces go to a small recent index, which is copied on
+ *             every update and searched exhaustively. Once it holds
+ *             merge_rows faces the watcher folds it into a copy of the base
+ *             index, graph included, and publishes that as the new base.
+ *
+ *             snapshot() is thread safe.
+ */
+class FaceGallery {
+public:
+	explicit FaceGallery(
+		const FaceGalleryOptions &options = FaceGalleryOptions());
+	~FaceGallery();
+
+	FaceGallery(const FaceGallery &) = delete;
+	FaceGallery &operator=(const FaceGallery &) = delete;
+
+	/**
+	 * @brief      Load a face store and follow it.
+	 *
+	 *             The store is searched through its graph as described in
+	 *             FaceIndex::index_store().
+	 *
+	 * @param[in]  base  Path of the store without extension
+	 *
+	 * @return     false if the store does not exist or is not valid
+	 */
+	bool open(const std::string &base);
+
+	/**
+	 * @brief      Load a face_embeddings.json gallery, which is not
+	 *             followed.
+	 *
+	 *             A store opened before keeps being followed, also if it
+	 *             does not exist yet: its faces are searched together with
+	 *             the JSON ones.
+	 *
+	 * @return     false if the file cannot be read
+	 */
+	bool open_json(const std::string &json_file);
+
+	/**
+	 * @brief      Current state, to search and name matches from.
+	 */
+	std::shared_ptr<const GallerySnapshot> snapshot() const;
+
+	/* Updates published since open() */
+	size_t updates() const { return updates_; }
+
+private:
+	void publish(std::shared_ptr<const FaceIndex> base,
+		     std::shared_ptr<const FaceIndex> recent);
+	void start();
+	void watch();
+	bool update();
+	void stop();
+
+	FaceGalleryOptions options_;
+	std::string base_;
+	std::shared_ptr<const FaceIndex> json_; /* Under the store, if set */
+	std::shared_ptr<const GallerySnapshot> current_;
+	FaceStoreView view_;  /* Store as far as it is loaded */
+	size_t loaded_ = 0;   /* Store records in the snapshot */
+	size_t merged_ = 0;   /* Store records in its base index */
+	std::thread watcher_;
+	std::mutex mutex_;
+	std::mutex reload_;   /* Held while the store state is updated */
+	std::condition_variable wake_;
+	bool stop_ = false;
+	int inotify_ = -1;
+	std::atomic<size_t> updates_{ 0 };
+};
+
+#endif
@@ -0,0 +1,629 @@
+/**
+ *
+ * @brief      In-process face embedding index used for face verification.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <rapidjson/document.h>
+#include <rapidjson/istreamwrapper.h>
+
+#include "face_index.hpp"
+#include "face_store.hpp"
+
+float dot_product(const float *__restrict a, const float *__restrict b,
+		  size_t n)
+{
+	float acc[8] = { 0 };
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		for (size_t j = 0; j < 8; j++) {
+			acc[j] += a[i + j] * b[i + j];
+		}
+	}
+	for (; i < n; i++) {
+		acc[0] += a[i] * b[i];
+	}
+	return ((acc[0] + acc[4]) + (acc[1] + acc[5])) +
+	       ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+}
+
+int32_t dot_product_i8(const int8_t *__restrict a, const int8_t *__restrict b,
+		       size_t n)
+{
+	int32_t sum = 0;
+	size_t i = 0;
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+	int32x4_t acc = vdupq_n_s32(0);
+	for (; i + 16 <= n; i += 16) {
+		int8x16_t x = vld1q_s8(a + i);
+		int8x16_t y = vld1q_s8(b + i);
+		acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(x), vget_low_s8(y)));
+		acc = vpadalq_s16(acc, vmull_high_s8(x, y));
+	}
+	sum = vaddvq_s32(acc);
+#elif defined(__AVX2__)
+	__m256i acc = _mm256_setzero_si256();
+	for (; i + 16 <= n; i += 16) {
+		__m256i x = _mm256_cvtepi8_epi16(
+			_mm_loadu_si128((const __m128i *)(a + i)));
+		__m256i y = _mm256_cvtepi8_epi16(
+			_mm_loadu_si128((const __m128i *)(b + i)));
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(x, y));
+	}
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc),
+				  _mm256_extracti128_si256(acc, 1));
+	s = _mm_hadd_epi32(s, s);
+	s = _mm_hadd_epi32(s, s);
+	sum = _mm_cvtsi128_si32(s);
+#elif defined(__SSE2__)
+	/* No widening load before SSE4.1: sign extend by unpack and shift */
+	__m128i acc = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		__m128i xl = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+		__m128i xh = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+		__m128i yl = _mm_srai_epi16(_mm_unpacklo_epi8(y, y), 8);
+		__m128i yh = _mm_srai_epi16(_mm_unpackhi_epi8(y, y), 8);
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(xl, yl));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(xh, yh));
+	}
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4e));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xb1));
+	sum = _mm_cvtsi128_si32(acc);
+#else
+	int32_t acc[8] = { 0 };
+	for (; i + 8 <= n; i += 8) {
+		for (size_t j = 0; j < 8; j++) {
+			acc[j] += (int32_t)a[i + j] * b[i + j];
+		}
+	}
+	sum = ((acc[0] + acc[4]) + (acc[1] + acc[5])) +
+	      ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+#endif
+	for (; i < n; i++) {
+		sum += (int32_t)a[i] * b[i];
+	}
+	return sum;
+}
+
+bool json_to_embedding(const rapidjson::Value &value, std::vector<float> &out)
+{
+	if (!value.IsArray()) {
+		return false;
+	}
+	out.resize(value.Size());
+	for (rapidjson::SizeType i = 0; i < value.Size(); i++) {
+		if (!value[i].IsNumber()) {
+			return false;
+		}
+		out[i] = value[i].GetFloat();
+	}
+	return true;
+}
+
+bool FaceIndex::load_json(const std::string &json_file)
+{
+	rapidjson::Document db;
+	std::ifstream ifs(json_file);
+
+	if (!ifs) {
+		return false;
+	}
+	rapidjson::IStreamWrapper isw(ifs);
+
+	if (db.ParseStream(isw).HasParseError() || !db.IsArray()) {
+		std::cerr << "Error: Failed to parse " << json_file << std::endl;
+		return false;
+	}
+
+	std::vector<float> values;
+	for (rapidjson::SizeType i = 0; i < db.Size(); i++) {
+		if (!db[i].HasMember("name") || !db[i].HasMember("embeddings") ||
+		    !json_to_embedding(db[i]["embeddings"], values)) {
+			std::cerr << "Warning: Skipping malformed entry " << i
+				  << " in " << json_file << std::endl;
+			continue;
+		}
+		if (!add(db[i]["name"].GetString(), values.data(),
+			 values.size())) {
+			std::cerr << "Warning: Skipping entry " << i
+				  << " with wrong embedding size" << std::endl;
+		}
+	}
+	return true;
+}
+
+#define FACE_CODES_MAGIC "BPQ8"
+#define FACE_CODES_VERSION 1
+
+/* Header of a codes file, followed by the codes and the norms of all rows */
+struct FaceCodesHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t dim;
+	uint32_t reserved;
+	uint64_t count;
+};
+
+/**
+ * @brief      Float rows as seen by the graph.
+ */
+class FaceIndex::FloatRows : public HnswSpace {
+public:
+	explicit FloatRows(const FaceIndex &index) : index_(index) {}
+
+	const void *row(uint32_t id) const override
+	{
+		return index_.data_.data() + (size_t)id * index_.dim_;
+	}
+
+	float distance(uint32_t id, const void *query) const override
+	{
+		return 1.0f - dot_product((const float *)row(id),
+					  (const float *)query, index_.dim_);
+	}
+
+private:
+	const FaceIndex &index_;
+};
+
+/**
+ * @brief      int8 codes as seen by the graph.
+ */
+class FaceIndex::CodeRows : public HnswSpace {
+public:
+	explicit CodeRows(const FaceIndex &index) : index_(index) {}
+
+	const void *row(uint32_t id) const override
+	{
+		return index_.codes_.data() + (size_t)id * index_.code_size();
+	}
+
+	float distance(uint32_t id, const void *query) const override
+	{
+		const int8_t *a = (const int8_t *)row(id);
+		const int8_t *b = (const int8_t *)query;
+		size_t dim = index_.dim_;
+		float sa, sb;
+
+		std::memcpy(&sa, a + dim, sizeof(sa));
+		std::memcpy(&sb, b + dim, sizeof(sb));
+		return 1.0f - sa * sb * dot_product_i8(a, b, dim);
+	}
+
+private:
+	const FaceIndex &index_;
+};
+
+FaceIndex::FaceIndex(const FaceIndexOptions &options) : options_(options)
+{
+}
+
+bool FaceIndex::load_store(const std::string &base)
+{
+	FaceStoreView view;
+
+	if (!view.open(base)) {
+		return false;
+	}
+
+	/* Rows already in the codes file need not be read as floats */
+	size_t first = 0;
+	if (!keeps_floats() && size() == 0) {
+		first = load_codes(base + FACE_CODES_EXT, view);
+	}
+
+	if (keeps_floats()) {
+		data_.reserve(data_.size() + view.size() * view.dim());
+	}
+	if (options_.quantize) {
+		codes_.reserve(codes_.size() +
+			       view.size() * (view.dim() + sizeof(float)));
+	}
+	norms_.reserve(norms_.size() + view.size());
+	names_.reserve(names_.size() + view.size());
+	for (size_t i = first; i < view.size(); i++) {
+		if (!add(view.name(i), view.embedding(i), view.dim())) {
+			std::cerr << "Warning: Face store " << base
+				  << " does not match the index size"
+				  << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Symmetric scaling to the largest value of the row, so a unit row loses
+ * about 1/127 of its largest value to rounding.
+ */
+void FaceIndex::encode(const float *unit, int8_t *code) const
+{
+	float largest = 0.0f;
+
+	for (size_t i = 0; i < dim_; i++) {
+		largest = std::max(largest, std::fabs(unit[i]));
+	}
+	float scale = largest > 0.0f ? largest / 127.0f : 1.0f;
+	float inv = 1.0f / scale;
+	for (size_t i = 0; i < dim_; i++) {
+		code[i] = (int8_t)std::lrint(unit[i] * inv);
+	}
+	std::memcpy(code + dim_, &scale, sizeof(scale));
+}
+
+bool FaceIndex::add(const std::string &name, const float *embedding,
+		    size_t dim)
+{
+	if (dim == 0 || (dim_ != 0 && dim != dim_)) {
+		return false;
+	}
+	dim_ = dim;
+
+	float norm = std::sqrt(dot_product(embedding, embedding, dim));
+	float inv = norm > 0.0f ? 1.0f / norm : 0.0f;
+
+	std::vector<float> unit(dim);
+	for (size_t i = 0; i < dim; i++) {
+		unit[i] = embedding[i] * inv;
+	}
+	if (keeps_floats()) {
+		data_.insert(data_.end(), unit.begin(), unit.end());
+	}
+	if (options_.quantize) {
+		size_t offset = codes_.size();
+		codes_.resize(offset + code_size());
+		encode(unit.data(), codes_.data() + offset);
+	}
+	norms_.push_back(norm);
+	names_.push_back(name);
+	if (use_graph_) {
+		link_rows();
+	}
+	return true;
+}
+
+/**
+ * @brief      Unit length copy of a query, so every row is a plain dot
+ *             product.
+ */
+static std::vector<float> normalise(const float *query, size_t dim)
+{
+	std::vector<float> q(query, query + dim);
+	float norm = std::sqrt(dot_product(q.data(), q.data(), dim));
+
+	if (norm > 0.0f) {
+		for (auto &v : q) {
+			v /= norm;
+		}
+	}
+	return q;
+}
+
+/**
+ * @brief      Insert a match into a top-k list kept best first.
+ */
+static inline void keep_best(std::vector<FaceMatch> &top, size_t k, size_t id,
+			     float score)
+{
+	if (top.size() == k && score <= top.back().confidence) {
+		return;
+	}
+	FaceMatch m = { id, score };
+	top.insert(std::upper_bound(top.begin(), top.end(), m,
+				    [](const FaceMatch &a, const FaceMatch &b) {
+					    return a.confidence > b.confidence;
+				    }),
+		   m);
+	if (top.size() > k) {
+		top.pop_back();
+	}
+}
+
+std::vector<FaceMatch> FaceIndex::scan_floats(const float *query,
+					      size_t k) const
+{
+	std::vector<FaceMatch> top;
+	const float *row = data_.data();
+
+	top.reserve(k + 1);
+	for (size_t id = 0; id < size(); id++, row += dim_) {
+		keep_best(top, k, id, dot_product(query, row, dim_));
+	}
+	return top;
+}
+
+std::vector<FaceMatch> FaceIndex::scan_codes(const int8_t *query,
+					     size_t k) const
+{
+	std::vector<FaceMatch> top;
+	const int8_t *row = codes_.data();
+	float query_scale, scale;
+
+	std::memcpy(&query_scale, query + dim_, sizeof(query_scale));
+	top.reserve(k + 1);
+	for (size_t id = 0; id < size(); id++, row += code_size()) {
+		std::memcpy(&scale, row + dim_, sizeof(scale));
+		keep_best(top, k, id,
+			  query_scale * scale *
+				  dot_product_i8(query, row, dim_));
+	}
+	return top;
+}
+
+/**
+ * @brief      Order matches best first.
+ */
+static void sort_matches(std::vector<FaceMatch> &top)
+{
+	std::sort(top.begin(), top.end(),
+		  [](const FaceMatch &a, const FaceMatch &b) {
+			  return a.confidence > b.confidence;
+		  });
+}
+
+void FaceIndex::to_server_scale(const float *query,
+				std::vector<FaceMatch> &top) const
+{
+	float norm = std::sqrt(dot_product(query, query, dim_));
+
+	for (auto &m : top) {
+		m.confidence *= norm * norms_[m.id];
+	}
+	sort_matches(top);
+}
+
+std::vector<FaceMatch> FaceIndex::search(const float *query, size_t k) const
+{
+	std::vector<FaceMatch> top = cosine_search(query, k);
+
+	to_server_scale(query, top);
+	return top;
+}
+
+std::vector<FaceMatch> FaceIndex::search_exact(const float *query,
+					       size_t k) const
+{
+	std::vector<FaceMatch> top = cosine_search_exact(query, k);
+
+	to_server_scale(query, top);
+	return top;
+}
+
+std::vector<FaceMatch> FaceIndex::cosine_search(const float *query,
+						size_t k) const
+{
+	std::vector<FaceMatch> top;
+	std::vector<HnswGraph::Match> matches;
+
+	if (size() == 0 || k == 0) {
+		return top;
+	}
+	k = std::min(k, size());
+
+	std::vector<float> q = normalise(query, dim_);
+	if (!options_.quantize) {
+		if (!use_graph_) {
+			return scan_floats(q.data(), k);
+		}
+		graph_.search(FloatRows(*this), q.data(), k, matches);
+		for (auto &m : matches) {
+			top.push_back({ m.second, m.first });
+		}
+		return top;
+	}
+
+	/* Candidates from the codes, re-scored from the float rows */
+	std::vector<int8_t> code(code_size());
+	size_t candidates = keeps_floats() ? std::max(k, options_.rerank) : k;
+	encode(q.data(), code.data());
+	if (!use_graph_) {
+		top = scan_codes(code.data(), candidates);
+	} else {
+		graph_.search(CodeRows(*this), code.data(), candidates,
+			      matches);
+		for (auto &m : matches) {
+			top.push_back({ m.second, m.first });
+		}
+	}
+	if (keeps_floats()) {
+		for (auto &m : top) {
+			m.confidence = dot_product(
+				q.data(), data_.data() + m.id * dim_, dim_);
+		}
+		sort_matches(top);
+		top.resize(std::min(k, top.size()));
+	}
+	return top;
+}
+
+std::vector<FaceMatch> FaceIndex::cosine_search_exact(const float *query,
+						      size_t k) const
+{
+	if (size() == 0 || k == 0) {
+		return {};
+	}
+	k = std::min(k, size());
+
+	std::vector<float> q = normalise(query, dim_);
+	if (keeps_floats()) {
+		return scan_floats(q.data(), k);
+	}
+	std::vector<int8_t> code(code_size());
+	encode(q.data(), code.data());
+	return scan_codes(code.data(), k);
+}
+
+void FaceIndex::embedding(size_t id, std::vector<float> &out) const
+{
+	out.resize(dim_);
+	if (keeps_floats()) {
+		const float *row = data_.data() + id * dim_;
+		for (size_t i = 0; i < dim_; i++) {
+			out[i] = row[i] * norms_[id];
+		}
+		return;
+	}
+
+	const int8_t *code = codes_.data() + id * code_size();
+	float scale;
+	std::memcpy(&scale, code + dim_, sizeof(scale));
+	for (size_t i = 0; i < dim_; i++) {
+		out[i] = code[i] * scale * norms_[id];
+	}
+}
+
+size_t FaceIndex::memory() const
+{
+	return data_.capacity() * sizeof(float) + codes_.capacity() +
+	       norms_.capacity() * sizeof(float) + graph_.memory();
+}
+
+void FaceIndex::link_rows()
+{
+	if (options_.quantize) {
+		CodeRows rows(*this);
+		while (graph_.size() < size()) {
+			graph_.insert(rows);
+		}
+	} else {
+		FloatRows rows(*this);
+		while (graph_.size() < size()) {
+			graph_.insert(rows);
+		}
+	}
+}
+
+void FaceIndex::build_graph(const HnswOptions &options)
+{
+	graph_ = HnswGraph(options);
+	link_rows();
+	use_graph_ = true;
+}
+
+bool FaceIndex::load_graph(const std::string &path,
+			   const HnswOptions &options)
+{
+	graph_ = HnswGraph(options);
+	if (dim_ == 0 || !graph_.load(path, dim_, size())) {
+		graph_.clear();
+		use_graph_ = false;
+		return false;
+	}
+	link_rows();
+	use_graph_ = true;
+	return true;
+}
+
+bool FaceIndex::save_graph(const std::string &path) const
+{
+	return use_graph_ && graph_.save(path, dim_);
+}
+
+size_t FaceIndex::load_codes(const std::string &path,
+			     const FaceStoreView &view)
+{
+	std::ifstream ifs(path, std::ios::binary);
+	FaceCodesHeader header;
+
+	if (!ifs || !ifs.read((char *)&header, sizeof(header))) {
+		return 0;
+	}
+	if (std::memcmp(header.magic, FACE_CODES_MAGIC, 4) != 0 ||
+	    header.version != FACE_CODES_VERSION || header.dim != view.dim() ||
+	    header.count > view.size()) {
+		std::cerr << "Warning: " << path
+			  << " does not match the face store" << std::endl;
+		return 0;
+	}
+
+	dim_ = header.dim;
+	codes_.resize(header.count * code_size());
+	norms_.resize(header.count);
+	ifs.read((char *)codes_.data(), codes_.size());
+	ifs.read((char *)norms_.data(), norms_.size() * sizeof(float));
+	if (!ifs) {
+		std::cerr << "Warning: " << path << " is damaged" << std::endl;
+		codes_.clear();
+		norms_.clear();
+		return 0;
+	}
+	names_.clear();
+	for (size_t i = 0; i < header.count; i++) {
+		names_.push_back(view.name(i));
+	}
+	codes_saved_ = header.count;
+	return header.count;
+}
+
+bool FaceIndex::save_codes(const std::string &path) const
+{
+	std::string tmp = path + ".tmp";
+	std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+	FaceCodesHeader header = {};
+
+	std::memcpy(header.magic, FACE_CODES_MAGIC, 4);
+	header.version = FACE_CODES_VERSION;
+	header.dim = dim_;
+	header.count = size();
+	ofs.write((const char *)&header, sizeof(header));
+	ofs.write((const char *)codes_.data(), size() * code_size());
+	ofs.write((const char *)norms_.data(), size() * sizeof(float));
+	ofs.close();
+	if (!ofs) {
+		std::cerr << "Error: Cannot write " << tmp << std::endl;
+		std::remove(tmp.c_str());
+		return false;
+	}
+	return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool FaceIndex::index_store(const std::string &base, size_t min_size,
+			    const HnswOptions &options)
+{
+	std::string path = base + FACE_GRAPH_EXT;
+	size_t saved = 0;
+
+	if (!keeps_floats() && size() > 0 && codes_saved_ != size()) {
+		if (save_codes(base + FACE_CODES_EXT)) {
+			codes_saved_ = size();
+		}
+	}
+
+	use_graph_ = false;
+	graph_ = HnswGraph(options);
+	if (dim_ > 0 && graph_.load(path, dim_, size())) {
+		/* Link in the faces enrolled since it was saved */
+		saved = graph_.size();
+		link_rows();
+		use_graph_ = true;
+	} else if (size() >= min_size && size() > 0) {
+		build_graph(options);
+	} else {
+		return false;
+	}
+	if (graph_.size() != saved && !save_graph(path)) {
+		std::cerr << "Warning: Cannot save the face graph " << path
+			  << std::endl;
+	}
+	return true;
+}
@@ -0,0 +1,241 @@
+/**
+ *
+ * @brief      In-process face embedding index used for face verification.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef FACE_INDEX_HPP
+#define FACE_INDEX_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <rapidjson/document.h>
+
+#include "hnsw.hpp"
+
+class FaceStoreView;
+
+/* Extension of the search graph saved next to a face store */
+#define FACE_GRAPH_EXT ".hnsw"
+
+/* Smaller galleries are searched exhaustively */
+#define FACE_GRAPH_MIN_SIZE 20000
+
+/* Extension of the quantized embeddings saved next to a face store */
+#define FACE_CODES_EXT ".i8"
+
+/**
+ * @brief      Result of a gallery lookup.
+ */
+struct FaceMatch {
+	size_t id;	  /* Row of the matched entry in the index */
+	float confidence; /* Same scale as /v1/compareface */
+};
+
+/**
+ * @brief      How a FaceIndex keeps its embeddings.
+ */
+struct FaceIndexOptions {
+	bool quantize = false; /* Search int8 codes, a quarter of the size of
+				* the float rows */
+	size_t rerank = 0;     /* Re-score this many of the best code matches
+				* in float; keeps the float rows in memory */
+};
+
+/**
+ * @brief      Gallery of enrolled face embeddings kept in memory.
+ *
+ *             Embeddings are stored row-major in one contiguous float32
+ *             buffer and normalised on insert, so a cosine similarity is a
+ *             single dot product. Matches are found by cosine similarity;
+ *             the confidence returned by search() is then scaled back by
+ *             the lengths of the query and the entry, which gives the raw
+ *             dot product that /v1/compareface reports for the same pair.
+ *
+ *             Large galleries can add an HNSW graph (see hnsw.hpp): search()
+ *             then visits a few thousand entries instead of all of them, at
+ *             a recall set by the graph's ef_search. Entries added later are
+ *             linked into the graph as they arrive.
+ *
+ *             With quantize, every row is also kept as dim int8 codes and a
+ *             float scale (132 bytes instead of 512 for 128 values), and the
+ *             search, exhaustive or through the graph, reads only the codes.
+ *             Cosine similarities are then off by about 0.01. With
+ *             rerank, the best rerank code matches are scored again from
+ *             the float rows, which gives exact confidences. Without rerank
+ *             the float rows are not kept at all, and a store with a saved
+ *             codes file is loaded without reading its float records.
+ */
+class FaceIndex {
+public:
+	explicit FaceIndex(const FaceIndexOptions &options = FaceIndexOptions());
+
+	/**
+	 * @brief      Load all entries of a face_embeddings.json file.
+	 *
+	 * @param[in]  json_file  Path to the JSON gallery
+	 *
+	 * @return     false if the file could not be read or parsed
+	 */
+	bool load_json(const std::string &json_file);
+
+	/**
+	 * @brief      Load all entries of a binary face store.
+	 *
+	 * @param[in]  base  Path of the store without extension
+	 *
+	 * @return     false if the store does not exist or is not valid
+	 */
+	bool load_store(const std::string &base);
+
+	/**
+	 * @brief      Add one embedding to the index.
+	 *
+	 * @param[in]  name       Name of the person
+	 * @param[in]  embedding  Embedding values
+	 * @param[in]  dim        Number of values, must match the index
+	 *
+	 * @return     false on dimension mismatch
+	 */
+	bool add(const std::string &name, const float *embedding, size_t dim);
+
+	/**
+	 * @brief      Find the k most similar entries, best first.
+	 *
+	 *             Uses the graph if there is one, so the result may miss
+	 *             some of the true k best.
+	 *
+	 * @param[in]  query  Query embedding of dim() values
+	 * @param[in]  k      Number of matches to return
+	 */
+	std::vector<FaceMatch> search(const float *query, size_t k) const;
+
+	/**
+	 * @brief      Find the k most similar entries by scanning all of them.
+	 *
+	 *             Scores the float rows if they are kept, else the codes.
+	 */
+	std::vector<FaceMatch> search_exact(const float *query, size_t k) const;
+
+	/**
+	 * @brief      Link all entries into a new search graph.
+	 */
+	void build_graph(const HnswOptions &options = HnswOptions());
+
+	/**
+	 * @brief      Read a graph saved for the first entries of this index.
+	 *
+	 *             Entries the graph does not cover, such as faces enrolled
+	 *             since it was saved, are linked in.
+	 *
+	 * @return     false if there is no valid graph for this gallery
+	 */
+	bool load_graph(const std::string &path,
+			const HnswOptions &options = HnswOptions());
+
+	bool save_graph(const std::string &path) const;
+
+	/**
+	 * @brief      Search a face store through its saved graph.
+	 *
+	 *             Loads <base>.hnsw and links in the entries enrolled since
+	 *             it was written, or builds a graph if the gallery has at
+	 *             least min_size entries. The graph is saved back if it
+	 *             changed, so each enrolment is linked in only once. The
+	 *             codes of a quantized index are saved to <base>.i8 the same
+	 *             way.
+	 *
+	 * @param[in]  base      Path of the store without extension, whose
+	 *                       entries were loaded with load_store()
+	 * @param[in]  min_size  Smaller galleries keep the exhaustive search
+	 *
+	 * @return     true if search() uses a graph
+	 */
+	bool index_store(const std::string &base,
+			 size_t min_size = FACE_GRAPH_MIN_SIZE,
+			 const HnswOptions &options = HnswOptions());
+
+	/**
+	 * @brief      Candidates kept per graph search, the recall/latency knob.
+	 */
+	void set_ef(size_t ef) { graph_.set_ef(ef); }
+	bool has_graph() const { return use_graph_; }
+
+	/**
+	 * @brief      Copy the original (un-normalised) embedding of an entry.
+	 *
+	 *             Decoded from the int8 codes if the float rows are not
+	 *             kept.
+	 */
+	void embedding(size_t id, std::vector<float> &out) const;
+
+	const std::string &name(size_t id) const { return names_[id]; }
+	size_t size() const { return names_.size(); }
+	size_t dim() const { return dim_; }
+
+	/**
+	 * @brief      Bytes of memory held by the embeddings and the graph.
+	 */
+	size_t memory() const;
+
+private:
+	class FloatRows;
+	class CodeRows;
+
+	bool keeps_floats() const
+	{
+		return !options_.quantize || options_.rerank > 0;
+	}
+	size_t code_size() const { return dim_ + sizeof(float); }
+	void encode(const float *unit, int8_t *code) const;
+	void link_rows();
+	std::vector<FaceMatch> cosine_search(const float *query,
+					     size_t k) const;
+	std::vector<FaceMatch> cosine_search_exact(const float *query,
+						   size_t k) const;
+	void to_server_scale(const float *query,
+			     std::vector<FaceMatch> &top) const;
+	std::vector<FaceMatch> scan_floats(const float *query, size_t k) const;
+	std::vector<FaceMatch> scan_codes(const int8_t *query, size_t k) const;
+	size_t load_codes(const std::string &path, const FaceStoreView &view);
+	bool save_codes(const std::string &path) const;
+
+	FaceIndexOptions options_;
+	size_t dim_ = 0;
+	std::vector<float> data_;  /* size() x dim_, unit length rows */
+	std::vector<int8_t> codes_; /* size() x code_size(): dim_ codes and
+				     * the float scale of the row */
+	size_t codes_saved_ = 0;    /* Rows in the saved codes file */
+	std::vector<float> norms_; /* Original row lengths */
+	std::vector<std::string> names_;
+	HnswGraph graph_;
+	bool use_graph_ = false;
+};
+
+/**
+ * @brief      Dot product of two float vectors.
+ *
+ *             Written with independent accumulators so the compiler can
+ *             vectorise it (NEON on BrainyPi, SSE/AVX on x86).
+ */
+float dot_product(const float *a, const float *b, size_t n);
+
+/**
+ * @brief      Dot product of two int8 vectors.
+ *
+ *             NEON on BrainyPi, AVX2 or SSE2 on x86, otherwise a loop the
+ *             compiler can vectorise.
+ */
+int32_t dot_product_i8(const int8_t *a, const int8_t *b, size_t n);
+
+/**
+ * @brief      Convert a JSON array of numbers into a float vector.
+ *
+ * @return     false if the value is not an array of numbers
+ */
+bool json_to_embedding(const rapidjson::Value &value, std::vector<float> &out);
+
+#endif
@@ -0,0 +1,487 @@
+/**
+ *
+ * @brief      Binary, append-only store of enrolled face embeddings.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <rapidjson/document.h>
+#include <rapidjson/istreamwrapper.h>
+#include <rapidjson/ostreamwrapper.h>
+#include <rapidjson/writer.h>
+
+#include "face_index.hpp"
+#include "face_store.hpp"
+
+#define FACE_STORE_MAGIC "BPFE"
+#define FACE_STORE_VERSION 1
+
+/* Header of the .f32 file, a multiple of 4 bytes so records stay aligned */
+struct FaceStoreHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t dim;
+	uint32_t reserved;
+};
+
+static size_t record_size(size_t dim)
+{
+	return sizeof(uint32_t) + dim * sizeof(float);
+}
+
+static bool write_all(int fd, const char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = ::write(fd, data, size);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+/**
+ * @brief      Read the complete lines of a name table.
+ *
+ * @param[in]  offset  Length already read into names, 0 to read it all
+ *
+ * @return     Length of the file up to the last complete line
+ */
+static size_t read_names(const std::string &path,
+			 std::vector<std::string> &names, size_t offset = 0)
+{
+	std::ifstream ifs(path, std::ios::binary);
+	std::string line;
+	size_t length = offset;
+
+	if (offset == 0) {
+		names.clear();
+	}
+	ifs.seekg(offset);
+	while (std::getline(ifs, line)) {
+		if (ifs.eof()) {
+			/* Last line has no newline, it was cut short */
+			break;
+		}
+		length += line.size() + 1;
+		names.push_back(line);
+	}
+	return length;
+}
+
+FaceStoreView::~FaceStoreView()
+{
+	close();
+}
+
+bool FaceStoreView::open(const std::string &base)
+{
+	close();
+
+	int fd = ::open((base + ".f32").c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	FaceStoreHeader header;
+	if (fstat(fd, &st) == 0 && st.st_size == 0) {
+		/* Just created, the header follows */
+		::close(fd);
+		return false;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(header) ||
+	    pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+	    std::memcmp(header.magic, FACE_STORE_MAGIC, 4) != 0 ||
+	    header.version != FACE_STORE_VERSION || header.dim == 0) {
+		std::cerr << "Error: " << base << ".f32 is not a face store"
+			  << std::endl;
+		::close(fd);
+		return false;
+	}
+
+	map_size_ = st.st_size;
+	map_ = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map_ == MAP_FAILED) {
+		map_ = nullptr;
+		map_size_ = 0;
+		return false;
+	}
+
+	base_ = base;
+	inode_ = st.st_ino;
+	dim_ = header.dim;
+	names_length_ = read_names(base + ".names", names_);
+	count_records();
+	return true;
+}
+
+/* Stop at a torn record or one whose name did not reach the disk */
+void FaceStoreView::count_records()
+{
+	size_t records = (map_size_ - sizeof(FaceStoreHeader)) /
+			 record_size(dim_);
+
+	for (; size_ < records; size_++) {
+		uint32_t id;
+		std::memcpy(&id, record(size_), sizeof(id));
+		if (id >= names_.size()) {
+			break;
+		}
+	}
+}
+
+bool FaceStoreView::refresh()
+{
+	struct stat st;
+
+	if (!map_ || stat((base_ + ".f32").c_str(), &st) < 0 ||
+	    st.st_ino != inode_ || (size_t)st.st_size < map_size_) {
+		return false;
+	}
+	if ((size_t)st.st_size == map_size_ && size_ == records()) {
+		return true;
+	}
+
+	if ((size_t)st.st_size > map_size_) {
+		int fd = ::open((base_ + ".f32").c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED,
+				 fd, 0);
+		::close(fd);
+		if (map == MAP_FAILED) {
+			return false;
+		}
+		munmap(map_, map_size_);
+		map_ = map;
+		map_size_ = st.st_size;
+	}
+
+	/* Only the names appended since the last read */
+	names_length_ = read_names(base_ + ".names", names_, names_length_);
+	count_records();
+	return true;
+}
+
+size_t FaceStoreView::records() const
+{
+	return (map_size_ - sizeof(FaceStoreHeader)) / record_size(dim_);
+}
+
+void FaceStoreView::close()
+{
+	if (map_) {
+		munmap(map_, map_size_);
+	}
+	map_ = nullptr;
+	map_size_ = 0;
+	dim_ = 0;
+	size_ = 0;
+	names_length_ = 0;
+	names_.clear();
+}
+
+const char *FaceStoreView::record(size_t i) const
+{
+	return (const char *)map_ + sizeof(FaceStoreHeader) +
+	       i * record_size(dim_);
+}
+
+const std::string &FaceStoreView::name(size_t i) const
+{
+	uint32_t id;
+
+	std::memcpy(&id, record(i), sizeof(id));
+	return names_[id];
+}
+
+const float *FaceStoreView::embedding(size_t i) const
+{
+	return (const float *)(record(i) + sizeof(uint32_t));
+}
+
+FaceStore::~FaceStore()
+{
+	close();
+}
+
+bool FaceStore::open(const std::string &base, size_t dim)
+{
+	close();
+	if (dim == 0) {
+		return false;
+	}
+
+	data_fd_ = ::open((base + ".f32").c_str(), O_RDWR | O_CREAT, 0644);
+	if (data_fd_ < 0) {
+		std::cerr << "Error: Cannot open face store " << base
+			  << std::endl;
+		return false;
+	}
+	/* Two writers would interleave their records and names */
+	if (flock(data_fd_, LOCK_EX | LOCK_NB) < 0) {
+		if (errno == EWOULDBLOCK) {
+			std::cerr << "Error: " << base
+				  << " is in use by another process"
+				  << std::endl;
+		} else {
+			std::cerr << "Error: Cannot lock face store " << base
+				  << ": " << std::strerror(errno) << std::endl;
+		}
+		close();
+		return false;
+	}
+
+	/* Find how much of an existing store survived */
+	size_t records = 0;
+	{
+		FaceStoreView view;
+		if (view.open(base)) {
+			if (view.dim() != dim) {
+				std::cerr << "Error: " << base
+					  << " holds embeddings of size "
+					  << view.dim() << ", not " << dim
+					  << std::endl;
+				close();
+				return false;
+			}
+			records = view.size();
+		} else {
+			struct stat st;
+			if (fstat(data_fd_, &st) == 0 && st.st_size > 0) {
+				/* Never overwrite a file that is not a store */
+				close();
+				return false;
+			}
+		}
+	}
+
+	std::vector<std::string> names;
+	size_t names_length = read_names(base + ".names", names);
+
+	names_fd_ = ::open((base + ".names").c_str(), O_RDWR | O_CREAT, 0644);
+	if (names_fd_ < 0) {
+		std::cerr << "Error: Cannot open face store " << base
+			  << std::endl;
+		close();
+		return false;
+	}
+
+	dim_ = dim;
+	if (records == 0) {
+		FaceStoreHeader header = {};
+		std::memcpy(header.magic, FACE_STORE_MAGIC, 4);
+		header.version = FACE_STORE_VERSION;
+		header.dim = dim;
+		if (ftruncate(data_fd_, 0) < 0 ||
+		    !write_all(data_fd_, (const char *)&header,
+			       sizeof(header))) {
+			close();
+			return false;
+		}
+	}
+
+	/* Drop whatever a crash left half written */
+	off_t data_end = sizeof(FaceStoreHeader) + records * record_size(dim);
+	if (ftruncate(data_fd_, data_end) < 0 ||
+	    ftruncate(names_fd_, names_length) < 0 ||
+	    lseek(data_fd_, 0, SEEK_END) < 0 ||
+	    lseek(names_fd_, 0, SEEK_END) < 0) {
+		close();
+		return false;
+	}
+
+	for (size_t i = 0; i < names.size(); i++) {
+		ids_.emplace(names[i], (uint32_t)i);
+	}
+	record_.resize(record_size(dim));
+	return true;
+}
+
+uint32_t FaceStore::name_id(const std::string &name)
+{
+	auto it = ids_.find(name);
+
+	if (it != ids_.end()) {
+		return it->second;
+	}
+
+	std::string line = name;
+	for (auto &c : line) {
+		if (c == '\n' || c == '\r') {
+			c = ' ';
+		}
+	}
+	line += '\n';
+	if (!write_all(names_fd_, line.data(), line.size())) {
+		failed_ = true;
+	}
+	names_dirty_ = true;
+
+	uint32_t id = ids_.size();
+	ids_.emplace(name, id);
+	return id;
+}
+
+bool FaceStore::append(const std::string &name, const float *embedding,
+		       size_t dim)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (!is_open() || dim != dim_) {
+		return false;
+	}
+
+	uint32_t id = name_id(name);
+	std::memcpy(record_.data(), &id, sizeof(id));
+	std::memcpy(record_.data() + sizeof(id), embedding,
+		    dim * sizeof(float));
+	if (failed_ || !write_all(data_fd_, record_.data(), record_.size())) {
+		std::cerr << "Error: Failed to append to face store"
+			  << std::endl;
+		failed_ = true;
+		return false;
+	}
+
+	if (++unsynced_ >= sync_every_) {
+		return flush_locked();
+	}
+	return true;
+}
+
+bool FaceStore::flush()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return flush_locked();
+}
+
+bool FaceStore::flush_locked()
+{
+	if (!is_open()) {
+		return false;
+	}
+	/* Names first, so a synced record never points at a lost name */
+	if (names_dirty_ && fsync(names_fd_) < 0) {
+		return false;
+	}
+	names_dirty_ = false;
+	if (unsynced_ > 0 && fsync(data_fd_) < 0) {
+		return false;
+	}
+	unsynced_ = 0;
+	return !failed_;
+}
+
+void FaceStore::close()
+{
+	if (data_fd_ >= 0 && names_fd_ >= 0) {
+		flush();
+	}
+	if (data_fd_ >= 0) {
+		::close(data_fd_);
+	}
+	if (names_fd_ >= 0) {
+		::close(names_fd_);
+	}
+	data_fd_ = -1;
+	names_fd_ = -1;
+	dim_ = 0;
+	unsynced_ = 0;
+	names_dirty_ = false;
+	failed_ = false;
+	ids_.clear();
+}
+
+long import_face_json(const std::string &json_file, const std::string &base)
+{
+	FaceStore store;
+	rapidjson::Document db;
+	std::ifstream ifs(json_file);
+
+	if (!ifs) {
+		return -1;
+	}
+	rapidjson::IStreamWrapper isw(ifs);
+
+	if (db.ParseStream(isw).HasParseError() || !db.IsArray()) {
+		std::cerr << "Error: Failed to parse " << json_file << std::endl;
+		return -1;
+	}
+
+	long imported = 0;
+	std::vector<float> values;
+	for (rapidjson::SizeType i = 0; i < db.Size(); i++) {
+		if (!db[i].HasMember("name") || !db[i]["name"].IsString() ||
+		    !db[i].HasMember("embeddings") ||
+		    !json_to_embedding(db[i]["embeddings"], values)) {
+			std::cerr << "Warning: Skipping malformed entry " << i
+				  << " in " << json_file << std::endl;
+			continue;
+		}
+		if (!store.is_open() && !store.open(base, values.size())) {
+			std::cerr << "Error: Cannot open face store " << base
+				  << std::endl;
+			return -1;
+		}
+		if (!store.append(db[i]["name"].GetString(), values.data(),
+				  values.size())) {
+			std::cerr << "Warning: Skipping entry " << i
+				  << " with wrong embedding size" << std::endl;
+			continue;
+		}
+		imported++;
+	}
+	if (store.is_open() && !store.flush()) {
+		return -1;
+	}
+	return imported;
+}
+
+bool export_face_json(const FaceStoreView &view, const std::string &json_file)
+{
+	std::ofstream ofs(json_file);
+
+	if (!ofs) {
+		return false;
+	}
+	rapidjson::OStreamWrapper osw(ofs);
+	rapidjson::Writer<rapidjson::OStreamWrapper> writer(osw);
+
+	writer.StartArray();
+	for (size_t i = 0; i < view.size(); i++) {
+		const float *values = view.embedding(i);
+		writer.StartObject();
+		writer.Key("name");
+		writer.String(view.name(i).c_str());
+		writer.Key("embeddings");
+		writer.StartArray();
+		for (size_t j = 0; j < view.dim(); j++) {
+			writer.Double(values[j]);
+		}
+		writer.EndArray();
+		writer.EndObject();
+	}
+	writer.EndArray();
+	ofs.flush();
+	return (bool)ofs;
+}
@@ -0,0 +1,182 @@
+/**
+ *
+ * @brief      Binary, append-only store of enrolled face embeddings.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef FACE_STORE_HPP
+#define FACE_STORE_HPP
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+/* Base name of the store in the output directory */
+#define FACE_STORE "face_embeddings"
+
+/* Records written between two fsync calls */
+#define FACE_STORE_SYNC_EVERY 64
+
+/**
+ * @brief      Writer of a face embedding store.
+ *
+ *             A store is two files next to each other:
+ *
+ *             <base>.f32    header followed by fixed-width records, each a
+ *                           uint32 name id and dim float32 values
+ *             <base>.names  name table, one name per line, the line number
+ *                           is the name id
+ *
+ *             Both files are only ever appended to, so enrolling one face
+ *             costs one record whatever the size of the gallery. A record
+ *             or name cut short by a crash is dropped when the store is
+ *             opened again. Writes are synced every sync_every records and
+ *             on flush() and close(). append() and flush() are thread safe.
+ *             Only one FaceStore at a time can have a store open, the
+ *             <base>.f32 file is locked with flock() until close().
+ */
+class FaceStore {
+public:
+	FaceStore() = default;
+	~FaceStore();
+
+	FaceStore(const FaceStore &) = delete;
+	FaceStore &operator=(const FaceStore &) = delete;
+
+	/**
+	 * @brief      Open a store for appending, creating it if needed.
+	 *
+	 * @param[in]  base  Path of the store without extension
+	 * @param[in]  dim   Embedding length, must match an existing store
+	 *
+	 * @return     false if the files cannot be opened, another writer
+	 *             holds the store or dim differs
+	 */
+	bool open(const std::string &base, size_t dim);
+
+	/**
+	 * @brief      Append one embedding.
+	 *
+	 * @param[in]  name       Name of the person
+	 * @param[in]  embedding  dim() values
+	 * @param[in]  dim        Number of values
+	 *
+	 * @return     false on dimension mismatch or write error
+	 */
+	bool append(const std::string &name, const float *embedding,
+		    size_t dim);
+
+	/**
+	 * @brief      Sync all appended records to disk.
+	 */
+	bool flush();
+
+	void close();
+
+	void set_sync_every(size_t records) { sync_every_ = records; }
+	bool is_open() const { return data_fd_ >= 0; }
+	size_t dim() const { return dim_; }
+
+private:
+	uint32_t name_id(const std::string &name);
+	bool flush_locked();
+
+	std::mutex mutex_;
+	int data_fd_ = -1;
+	int names_fd_ = -1;
+	size_t dim_ = 0;
+	size_t sync_every_ = FACE_STORE_SYNC_EVERY;
+	size_t unsynced_ = 0;
+	bool names_dirty_ = false;
+	std::map<std::string, uint32_t> ids_;
+	std::vector<char> record_;
+	bool failed_ = false;
+};
+
+/**
+ * @brief      Read-only view of a face embedding store.
+ *
+ *             The record file is memory mapped, so opening a store reads
+ *             only the name table and embeddings are paged in on use.
+ */
+class FaceStoreView {
+public:
+	FaceStoreView() = default;
+	~FaceStoreView();
+
+	FaceStoreView(const FaceStoreView &) = delete;
+	FaceStoreView &operator=(const FaceStoreView &) = delete;
+
+	/**
+	 * @brief      Map a store written by FaceStore.
+	 *
+	 * @param[in]  base  Path of the store without extension
+	 *
+	 * @return     false if the store does not exist or is not valid
+	 */
+	bool open(const std::string &base);
+
+	/**
+	 * @brief      Map the records appended since open() or the last
+	 *             refresh().
+	 *
+	 *             Only the new names are read, so following a growing store
+	 *             costs in proportion to what was appended. Pointers from
+	 *             embedding() are invalid afterwards.
+	 *
+	 * @return     false if the store was replaced or truncated and must be
+	 *             opened again
+	 */
+	bool refresh();
+
+	void close();
+
+	size_t size() const { return size_; }
+	size_t dim() const { return dim_; }
+
+	/* Name of record i */
+	const std::string &name(size_t i) const;
+	/* dim() values of record i */
+	const float *embedding(size_t i) const;
+
+private:
+	const char *record(size_t i) const;
+	size_t records() const;
+	void count_records();
+
+	std::string base_;
+	ino_t inode_ = 0;
+	void *map_ = nullptr;
+	size_t map_size_ = 0;
+	size_t dim_ = 0;
+	size_t size_ = 0;
+	size_t names_length_ = 0; /* Bytes of the name table read */
+	std::vector<std::string> names_;
+};
+
+/**
+ * @brief      Append every entry of a face_embeddings.json file to a store.
+ *
+ *             The store is created with the embedding size of the first
+ *             entry if it does not exist yet.
+ *
+ * @param[in]  json_file  Path to the JSON gallery
+ * @param[in]  base       Path of the store without extension
+ *
+ * @return     Number of entries imported, -1 on error
+ */
+long import_face_json(const std::string &json_file, const std::string &base);
+
+/**
+ * @brief      Write a store in the face_embeddings.json format.
+ *
+ * @return     false if the file cannot be written
+ */
+bool export_face_json(const FaceStoreView &view, const std::string &json_file);
+
+#endif
@@ -0,0 +1,95 @@
+/**
+ * @brief      Convert between face_embeddings.json and the binary face store
+ *             and build its search graph.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "face_index.hpp"
+#include "face_store.hpp"
+
+static void usage(const char *prog)
+{
+	std::cerr << "Usage:\n"
+		  << "  " << prog << " import <face_embeddings.json> <store>\n"
+		  << "  " << prog << " export <store> <face_embeddings.json>\n"
+		  << "  " << prog << " index <store> [m] [ef_construction]\n"
+		  << "<store> is the path without extension, e.g. ./output/"
+		  << FACE_STORE << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::string command = argv[1];
+
+	if (command == "index") {
+		FaceIndex index;
+		HnswOptions options;
+		if (argc > 3) {
+			options.m = std::atoi(argv[3]);
+		}
+		if (argc > 4) {
+			options.ef_construction = std::atoi(argv[4]);
+		}
+		if (!index.load_store(argv[2])) {
+			std::cerr << "Error: Cannot open face store " << argv[2]
+				  << std::endl;
+			return 1;
+		}
+		if (!index.index_store(argv[2], 0, options)) {
+			std::cerr << "Error: Face store " << argv[2]
+				  << " is empty" << std::endl;
+			return 1;
+		}
+		std::cout << "Indexed " << index.size() << " faces in "
+			  << argv[2] << FACE_GRAPH_EXT << std::endl;
+		return 0;
+	}
+
+	if (argc != 4) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (command == "import") {
+		long imported = import_face_json(argv[2], argv[3]);
+		if (imported < 0) {
+			std::cerr << "Error: Import of " << argv[2] << " failed"
+				  << std::endl;
+			return 1;
+		}
+		std::cout << "Imported " << imported << " faces into "
+			  << argv[3] << std::endl;
+		return 0;
+	}
+
+	if (command == "export") {
+		FaceStoreView view;
+		if (!view.open(argv[2])) {
+			std::cerr << "Error: Cannot open face store " << argv[2]
+				  << std::endl;
+			return 1;
+		}
+		if (!export_face_json(view, argv[3])) {
+			std::cerr << "Error: Cannot write " << argv[3]
+				  << std::endl;
+			return 1;
+		}
+		std::cout << "Exported " << view.size() << " faces to "
+			  << argv[3] << std::endl;
+		return 0;
+	}
+
+	usage(argv[0]);
+	return 1;
+}
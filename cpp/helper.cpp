@@ -9,9 +9,15 @@
 #include <pistache/http.h>
 #include <pistache/net.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <stdexcept>
 #include <iostream>
 #include <fstream>
+#include <random>
 
 #include <opencv2/dnn.hpp>
 #include <opencv2/imgproc.hpp>
@@ -27,117 +33,992 @@
 #include <rapidjson/istreamwrapper.h>
 #include <rapidjson/ostreamwrapper.h>
 
+#include "helper.hpp"
+#include "trace.hpp"
+
 using namespace Pistache;
 using namespace std;
 
 /**
- * @brief      send data to the API endpoint
+ * @brief      Send a POST request, failing it after timeout_ms if set.
+ */
+static void send_request(Http::Experimental::Client &client,
+			 const std::string &url, std::string body,
+			 int timeout_ms, ApiCallback done)
+{
+	auto builder = client.post(url);
+	if (timeout_ms > 0) {
+		builder.timeout(std::chrono::milliseconds(timeout_ms));
+	}
+	auto resp = builder.body(std::move(body)).send();
+	auto callback = std::make_shared<ApiCallback>(std::move(done));
+
+	resp.then(
+		[callback](Http::Response response) {
+			ApiResponse result;
+			result.code = static_cast<int>(response.code());
+			result.body = response.body();
+			(*callback)(result);
+		},
+		[callback](std::exception_ptr exc) {
+			ApiResponse result;
+			try {
+				std::rethrow_exception(exc);
+			} catch (const std::exception &e) {
+				result.error = e.what();
+			} catch (...) {
+				result.error = "unknown error";
+			}
+			(*callback)(result);
+		});
+}
+
+void send_request_async(Http::Experimental::Client &client,
+			const std::string &url, std::string body,
+			ApiCallback done)
+{
+	send_request(client, url, std::move(body), 0, std::move(done));
+}
+
+std::future<ApiResponse> send_request_async(Http::Experimental::Client &client,
+					     const std::string &url,
+					     std::string body)
+{
+	auto promise = std::make_shared<std::promise<ApiResponse> >();
+	std::future<ApiResponse> future = promise->get_future();
+
+	send_request_async(client, url, std::move(body),
+			   [promise](ApiResponse &response) {
+				   promise->set_value(std::move(response));
+			   });
+	return future;
+}
+
+ServerPool::ServerPool(Http::Experimental::Client &client,
+		       const std::vector<std::string> &servers,
+		       const ApiSessionOptions &options)
+	: client_(client), options_(options)
+{
+	options_.max_in_flight = std::max<size_t>(options_.max_in_flight, 1);
+	options_.max_limit =
+		std::max(options_.max_limit, options_.max_in_flight);
+	options_.eject_after = std::max(options_.eject_after, 1);
+	options_.max_retries = std::max(options_.max_retries, 0);
+	options_.retry_base_ms = std::max(options_.retry_base_ms, 1);
+	if (servers.empty()) {
+		throw std::invalid_argument("No API server given");
+	}
+	for (auto &url : servers) {
+		Node node;
+		node.url = url;
+		node.limit = options_.max_in_flight;
+		nodes_.push_back(node);
+	}
+	if ((options_.hedge_ms > 0 && nodes_.size() > 1) ||
+	    options_.max_retries > 0) {
+		timer_thread_ = std::thread(&ServerPool::timer_loop, this);
+	}
+}
+
+ServerPool::~ServerPool()
+{
+	wait_idle();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	timer_cond_.notify_all();
+	if (timer_thread_.joinable()) {
+		timer_thread_.join();
+	}
+}
+
+bool ServerPool::available(const Node &node, Clock::time_point now) const
+{
+	if (node.ejected) {
+		/* One probe at a time once the backoff has passed */
+		return node.in_flight == 0 && now >= node.retry_at;
+	}
+	if (options_.adaptive) {
+		return node.in_flight < std::max((size_t)node.limit, (size_t)1);
+	}
+	return node.in_flight < options_.max_in_flight;
+}
+
+int ServerPool::pick(int exclude, Clock::time_point now) const
+{
+	int best = -1;
+	double best_room = 0;
+
+	for (int i = 0; i < (int)nodes_.size(); i++) {
+		const Node &node = nodes_[i];
+		if (i == exclude || !available(node, now)) {
+			continue;
+		}
+		double room = node.limit - node.in_flight;
+		if (best < 0 || room > best_room ||
+		    (room == best_room &&
+		     node.latency_ms < nodes_[best].latency_ms)) {
+			best = i;
+			best_room = room;
+		}
+	}
+	return best;
+}
+
+/**
+ * @brief      Shrink the window of a node, at most once per round trip.
+ */
+void ServerPool::decrease(Node &node, double factor, Clock::time_point now)
+{
+	if (!options_.adaptive ||
+	    now - node.last_decrease <
+		    std::chrono::duration<double, std::milli>(node.latency_ms)) {
+		return;
+	}
+	node.limit = std::max(node.limit * factor, 1.0);
+	node.last_decrease = now;
+}
+
+/**
+ * @brief      Grow or shrink the window of a node after a success.
+ */
+void ServerPool::adapt(Node &node, double ms, Clock::time_point now)
+{
+	if (!options_.adaptive) {
+		return;
+	}
+	/* The baseline drifts up so a server that got slower is followed */
+	if (node.base_latency_ms == 0 || ms < node.base_latency_ms) {
+		node.base_latency_ms = ms;
+	} else {
+		node.base_latency_ms += 0.01 * (ms - node.base_latency_ms);
+	}
+
+	if (ms > node.base_latency_ms * options_.latency_tolerance) {
+		/* Requests queue up on the server */
+		decrease(node, 0.9, now);
+	} else if (node.in_flight + 1 >= (size_t)node.limit) {
+		/* Grow only a window that was full, by one per window */
+		node.limit = std::min(node.limit + 1 / node.limit,
+				      (double)options_.max_limit);
+	}
+}
+
+std::shared_ptr<ServerPool::Call>
+ServerPool::make_call(const std::string &endpoint, std::string &body,
+		      ApiCallback done)
+{
+	auto call = std::make_shared<Call>();
+
+	call->endpoint = endpoint;
+	call->done = std::move(done);
+	call->pending = 1;
+	call->deadline = options_.deadline_ms > 0 ?
+				 Clock::now() + std::chrono::milliseconds(
+							options_.deadline_ms) :
+				 Clock::time_point::max();
+	call->body = std::make_shared<std::string>(std::move(body));
+	call->resend = nodes_.size() > 1 || options_.max_retries > 0;
+	return call;
+}
+
+void ServerPool::post(const std::string &endpoint, std::string body,
+		      ApiCallback done)
+{
+	uint64_t queued = trace_clock();
+	auto call = make_call(endpoint, body, std::move(done));
+	int node;
+
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		for (;;) {
+			Clock::time_point now = Clock::now();
+			node = pick(-1, now);
+			if (node >= 0) {
+				break;
+			}
+			/* Wake up for the next probe if all nodes are out */
+			Clock::time_point wake = Clock::time_point::max();
+			for (auto &n : nodes_) {
+				if (n.ejected && n.in_flight == 0) {
+					wake = std::min(wake, n.retry_at);
+				}
+			}
+			if (wake == Clock::time_point::max()) {
+				cond_.wait(lock);
+			} else {
+				cond_.wait_until(lock, wake);
+			}
+		}
+		nodes_[node].in_flight++;
+		in_flight_++;
+	}
+	trace_record(TRACE_QUEUE, queued, trace_clock());
+	start(call, node);
+}
+
+bool ServerPool::try_post(const std::string &endpoint, std::string body,
+			  ApiCallback done)
+{
+	int node;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		node = pick(-1, Clock::now());
+		if (node < 0) {
+			return false;
+		}
+		nodes_[node].in_flight++;
+		in_flight_++;
+	}
+	start(make_call(endpoint, body, std::move(done)), node);
+	return true;
+}
+
+/**
+ * @brief      Send one attempt of a call, already counted in pending.
+ */
+void ServerPool::start(const std::shared_ptr<Call> &call, int node)
+{
+	Clock::time_point sent = Clock::now();
+
+	if (call->node < 0) {
+		call->node = node;
+		if (options_.hedge_ms > 0 && nodes_.size() > 1) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			timers_.push(
+				{ sent + std::chrono::milliseconds(
+						 options_.hedge_ms),
+				  call, false });
+			timer_cond_.notify_one();
+		}
+	}
+	/* Pistache takes the body by value. It is copied at the last moment
+	 * if another attempt may need it, and handed over otherwise */
+	send_request(client_, nodes_[node].url + call->endpoint,
+		     call->resend ? *call->body : std::move(*call->body),
+		     options_.timeout_ms,
+		     [this, call, node, sent](ApiResponse &response) {
+			     complete(call, node, sent, response);
+		     });
+}
+
+void ServerPool::complete(const std::shared_ptr<Call> &call, int node,
+			  Clock::time_point sent, ApiResponse &response)
+{
+	bool throttled = response.error.empty() && response.code == 429;
+	bool ok = response.error.empty() && response.code > 0 &&
+		  response.code < 500 && !throttled;
+	int retry = -1;
+
+	response.latency_ms =
+		std::chrono::duration<double, std::milli>(Clock::now() - sent)
+			.count();
+	trace_record(TRACE_NETWORK,
+		     std::chrono::duration_cast<std::chrono::nanoseconds>(
+			     sent.time_since_epoch())
+			     .count(),
+		     trace_clock());
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		Node &n = nodes_[node];
+		Clock::time_point now = Clock::now();
+		n.in_flight--;
+		n.requests++;
+		if (ok) {
+			double ms = std::chrono::duration<double, std::milli>(
+					    now - sent)
+					    .count();
+			n.latency_ms = n.latency_ms == 0 ?
+					       ms :
+					       0.8 * n.latency_ms + 0.2 * ms;
+			n.failures = 0;
+			n.ejected = false;
+			n.backoff_ms = 0;
+			adapt(n, ms, now);
+		} else if (throttled) {
+			/* The server is alive but overloaded, back off */
+			n.throttled++;
+			decrease(n, 0.5, now);
+			if (call->retries < options_.max_retries &&
+			    call->body && !call->answered &&
+			    now < call->deadline) {
+				int backoff = options_.retry_base_ms
+					      << std::min(call->retries, 16);
+				thread_local std::minstd_rand rng(
+					std::random_device{}());
+				int delay = backoff / 2 +
+					    rng() % (backoff / 2 + 1);
+				call->retries++;
+				call->pending++;
+				call->throttled = response;
+				in_flight_++;
+				timers_.push(
+					{ now + std::chrono::milliseconds(delay),
+					  call, true });
+				timer_cond_.notify_one();
+			}
+		} else {
+			n.errors++;
+			n.failures++;
+			if (n.ejected || n.failures >= options_.eject_after) {
+				/* Failed probe or too many errors in a row */
+				n.backoff_ms =
+					n.ejected ?
+						std::min(n.backoff_ms * 2,
+							 options_.max_probe_ms) :
+						options_.probe_ms;
+				n.ejected = true;
+				n.retry_at = now + std::chrono::milliseconds(
+							   n.backoff_ms);
+			}
+			if (!call->failed_over && call->pending == 1 &&
+			    nodes_.size() > 1 && call->body) {
+				retry = pick(node, now);
+				if (retry >= 0) {
+					call->failed_over = true;
+					call->pending++;
+					nodes_[retry].in_flight++;
+					in_flight_++;
+				}
+			}
+		}
+	}
+	cond_.notify_all();
+
+	if (retry >= 0) {
+		start(call, retry);
+	}
+	finish(call, response, ok);
+}
+
+/**
+ * @brief      Account for the end of one attempt of a call.
  *
- * @param      frame      - input image
- * @param      client     - HTTP client object
- * @param      url        - API endpoint URL
- * @param      responses  - vector of promises for HTTP responses
+ *             The first success wins, a failure is only reported once no
+ *             other attempt is left.
+ */
+void ServerPool::finish(const std::shared_ptr<Call> &call,
+			ApiResponse &response, bool ok)
+{
+	bool last = --call->pending == 0;
+	if ((ok || last) && !call->answered.exchange(true)) {
+		call->done(response);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (last) {
+			/* Outlives the request while a hedge entry is queued */
+			call->body.reset();
+		}
+		in_flight_--;
+	}
+	cond_.notify_all();
+}
+
+void ServerPool::timer_loop()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	while (!stop_) {
+		if (timers_.empty()) {
+			timer_cond_.wait(lock);
+			continue;
+		}
+		Timer next = timers_.top();
+		Clock::time_point now = Clock::now();
+		if (now < next.due) {
+			timer_cond_.wait_until(lock, next.due);
+			continue;
+		}
+		timers_.pop();
+
+		std::shared_ptr<Call> call = next.call;
+		if (next.retry) {
+			int node = -1;
+			if (!call->answered && now < call->deadline) {
+				node = pick(-1, now);
+				if (node < 0) {
+					/* Every window is full, look again */
+					next.due = now +
+						   std::chrono::milliseconds(10);
+					timers_.push(next);
+					continue;
+				}
+			}
+			if (node < 0) {
+				/* Answered by a hedge or out of time */
+				lock.unlock();
+				finish(call, call->throttled, false);
+				lock.lock();
+				continue;
+			}
+			nodes_[node].in_flight++;
+			lock.unlock();
+			start(call, node);
+			lock.lock();
+			continue;
+		}
+
+		if (call->answered || call->hedged || !call->body) {
+			continue;
+		}
+		int node = pick(call->node, now);
+		if (node < 0) {
+			/* Every other node is busy, a copy would only queue */
+			continue;
+		}
+		call->hedged = true;
+		call->pending++;
+		nodes_[node].in_flight++;
+		in_flight_++;
+		lock.unlock();
+		start(call, node);
+		lock.lock();
+	}
+}
+
+void ServerPool::wait_idle()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	cond_.wait(lock, [this] { return in_flight_ == 0; });
+}
+
+std::vector<ServerPool::NodeStats> ServerPool::stats()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::vector<NodeStats> out;
+
+	for (auto &n : nodes_) {
+		double limit = options_.adaptive ? n.limit :
+						   options_.max_in_flight;
+		out.push_back({ n.url, n.in_flight, limit, n.latency_ms,
+				n.ejected, n.requests, n.errors,
+				n.throttled });
+	}
+	return out;
+}
+
+std::vector<std::string> split_servers(const std::string &servers)
+{
+	std::vector<std::string> out;
+	size_t begin = 0;
+
+	while (begin <= servers.size()) {
+		size_t end = servers.find(',', begin);
+		if (end == std::string::npos) {
+			end = servers.size();
+		}
+		std::string url = servers.substr(begin, end - begin);
+		url.erase(0, url.find_first_not_of(" \t"));
+		url.erase(url.find_last_not_of(" \t/") + 1);
+		if (!url.empty()) {
+			out.push_back(url);
+		}
+		begin = end + 1;
+	}
+	return out;
+}
+
+std::string api_servers(const std::string &fallback)
+{
+	const char *env = std::getenv("BRAINYPI_SERVERS");
+	return (env && *env) ? env : fallback;
+}
+
+static Http::Experimental::Client::Options
+client_options(const ApiSessionOptions &options)
+{
+	return Http::Experimental::Client::options()
+		.threads(options.threads)
+		.keepAlive(true)
+		.maxConnectionsPerHost(options.max_connections_per_host)
+		.maxResponseSize(options.max_response_size);
+}
+
+ApiSession::ApiSession(const std::string &server,
+		       const ApiSessionOptions &options)
+	: ApiSession(split_servers(server), options)
+{
+}
+
+ApiSession::ApiSession(const std::vector<std::string> &servers,
+		       const ApiSessionOptions &options)
+	: upload_(options.upload), pool_(client_, servers, options)
+{
+	client_.init(client_options(options));
+}
+
+ApiSession::~ApiSession()
+{
+	pool_.wait_idle();
+	client_.shutdown();
+}
+
+void ApiSession::post(const std::string &endpoint, std::string body,
+		      ApiCallback done)
+{
+	pool_.post(endpoint, std::move(body), std::move(done));
+}
+
+std::future<ApiResponse> ApiSession::post(const std::string &endpoint,
+					  std::string body)
+{
+	auto promise = std::make_shared<std::promise<ApiResponse> >();
+	std::future<ApiResponse> future = promise->get_future();
+
+	pool_.post(endpoint, std::move(body),
+		   [promise](ApiResponse &response) {
+			   promise->set_value(std::move(response));
+		   });
+	return future;
+}
+
+bool ApiSession::try_post(const std::string &endpoint, std::string body,
+			  ApiCallback done)
+{
+	return pool_.try_post(endpoint, std::move(body), std::move(done));
+}
+
+std::future<ApiResponse> ApiSession::post_image(const std::string &endpoint,
+						const cv::Mat &image,
+						double *scale)
+{
+	std::string jpeg;
+	double factor = encode_upload(image, upload_, jpeg);
+
+	if (scale) {
+		*scale = factor;
+	}
+	return post(endpoint, std::move(jpeg));
+}
+
+/**
+ * @brief      Load an image file as an upload body.
  *
- * @return     JSON response from the API
+ * @return     false with error set if the file cannot be read
  */
-std::string send_request_to_api_server(
-	cv::Mat &frame, Http::Experimental::Client &client, string &url,
-	std::vector<Async::Promise<Http::Response> > &responses)
+bool ApiSession::prepare_image(const std::string &image_path,
+			       std::string &jpeg, double *scale,
+			       std::string &error)
 {
-	// Encode the input frame as a jpg image
-	std::vector<uchar> buf;
-	cv::imencode(".jpg", frame, buf);
-	std::string image_data(buf.begin(), buf.end());
+	double factor = 1.0;
 
-	// Clear the buffer and shrink it to fit
-	buf.clear();
-	buf.shrink_to_fit();
-	// Send the image data as a post request to the API endpoint
-	auto resp = client.post(url).body(image_data).send();
+	/* Already a JPEG that fits, send the file as it is */
+	if (!read_upload_file(image_path, upload_, jpeg)) {
+		cv::Mat image = read_image(image_path);
+		if (image.empty()) {
+			error = "Error: Cannot read image " + image_path;
+			return false;
+		}
+		factor = encode_upload(image, upload_, jpeg);
+	}
+	if (scale) {
+		*scale = factor;
+	}
+	return true;
+}
+
+static std::future<ApiResponse> failed_response(const std::string &error)
+{
+	std::promise<ApiResponse> failed;
+	ApiResponse response;
 
-	// Store the JSON response from the API
-	std::string result;
+	response.error = error;
+	failed.set_value(std::move(response));
+	return failed.get_future();
+}
 
-	// Handle the response from the API
-	resp.then(
-		[&](Http::Response response) {
-			std::cout << "Response code = " << response.code()
-				  << std::endl;
-			auto body = response.body();
-			if (!body.empty()) {
-				std::cout << "Response body size = "
-					  << body.size() << std::endl;
-				// Handle response
-				result = body;
+std::future<ApiResponse> ApiSession::post_image(const std::string &endpoint,
+						const std::string &image_path,
+						double *scale)
+{
+	std::string jpeg, error;
+
+	if (!prepare_image(image_path, jpeg, scale, error)) {
+		return failed_response(error);
+	}
+	return post(endpoint, std::move(jpeg));
+}
+
+std::vector<std::future<ApiResponse> >
+ApiSession::post_all(const std::vector<std::string> &endpoints,
+		     std::string body)
+{
+	std::vector<std::future<ApiResponse> > out;
+
+	/* Pistache owns each request body, so all but the last request get
+	 * a copy of the bytes; the image itself is only encoded once */
+	for (size_t i = 0; i < endpoints.size(); i++) {
+		out.push_back(i + 1 < endpoints.size() ?
+				      post(endpoints[i], body) :
+				      post(endpoints[i], std::move(body)));
+	}
+	return out;
+}
+
+std::vector<std::future<ApiResponse> >
+ApiSession::analyze(const std::vector<std::string> &endpoints,
+		    const cv::Mat &image, double *scale)
+{
+	std::string jpeg;
+	double factor = encode_upload(image, upload_, jpeg);
+
+	if (scale) {
+		*scale = factor;
+	}
+	return post_all(endpoints, std::move(jpeg));
+}
+
+std::vector<std::future<ApiResponse> >
+ApiSession::analyze(const std::vector<std::string> &endpoints,
+		    const std::string &image_path, double *scale)
+{
+	std::string jpeg, error;
+
+	if (!prepare_image(image_path, jpeg, scale, error)) {
+		std::vector<std::future<ApiResponse> > out;
+		for (size_t i = 0; i < endpoints.size(); i++) {
+			out.push_back(failed_response(error));
+		}
+		return out;
+	}
+	return post_all(endpoints, std::move(jpeg));
+}
+
+std::future<ApiResponse> ApiSession::detect_face(const cv::Mat &image,
+						 double *scale)
+{
+	return post_image(API_DETECT_FACE, image, scale);
+}
+
+std::future<ApiResponse> ApiSession::detect_objects(const cv::Mat &image,
+						    double *scale)
+{
+	return post_image(API_DETECT_OBJECTS, image, scale);
+}
+
+std::future<ApiResponse> ApiSession::estimate_pose(const cv::Mat &image,
+						   double *scale)
+{
+	return post_image(API_ESTIMATE_POSE, image, scale);
+}
+
+std::future<ApiResponse> ApiSession::classify_image(const cv::Mat &image,
+						    double *scale)
+{
+	return post_image(API_CLASSIFY_IMAGE, image, scale);
+}
+
+std::future<ApiResponse> ApiSession::face_to_embedding(const cv::Mat &image,
+						       double *scale)
+{
+	return post_image(API_FACE_TO_EMBEDDING, image, scale);
+}
+
+std::future<ApiResponse> ApiSession::detect_face(const std::string &image_path,
+						 double *scale)
+{
+	return post_image(API_DETECT_FACE, image_path, scale);
+}
+
+std::future<ApiResponse>
+ApiSession::detect_objects(const std::string &image_path, double *scale)
+{
+	return post_image(API_DETECT_OBJECTS, image_path, scale);
+}
+
+std::future<ApiResponse>
+ApiSession::estimate_pose(const std::string &image_path, double *scale)
+{
+	return post_image(API_ESTIMATE_POSE, image_path, scale);
+}
+
+std::future<ApiResponse>
+ApiSession::classify_image(const std::string &image_path, double *scale)
+{
+	return post_image(API_CLASSIFY_IMAGE, image_path, scale);
+}
+
+std::future<ApiResponse>
+ApiSession::face_to_embedding(const std::string &image_path, double *scale)
+{
+	return post_image(API_FACE_TO_EMBEDDING, image_path, scale);
+}
+
+/**
+ * @brief      Write one {"embeddings": [...]} object.
+ */
+static void write_face(rapidjson::Writer<rapidjson::StringBuffer> &writer,
+		       const char *key, const std::vector<float> &embeddings)
+{
+	writer.Key(key);
+	writer.StartObject();
+	writer.Key("embeddings");
+	writer.StartArray();
+	for (auto v : embeddings) {
+		writer.Double(v);
+	}
+	writer.EndArray();
+	writer.EndObject();
+}
+
+std::string compare_face_body(const std::vector<float> &face1,
+			      const std::vector<float> &face2)
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	writer.SetMaxDecimalPlaces(2);
+
+	writer.StartObject();
+	write_face(writer, "face1", face1);
+	write_face(writer, "face2", face2);
+	writer.EndObject();
+
+	return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+std::future<ApiResponse> ApiSession::compare_face(const std::vector<float> &face1,
+						  const std::vector<float> &face2)
+{
+	return post(API_COMPARE_FACE, compare_face_body(face1, face2));
+}
+
+/**
+ * @brief      Encoder output buffer of the calling thread.
+ *
+ *             Kept across calls so encoding a frame does not allocate once
+ *             the buffer has grown to the frame size.
+ */
+static std::vector<uchar> &encode_buffer()
+{
+	static thread_local std::vector<uchar> buf;
+	return buf;
+}
+
+cv::Mat read_image(const std::string &image_path)
+{
+	TraceSpan span(TRACE_DECODE);
+	return cv::imread(image_path);
+}
+
+double encode_upload(const cv::Mat &image, const UploadOptions &options,
+		     std::string &jpeg)
+{
+	TraceSpan span(TRACE_ENCODE);
+	static thread_local cv::Mat resized;
+	const cv::Mat *src = &image;
+	std::vector<uchar> &buf = encode_buffer();
+	double shrink = 1.0;
+	int longest = std::max(image.cols, image.rows);
+	int quality = options.quality;
+
+	if (options.max_side > 0 && longest > options.max_side) {
+		shrink = (double)longest / options.max_side;
+	}
+
+	for (;;) {
+		if (shrink > 1.0) {
+			cv::Size size(std::max(1, (int)(image.cols / shrink)),
+				      std::max(1, (int)(image.rows / shrink)));
+			cv::resize(image, resized, size, 0, 0, cv::INTER_AREA);
+			src = &resized;
+		}
+		cv::imencode(".jpg", *src, buf,
+			     { cv::IMWRITE_JPEG_QUALITY, quality });
+		if (options.max_bytes == 0 || buf.size() <= options.max_bytes ||
+		    std::max(src->cols, src->rows) <= 64) {
+			break;
+		}
+		if (quality > options.min_quality) {
+			quality = std::max(options.min_quality, quality - 10);
+			continue;
+		}
+		/* JPEG size grows with the pixel count */
+		shrink *= std::sqrt((double)buf.size() / options.max_bytes) *
+			  1.05;
+	}
+
+	/* Moved into the request, which copies it once per attempt */
+	jpeg.assign((const char *)buf.data(), buf.size());
+	return (double)image.cols / src->cols;
+}
+
+static unsigned read_u16(const uchar *p, bool big_endian)
+{
+	return big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static unsigned read_u32(const uchar *p, bool big_endian)
+{
+	return big_endian ? (read_u16(p, true) << 16) | read_u16(p + 2, true) :
+			    (read_u16(p + 2, false) << 16) | read_u16(p, false);
+}
+
+/**
+ * @brief      EXIF orientation stored in an APP1 segment.
+ *
+ * @return     Orientation tag value, 1 (upright) if there is none
+ */
+static unsigned exif_orientation(const uchar *app1, size_t size)
+{
+	if (size < 14 || std::memcmp(app1, "Exif\0\0", 6) != 0) {
+		return 1;
+	}
+	const uchar *tiff = app1 + 6;
+	size -= 6;
+	bool big_endian = tiff[0] == 'M';
+	size_t ifd = read_u32(tiff + 4, big_endian);
+	if (ifd + 2 > size) {
+		return 1;
+	}
+	unsigned entries = read_u16(tiff + ifd, big_endian);
+	for (unsigned i = 0; i < entries; i++) {
+		const uchar *entry = tiff + ifd + 2 + i * 12;
+		if (entry + 12 > tiff + size) {
+			break;
+		}
+		if (read_u16(entry, big_endian) == 0x0112) {
+			return read_u16(entry + 8, big_endian);
+		}
+	}
+	return 1;
+}
+
+bool jpeg_info(const std::string &data, int &width, int &height)
+{
+	const uchar *p = (const uchar *)data.data();
+	size_t size = data.size();
+	size_t i = 2;
+
+	if (size < 4 || p[0] != 0xFF || p[1] != 0xD8) {
+		return false;
+	}
+	while (i + 4 <= size) {
+		if (p[i] != 0xFF) {
+			return false;
+		}
+		uchar marker = p[i + 1];
+		if (marker == 0xFF) {
+			/* Fill byte */
+			i++;
+			continue;
+		}
+		size_t length = (p[i + 2] << 8) | p[i + 3];
+		if (i + 2 + length > size) {
+			return false;
+		}
+		if (marker == 0xE1 &&
+		    exif_orientation(p + i + 4, length - 2) != 1) {
+			/* Would be rotated by cv::imread, not by the upload */
+			return false;
+		}
+		/* Start of frame, except DHT, JPG and DAC */
+		if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+		    marker != 0xC8 && marker != 0xCC) {
+			if (length < 7) {
+				return false;
 			}
-		},
-		[&](std::exception_ptr
-			    exc) { // In case of an exception, set the objects count to 0
-			result = "";
-			PrintException excPrinter;
-			excPrinter(exc);
-		});
-	// Push the response promise to the vector of responses
-	responses.push_back(std::move(resp));
+			height = (p[i + 5] << 8) | p[i + 6];
+			width = (p[i + 7] << 8) | p[i + 8];
+			return width > 0 && height > 0;
+		}
+		i += 2 + length;
+	}
+	return false;
+}
+
+bool read_upload_file(const std::string &path, const UploadOptions &options,
+		      std::string &jpeg)
+{
+	std::error_code error;
+	uintmax_t size = filesystem::file_size(path, error);
+
+	if (error || size == 0 ||
+	    (options.max_bytes > 0 && size > options.max_bytes)) {
+		return false;
+	}
 
-	// Wait for all the responses to complete
-	auto sync = Async::whenAll(responses.begin(), responses.end());
-	Async::Barrier<std::vector<Http::Response> > barrier(sync);
-	barrier.wait();
+	std::ifstream file(path, std::ios::binary);
+	jpeg.resize(size);
+	if (!file.read(&jpeg[0], size)) {
+		return false;
+	}
 
-	// Return the JSON response from the API
-	return result;
+	int width, height;
+	if (!jpeg_info(jpeg, width, height) ||
+	    (options.max_side > 0 &&
+	     std::max(width, height) > options.max_side)) {
+		jpeg.clear();
+		return false;
+	}
+	return true;
+}
+
+std::string response_body(ApiResponse response)
+{
+	if (!response.error.empty()) {
+		std::cerr << response.error << std::endl;
+		return "";
+	}
+	if (response.code == 429) {
+		std::cerr << "Error: Server busy (429)" << std::endl;
+		return "";
+	}
+	std::cout << "Response code = " << response.code << std::endl;
+	if (!response.body.empty()) {
+		std::cout << "Response body size = " << response.body.size()
+			  << std::endl;
+	}
+	return std::move(response.body);
 }
 
 /**
  * @brief      send data to the API endpoint
  *
- * @param      input      - input json
+ * @param      frame      - input image
  * @param      client     - HTTP client object
  * @param      url        - API endpoint URL
- * @param      responses  - vector of promises for HTTP responses
  *
  * @return     JSON response from the API
  */
-std::string send_json_request_to_api_server(
-	std::string &input, Http::Experimental::Client &client, string &url,
-	std::vector<Async::Promise<Http::Response> > &responses)
+std::string send_request_to_api_server(cv::Mat &frame,
+				       Http::Experimental::Client &client,
+				       string &url)
 {
-	// Send the image data as a post request to the API endpoint
-	auto resp = client.post(url).body(input).send();
-
-	// Store the JSON response from the API
-	std::string result;
-
-	// Handle the response from the API
-	resp.then(
-		[&](Http::Response response) {
-			std::cout << "Response code = " << response.code()
-				  << std::endl;
-			auto body = response.body();
-			if (!body.empty()) {
-				std::cout << "Response body size = "
-					  << body.size() << std::endl;
-				// Handle response
-				result = body;
-			}
-		},
-		[&](std::exception_ptr
-			    exc) { // In case of an exception, set the objects count to 0
-			result = "";
-			PrintException excPrinter;
-			excPrinter(exc);
-		});
-	// Push the response promise to the vector of responses
-	responses.push_back(std::move(resp));
+	// Encode the input frame as a jpg image. The caller expects results in
+	// frame coordinates, so only the quality is lowered to fit the limit
+	UploadOptions options;
+	options.max_side = 0;
+	std::string image_data;
+	if (encode_upload(frame, options, image_data) != 1.0) {
+		std::cerr << "Warning: Image was downscaled to fit the upload "
+			     "limit, results are not in frame coordinates"
+			  << std::endl;
+	}
 
-	// Wait for all the responses to complete
-	auto sync = Async::whenAll(responses.begin(), responses.end());
-	Async::Barrier<std::vector<Http::Response> > barrier(sync);
-	barrier.wait();
+	// Send the image data and wait for this request only
+	return response_body(
+		send_request_async(client, url, std::move(image_data)).get());
+}
 
-	// Return the JSON response from the API
-	return result;
+/**
+ * @brief      send data to the API endpoint
+ *
+ * @param      input      - input json
+ * @param      client     - HTTP client object
+ * @param      url        - API endpoint URL
+ *
+ * @return     JSON response from the API
+ */
+std::string send_json_request_to_api_server(std::string &input,
+					    Http::Experimental::Client &client,
+					    string &url)
+{
+	// Send the json and wait for this request only
+	return response_body(send_request_async(client, url, input).get());
 }
 
 /**
@@ -153,6 +1034,7 @@ std::string send_json_request_to_api_server(
  */
 void draw_label(cv::Mat &input_image, string label, int left, int top)
 {
+	TraceSpan span(TRACE_DRAW);
 	// Display the label at the top of the bounding box.
 	int baseLine;
 	cv::Size label_size = cv::getTextSize(label, cv::FONT_HERSHEY_SIMPLEX,
@@ -174,98 +1056,46 @@ void draw_label(cv::Mat &input_image, string label, int left, int top)
 void draw_bounding_box(cv::Mat &input_image, int left, int top, int width,
 		       int height)
 {
+	TraceSpan span(TRACE_DRAW);
 	// Draw bounding boxes
 	cv::rectangle(input_image, cv::Rect2i(top, left, width, height),
 		      cv::Scalar(0, 255, 255), 2);
 }
 
-/**
- * @brief      Dispaly the image 
- *
- * @param      image  The image
- */
-void display_output_image(cv::Mat &image)
+void draw_poses(cv::Mat &input_image, const std::vector<Pose> &poses,
+		float min_confidence)
 {
-	// Visualize results
-	std::cout << "Press any key to continue..." << std::endl;
-	cv::imshow("Result Image", image);
-	cv::waitKey(0);
-}
+	TraceSpan span(TRACE_DRAW);
+	static const int joint_pairs[16][2] = {
+		{ 0, 1 },   { 1, 3 },	{ 0, 2 },   { 2, 4 },
+		{ 5, 6 },   { 5, 7 },	{ 7, 9 },   { 6, 8 },
+		{ 8, 10 },  { 5, 11 },	{ 6, 12 },  { 11, 12 },
+		{ 11, 13 }, { 12, 14 }, { 13, 15 }, { 14, 16 }
+	};
 
-/**
- * @brief      Saves image to disk to disk.
- *
- * @param      image       The image
- * @param[in]  image_path  The image path
- * @param[in]  output_dir  The output dir
- */
-void save_to_disk(cv::Mat &image, const std::string image_path,
-		  const std::string output_dir)
-{
-	cout << "Saving results...\n";
-	if (!filesystem::exists(output_dir)) {
-		filesystem::create_directory(output_dir);
-	}
-	// Save the output image
-	std::string output_image =
-		output_dir + "/result_" +
-		image_path.substr(image_path.find_last_of("/") + 1);
-	cv::imwrite(output_image, image);
-}
-
-/**
- * @brief      Saves face embeddings to JSON file on disk.
- *
- * @param[in]  name	   name of the person
- * @param[in]  embeddings  The face embeddings
- * @param[in]  output_dir  The output dir
- */
-void save_embeddings_to_disk(const std::string &name,
-			     const rapidjson::Value &embeddings,
-			     const std::string &output_dir,
-			     const std::string &json_path)
-{
-	std::fstream file;
-	rapidjson::Document embedings_json;
-	rapidjson::Value face(rapidjson::kObjectType);
-	/* Check if the file exists */
-	std::string output_file = output_dir + "/" + json_path;
-
-	if (!filesystem::exists(output_dir)) {
-		/* Create directory */
-		filesystem::create_directory(output_dir);
-	}
-	if (filesystem::exists(output_file)) {
-		/* Read existing file */
-		std::ifstream ifs(output_file);
-		rapidjson::IStreamWrapper isw(ifs);
-
-		embedings_json.ParseStream(isw);
-	} else {
-		file.open(output_file, ios::out);
-		if (!file) {
-			std::cerr << "Error in creating file!!!"<<std::endl;
-			file.close();
-                        return;
+	for (auto &pose : poses) {
+		const std::vector<PosePoint> &points = pose.points;
+		for (size_t j = 0; j < points.size(); j++) {
+			/*Check if the confidence is above threshold*/
+			if (points[j].confidence < min_confidence) {
+				continue;
+			}
+			//Draw Joints
+			cv::circle(input_image,
+				   cv::Point2f((int)points[j].x,
+					       (int)points[j].y),
+				   3, cv::Scalar(0, 255, 0), -1);
+			if (j > 15 ||
+			    (size_t)joint_pairs[j][0] >= points.size() ||
+			    (size_t)joint_pairs[j][1] >= points.size()) {
+				continue;
+			}
+			const PosePoint &p1 = points[joint_pairs[j][0]];
+			const PosePoint &p2 = points[joint_pairs[j][1]];
+			// Draw Bone
+			cv::line(input_image, cv::Point2f((int)p1.x, (int)p1.y),
+				 cv::Point2f((int)p2.x, (int)p2.y),
+				 cv::Scalar(255, 0, 0), 2, cv::LINE_8);
 		}
-                file.close();
-		embedings_json.SetArray();
-	}
-
-	/* Add member */
-	rapidjson::Value nameValue(name.c_str(), embedings_json.GetAllocator());
-	face.AddMember("name", nameValue, embedings_json.GetAllocator());
-	rapidjson::Value embeddingsCopy(embeddings,
-					embedings_json.GetAllocator());
-	face.AddMember("embeddings", embeddingsCopy,
-		       embedings_json.GetAllocator());
-	embedings_json.PushBack(face, embedings_json.GetAllocator());
-
-	/* Save to Disk */
-	std::cout << "Saving results..." << std::endl;
-	std::ofstream ofs(output_file);
-	rapidjson::OStreamWrapper osw(ofs);
-
-	rapidjson::Writer<rapidjson::OStreamWrapper> writer(osw);
-	embedings_json.Accept(writer);
+	}
 }
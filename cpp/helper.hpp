@@ -5,13 +5,26 @@
  * @author     ShunyaOS Team
  * @date       2023
  */
+#ifndef HELPER_HPP
+#define HELPER_HPP
+
 #include <pistache/client.h>
 #include <pistache/http.h>
 #include <pistache/net.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <filesystem>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
 
 #include <opencv2/dnn.hpp>
 #include <opencv2/imgproc.hpp>
@@ -27,21 +40,456 @@
 #include <rapidjson/istreamwrapper.h>
 #include <rapidjson/ostreamwrapper.h>
 
+#include "api_result.hpp"
+
+#define API_DETECT_FACE "/v1/detectface"
+#define API_DETECT_OBJECTS "/v1/detectobjects"
+#define API_ESTIMATE_POSE "/v1/estimatepose"
+#define API_CLASSIFY_IMAGE "/v1/classifyimage"
+#define API_FACE_TO_EMBEDDING "/v1/face2embedding"
+#define API_COMPARE_FACE "/v1/compareface"
+
+/* Largest image body accepted by the server (maxLength in openapi.yaml) */
+#define API_MAX_IMAGE_SIZE 1048576
+
 using namespace Pistache;
 using namespace std;
+
+/**
+ * @brief      Outcome of a request to the API server.
+ */
+struct ApiResponse {
+	int code = 0;	   /* HTTP status code, 0 if no response arrived */
+	std::string body;  /* Response body */
+	std::string error; /* Transport error, empty if a response arrived */
+	double latency_ms = 0; /* Attempt sent until answered, without the
+				* wait for a free slot */
+};
+
+/**
+ * @brief      Completion callback of an asynchronous request.
+ *
+ *             Runs on a client I/O thread, so it must not block; in
+ *             particular it must not call a blocking post() on the same
+ *             session, use try_post() instead.
+ */
+typedef std::function<void(ApiResponse &)> ApiCallback;
+
+/**
+ * @brief      Send a POST request without waiting for the response.
+ *
+ * @param      client  - HTTP client object
+ * @param[in]  url     - API endpoint URL
+ * @param[in]  body    - Request body, moved into the request
+ * @param[in]  done    - Completion callback
+ */
+void send_request_async(Http::Experimental::Client &client,
+			const std::string &url, std::string body,
+			ApiCallback done);
+
+/**
+ * @brief      Send a POST request without waiting for the response.
+ *
+ * @return     Future resolved with the response
+ */
+std::future<ApiResponse> send_request_async(Http::Experimental::Client &client,
+					     const std::string &url,
+					     std::string body);
+
+/**
+ * @brief      How images are prepared before upload.
+ */
+struct UploadOptions {
+	int max_side = 1280;	/* Longest side sent, 0 keeps the original */
+	int quality = 90;	/* Initial JPEG quality */
+	int min_quality = 50;	/* Lowest quality before downscaling further */
+	size_t max_bytes = API_MAX_IMAGE_SIZE; /* 0 disables the limit */
+};
+
+/**
+ * @brief      Tunables of an ApiSession.
+ */
+struct ApiSessionOptions {
+	int threads = 2;		   /* Client I/O threads */
+	int max_connections_per_host = 4;  /* Kept-alive TCP connections */
+	size_t max_in_flight = 4;	   /* Requests per host, initial window */
+	size_t max_response_size = 1024 * 1024 * 100;
+	UploadOptions upload;
+
+	/* Server pool, see ServerPool */
+	int timeout_ms = 0;	      /* Request timeout, 0 waits forever */
+	int hedge_ms = 0;	      /* Duplicate slow requests, 0 disables */
+	int eject_after = 3;	      /* Consecutive failures to eject a node */
+	int probe_ms = 1000;	      /* First probe of an ejected node */
+	int max_probe_ms = 30000;     /* Probe interval limit, doubles */
+
+	/* Adaptive concurrency, see ServerPool */
+	bool adaptive = true;	      /* Adapt the window, else max_in_flight */
+	size_t max_limit = 64;	      /* Largest adaptive window */
+	double latency_tolerance = 2; /* Latency / baseline that shrinks it */
+	int max_retries = 3;	      /* Retries of a 429 answer */
+	int retry_base_ms = 50;	      /* First retry backoff, doubles */
+	int deadline_ms = 10000;      /* No retry starts after this */
+};
+
+/**
+ * @brief      Schedules requests over one or more servers.
+ *
+ *             Each request goes to the healthy node with the most room in
+ *             its window, ties broken by the lowest latency (EWMA). A node
+ *             is ejected after eject_after consecutive errors, 5xx
+ *             responses or timeouts, and gets a single probe request after
+ *             probe_ms, backing off exponentially while the probes fail. A
+ *             failed request is retried once on another node. With
+ *             hedge_ms set, a request still outstanding after hedge_ms is
+ *             also sent to another idle node and the first answer wins.
+ *
+ *             The window of a node adapts AIMD style: it grows by one per
+ *             window of requests while latency stays within
+ *             latency_tolerance of the lowest seen, shrinks by 10% when
+ *             latency inflates and halves on 429 Too Many Requests, at
+ *             most once per round trip. A 429 answer is retried after a
+ *             jittered exponential backoff, up to max_retries times and
+ *             only while the deadline has not passed.
+ */
+class ServerPool {
+public:
+	/**
+	 * @brief      State of one node, for reporting.
+	 */
+	struct NodeStats {
+		std::string url;
+		size_t in_flight;
+		double limit;	   /* Current window */
+		double latency_ms; /* EWMA of successful requests */
+		bool ejected;
+		size_t requests;
+		size_t failures;
+		size_t throttled;  /* 429 answers */
+	};
+
+	ServerPool(Http::Experimental::Client &client,
+		   const std::vector<std::string> &servers,
+		   const ApiSessionOptions &options);
+	~ServerPool();
+
+	ServerPool(const ServerPool &) = delete;
+	ServerPool &operator=(const ServerPool &) = delete;
+
+	/**
+	 * @brief      Send a request, waiting for a node with a free slot.
+	 */
+	void post(const std::string &endpoint, std::string body,
+		  ApiCallback done);
+
+	/**
+	 * @brief      Like post() but gives up if every node is busy.
+	 *
+	 * @return     false if the request was not sent
+	 */
+	bool try_post(const std::string &endpoint, std::string body,
+		      ApiCallback done);
+
+	/**
+	 * @brief      Wait until every request sent so far has completed.
+	 */
+	void wait_idle();
+
+	size_t size() const { return nodes_.size(); }
+	const std::string &url(size_t node) const { return nodes_[node].url; }
+	std::vector<NodeStats> stats();
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Node {
+		std::string url;
+		size_t in_flight = 0;
+		double limit = 1;
+		double latency_ms = 0;
+		double base_latency_ms = 0; /* Lowest latency, slowly rising */
+		Clock::time_point last_decrease;
+		int failures = 0; /* Consecutive */
+		bool ejected = false;
+		int backoff_ms = 0;
+		Clock::time_point retry_at;
+		size_t requests = 0;
+		size_t errors = 0;
+		size_t throttled = 0;
+	};
+
+	/* One logical request and its attempts */
+	struct Call {
+		std::string endpoint;
+		/* Shared by the attempts, each sends its own copy */
+		std::shared_ptr<std::string> body;
+		bool resend = false; /* Retry, failover or hedge possible */
+		ApiCallback done;
+		ApiResponse throttled; /* Last 429 answer, while retrying */
+		Clock::time_point deadline;
+		std::atomic<bool> answered{ false };
+		std::atomic<int> pending{ 0 }; /* Attempts sent or scheduled */
+		int retries = 0;		/* 429 retries */
+		bool failed_over = false;
+		bool hedged = false;
+		int node = -1; /* Node of the first attempt */
+	};
+
+	/* Work for the timer thread: a hedge or a delayed retry */
+	struct Timer {
+		Clock::time_point due;
+		std::shared_ptr<Call> call;
+		bool retry;
+		bool operator<(const Timer &other) const
+		{
+			return due > other.due;
+		}
+	};
+
+	bool available(const Node &node, Clock::time_point now) const;
+	int pick(int exclude, Clock::time_point now) const;
+	void decrease(Node &node, double factor, Clock::time_point now);
+	void adapt(Node &node, double ms, Clock::time_point now);
+	std::shared_ptr<Call> make_call(const std::string &endpoint,
+					std::string &body, ApiCallback done);
+	void start(const std::shared_ptr<Call> &call, int node);
+	void complete(const std::shared_ptr<Call> &call, int node,
+		      Clock::time_point sent, ApiResponse &response);
+	void finish(const std::shared_ptr<Call> &call, ApiResponse &response,
+		    bool ok);
+	void timer_loop();
+
+	Http::Experimental::Client &client_;
+	ApiSessionOptions options_;
+	std::vector<Node> nodes_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	size_t in_flight_ = 0; /* Attempts sent or scheduled */
+
+	std::priority_queue<Timer> timers_;
+	std::condition_variable timer_cond_;
+	bool stop_ = false;
+	std::thread timer_thread_;
+};
+
+/**
+ * @brief      Long-lived connection to one or more BrainyPi AI servers.
+ *
+ *             Owns a single HTTP client whose threads and keep-alive
+ *             connections are reused by every request, instead of
+ *             creating and tearing down a client per call. Requests are
+ *             spread over the servers by a ServerPool. Thread safe; one
+ *             session is meant to be shared by the whole program.
+ */
+class ApiSession {
+public:
+	/**
+	 * @brief      Connect to servers.
+	 *
+	 * @param[in]  server   Base URL, e.g. "http://localhost:9900", or
+	 *                      several separated by commas
+	 * @param[in]  options  Client tunables
+	 */
+	explicit ApiSession(const std::string &server,
+			    const ApiSessionOptions &options = ApiSessionOptions());
+	explicit ApiSession(const std::vector<std::string> &servers,
+			    const ApiSessionOptions &options = ApiSessionOptions());
+	~ApiSession();
+
+	ApiSession(const ApiSession &) = delete;
+	ApiSession &operator=(const ApiSession &) = delete;
+
+	/*
+	 * Image endpoints. The image is prepared with upload_options(); if
+	 * scale is given it receives the factor that maps coordinates of the
+	 * response back to the image, see ApiResult::rescale().
+	 */
+
+	/* /v1/detectface */
+	std::future<ApiResponse> detect_face(const cv::Mat &image,
+					     double *scale = nullptr);
+	/* /v1/detectobjects */
+	std::future<ApiResponse> detect_objects(const cv::Mat &image,
+						double *scale = nullptr);
+	/* /v1/estimatepose */
+	std::future<ApiResponse> estimate_pose(const cv::Mat &image,
+					       double *scale = nullptr);
+	/* /v1/classifyimage */
+	std::future<ApiResponse> classify_image(const cv::Mat &image,
+						double *scale = nullptr);
+	/* /v1/face2embedding */
+	std::future<ApiResponse> face_to_embedding(const cv::Mat &image,
+						   double *scale = nullptr);
+
+	/*
+	 * Same for an image file. A JPEG within the upload limits is sent
+	 * as read from disk, without decoding it; other files are decoded
+	 * and prepared like an image.
+	 */
+	std::future<ApiResponse> detect_face(const std::string &image_path,
+					     double *scale = nullptr);
+	std::future<ApiResponse> detect_objects(const std::string &image_path,
+						double *scale = nullptr);
+	std::future<ApiResponse> estimate_pose(const std::string &image_path,
+					       double *scale = nullptr);
+	std::future<ApiResponse> classify_image(const std::string &image_path,
+						double *scale = nullptr);
+	std::future<ApiResponse>
+	face_to_embedding(const std::string &image_path,
+			  double *scale = nullptr);
+	/**
+	 * @brief      Send one image to several endpoints at once.
+	 *
+	 *             The image is read and encoded once and the requests run
+	 *             concurrently, so the answer takes as long as the slowest
+	 *             endpoint rather than the sum of all of them.
+	 *
+	 * @return     One response per endpoint, in the same order
+	 */
+	std::vector<std::future<ApiResponse> >
+	analyze(const std::vector<std::string> &endpoints,
+		const cv::Mat &image, double *scale = nullptr);
+	std::vector<std::future<ApiResponse> >
+	analyze(const std::vector<std::string> &endpoints,
+		const std::string &image_path, double *scale = nullptr);
+
+	/* /v1/compareface */
+	std::future<ApiResponse> compare_face(const std::vector<float> &face1,
+					      const std::vector<float> &face2);
+
+	/**
+	 * @brief      Send a request body to an endpoint of this server.
+	 *
+	 * @param[in]  endpoint  Endpoint path, e.g. API_DETECT_FACE
+	 * @param[in]  body      Request body, moved into the request
+	 * @param[in]  done      Completion callback
+	 */
+	void post(const std::string &endpoint, std::string body,
+		  ApiCallback done);
+	std::future<ApiResponse> post(const std::string &endpoint,
+				      std::string body);
+
+	/**
+	 * @brief      Like post() but gives up if the request window is full.
+	 *
+	 * @return     false if the request was not sent
+	 */
+	bool try_post(const std::string &endpoint, std::string body,
+		      ApiCallback done);
+
+	/**
+	 * @brief      Wait until every request sent so far has completed.
+	 */
+	void wait_idle() { pool_.wait_idle(); }
+
+	/* First server */
+	const std::string &server() const { return pool_.url(0); }
+	const UploadOptions &upload_options() const { return upload_; }
+	ServerPool &pool() { return pool_; }
+
+private:
+	std::future<ApiResponse> post_image(const std::string &endpoint,
+					    const cv::Mat &image, double *scale);
+	std::future<ApiResponse> post_image(const std::string &endpoint,
+					    const std::string &image_path,
+					    double *scale);
+	std::vector<std::future<ApiResponse> >
+	post_all(const std::vector<std::string> &endpoints, std::string body);
+	bool prepare_image(const std::string &image_path, std::string &jpeg,
+			   double *scale, std::string &error);
+
+	UploadOptions upload_;
+	Http::Experimental::Client client_;
+	ServerPool pool_;
+};
+
+/**
+ * @brief      Split a comma separated list of server URLs.
+ */
+std::vector<std::string> split_servers(const std::string &servers);
+
+/**
+ * @brief      Servers the examples connect to.
+ *
+ * @param[in]  fallback  Used if BRAINYPI_SERVERS is not set
+ *
+ * @return     BRAINYPI_SERVERS ("http://a:9900,http://b:9900") or fallback
+ */
+std::string api_servers(const std::string &fallback);
+
+/**
+ * @brief      Read an image file, timed as the decode stage (trace.hpp).
+ *
+ * @return     The image, empty if the file cannot be read
+ */
+cv::Mat read_image(const std::string &image_path);
+
+/**
+ * @brief      Read the size of a JPEG image from its header.
+ *
+ * @param[in]  data    JPEG bytes
+ * @param[out] width   Image width
+ * @param[out] height  Image height
+ *
+ * @return     false if data is not a JPEG or is stored rotated (EXIF)
+ */
+bool jpeg_info(const std::string &data, int &width, int &height);
+
+/**
+ * @brief      Read an image file that can be uploaded without re-encoding.
+ *
+ * @param[in]  path     Image file
+ * @param[in]  options  Upload limits the file has to meet
+ * @param[out] jpeg     File contents
+ *
+ * @return     false if the file is not such a JPEG, it must then be decoded
+ */
+bool read_upload_file(const std::string &path, const UploadOptions &options,
+		      std::string &jpeg);
+
+/**
+ * @brief      Build the request body of /v1/compareface.
+ */
+std::string compare_face_body(const std::vector<float> &face1,
+			      const std::vector<float> &face2);
+
+/**
+ * @brief      Downscale and encode an image so it fits an upload.
+ *
+ *             The image is first shrunk to options.max_side. If the JPEG is
+ *             larger than options.max_bytes the quality is lowered down to
+ *             options.min_quality, then the image is shrunk further.
+ *
+ * @param[in]  image    The image
+ * @param[in]  options  Upload limits
+ * @param[out] jpeg     JPEG bytes
+ *
+ * @return     Original size / uploaded size, to map results back
+ */
+double encode_upload(const cv::Mat &image, const UploadOptions &options,
+		     std::string &jpeg);
+
+/**
+ * @brief      Print the status of a completed request and return its body.
+ *
+ * @param[in]  response  The response
+ *
+ * @return     Response body, empty if the request failed
+ */
+std::string response_body(ApiResponse response);
+
 /**
  * @brief      send data to the API endpoint
  *
  * @param      frame      - input image
  * @param      client     - HTTP client object
  * @param      url        - API endpoint URL
- * @param      responses  - vector of promises for HTTP responses
  *
  * @return     JSON response from the API
  */
-std::string send_request_to_api_server(
-	cv::Mat &frame, Http::Experimental::Client &client, string &url,
-	std::vector<Async::Promise<Http::Response> > &responses);
+std::string send_request_to_api_server(cv::Mat &frame,
+				       Http::Experimental::Client &client,
+				       string &url);
 
 /**
  * @brief      send data to the API endpoint
@@ -49,13 +497,12 @@ std::string send_request_to_api_server(
  * @param      input      - input json
  * @param      client     - HTTP client object
  * @param      url        - API endpoint URL
- * @param      responses  - vector of promises for HTTP responses
  *
  * @return     JSON response from the API
  */
-std::string send_json_request_to_api_server(
-	std::string &input, Http::Experimental::Client &client, string &url,
-	std::vector<Async::Promise<Http::Response> > &responses);
+std::string send_json_request_to_api_server(std::string &input,
+					    Http::Experimental::Client &client,
+					    string &url);
 
 /**
  * @brief      Draw a label on an input image with the specified text, position
@@ -73,30 +520,13 @@ void draw_label(cv::Mat &input_image, string label, int left, int top);
 void draw_bounding_box(cv::Mat &input_image, int left, int top, int width, int height);
 
 /**
- * @brief      Dispaly the image 
+ * @brief      Draw the joints and bones of pose skeletons.
  *
- * @param      image  The image
+ * @param      input_image     The image to draw on
+ * @param[in]  poses           Poses in image coordinates
+ * @param[in]  min_confidence  Joints below it and their bones are not drawn
  */
-void display_output_image(cv::Mat &image);
+void draw_poses(cv::Mat &input_image, const std::vector<Pose> &poses,
+		float min_confidence);
 
-/**
- * @brief      Saves image to disk to disk.
- *
- * @param      image       The image
- * @param[in]  image_path  The image path
- * @param[in]  output_dir  The output dir
- */
-void save_to_disk(cv::Mat &image, const std::string image_path,
-		  const std::string output_dir);
-
-/**
- * @brief      Saves face embeddings to JSON file on disk.
- *
- * @param[in]  name	   name of the person
- * @param[in]  embeddings  The face embeddings
- * @param[in]  output_dir  The output dir
- */
-void save_embeddings_to_disk(const std::string &name, 
-			     const rapidjson::Value &embeddings, 
-			     const std::string &output_dir,
-			     const std::string &json_path);
\ No newline at end of file
+#endif
@@ -0,0 +1,401 @@
+/**
+ *
+ * @brief      Hierarchical navigable small world graph for approximate
+ *             nearest neighbour search over embeddings.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <queue>
+
+#include "hnsw.hpp"
+
+#define HNSW_MAGIC "BPHN"
+#define HNSW_VERSION 1
+
+/* Highest layer a node can be put on */
+#define HNSW_MAX_LEVEL 16
+
+struct HnswHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t dim;
+	uint32_t m;
+	uint64_t count;
+	int32_t max_level;
+	uint32_t entry;
+};
+
+/**
+ * @brief      Rows seen by the current search, one per thread.
+ *
+ *             A row is visited if its mark equals the epoch, so starting a
+ *             search costs nothing until the epoch wraps.
+ */
+struct VisitedRows {
+	std::vector<uint32_t> marks;
+	uint32_t epoch = 0;
+
+	void start(size_t rows)
+	{
+		if (marks.size() < rows) {
+			marks.resize(rows, 0);
+		}
+		if (++epoch == 0) {
+			std::fill(marks.begin(), marks.end(), 0);
+			epoch = 1;
+		}
+	}
+
+	/* Mark a row, false if it already was */
+	bool visit(uint32_t id)
+	{
+		if (marks[id] == epoch) {
+			return false;
+		}
+		marks[id] = epoch;
+		return true;
+	}
+};
+
+static thread_local VisitedRows visited;
+
+HnswGraph::HnswGraph(const HnswOptions &options)
+	: options_(options), rng_(options.seed)
+{
+	options_.m = std::max<size_t>(options_.m, 2);
+	options_.ef_construction =
+		std::max(options_.ef_construction, options_.m);
+	level_mult_ = 1.0 / std::log((double)options_.m);
+}
+
+int HnswGraph::random_level()
+{
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	double r = 1.0 - uniform(rng_);
+
+	return std::min((int)(-std::log(r) * level_mult_), HNSW_MAX_LEVEL);
+}
+
+uint32_t *HnswGraph::links(uint32_t id, int level)
+{
+	if (level == 0) {
+		return links0_.data() + (size_t)id * (2 * options_.m + 1);
+	}
+	return upper_[id].data() + (level - 1) * (options_.m + 1);
+}
+
+const uint32_t *HnswGraph::links(uint32_t id, int level) const
+{
+	return const_cast<HnswGraph *>(this)->links(id, level);
+}
+
+uint32_t HnswGraph::greedy(const HnswSpace &space, const void *query,
+			   uint32_t entry, int top, int bottom) const
+{
+	float best = space.distance(entry, query);
+
+	for (int level = top; level > bottom; level--) {
+		bool moved = true;
+		while (moved) {
+			moved = false;
+			const uint32_t *l = links(entry, level);
+			for (uint32_t i = 1; i <= l[0]; i++) {
+				float d = space.distance(l[i], query);
+				if (d < best) {
+					best = d;
+					entry = l[i];
+					moved = true;
+				}
+			}
+		}
+	}
+	return entry;
+}
+
+void HnswGraph::search_layer(const HnswSpace &space, const void *query,
+			     const std::vector<Candidate> &entries, size_t ef,
+			     int level, std::vector<Candidate> &found) const
+{
+	/* Closest candidate first, and the farthest result first */
+	std::priority_queue<Candidate, std::vector<Candidate>,
+			    std::greater<Candidate> >
+		candidates;
+	std::priority_queue<Candidate> results;
+
+	visited.start(size());
+	for (auto &e : entries) {
+		if (visited.visit(e.second)) {
+			candidates.push(e);
+			results.push(e);
+		}
+	}
+	while (results.size() > ef) {
+		results.pop();
+	}
+
+	while (!candidates.empty()) {
+		Candidate c = candidates.top();
+		if (results.size() >= ef && c.first > results.top().first) {
+			break;
+		}
+		candidates.pop();
+
+		const uint32_t *l = links(c.second, level);
+		for (uint32_t i = 1; i <= l[0]; i++) {
+			if (i < l[0]) {
+				__builtin_prefetch(space.row(l[i + 1]));
+			}
+			if (!visited.visit(l[i])) {
+				continue;
+			}
+			float d = space.distance(l[i], query);
+			if (results.size() < ef || d < results.top().first) {
+				candidates.emplace(d, l[i]);
+				results.emplace(d, l[i]);
+				if (results.size() > ef) {
+					results.pop();
+				}
+			}
+		}
+	}
+
+	found.resize(results.size());
+	for (size_t i = found.size(); i-- > 0;) {
+		found[i] = results.top();
+		results.pop();
+	}
+}
+
+/**
+ * Keep a candidate only if it is closer to the new node than to every
+ * neighbour kept so far, so links spread in all directions instead of
+ * piling up inside one cluster of near duplicates.
+ */
+void HnswGraph::select(const HnswSpace &space,
+		       std::vector<Candidate> &candidates, size_t m) const
+{
+	std::vector<Candidate> kept;
+
+	if (candidates.size() <= m) {
+		return;
+	}
+	std::sort(candidates.begin(), candidates.end());
+	for (auto &c : candidates) {
+		if (kept.size() >= m) {
+			break;
+		}
+		bool diverse = true;
+		for (auto &k : kept) {
+			if (space.distance(c.second, space.row(k.second)) <
+			    c.first) {
+				diverse = false;
+				break;
+			}
+		}
+		if (diverse) {
+			kept.push_back(c);
+		}
+	}
+	candidates.swap(kept);
+}
+
+void HnswGraph::connect(const HnswSpace &space, uint32_t from, uint32_t to,
+			int level)
+{
+	uint32_t *l = links(from, level);
+	size_t m = max_links(level);
+
+	if (l[0] < m) {
+		l[++l[0]] = to;
+		return;
+	}
+
+	/* Full: keep the best spread of the old links and the new one */
+	const void *row = space.row(from);
+	std::vector<Candidate> candidates;
+	candidates.reserve(m + 1);
+	for (uint32_t i = 1; i <= l[0]; i++) {
+		candidates.emplace_back(space.distance(l[i], row), l[i]);
+	}
+	candidates.emplace_back(space.distance(to, row), to);
+	select(space, candidates, m);
+
+	l[0] = candidates.size();
+	for (size_t i = 0; i < candidates.size(); i++) {
+		l[i + 1] = candidates[i].second;
+	}
+}
+
+void HnswGraph::insert(const HnswSpace &space)
+{
+	uint32_t id = size();
+	int level = random_level();
+	const void *query = space.row(id);
+
+	levels_.push_back(level);
+	links0_.resize(links0_.size() + 2 * options_.m + 1, 0);
+	upper_.emplace_back((size_t)level * (options_.m + 1), 0);
+
+	if (max_level_ < 0) {
+		entry_ = id;
+		max_level_ = level;
+		return;
+	}
+
+	uint32_t entry = greedy(space, query, entry_, max_level_, level);
+	std::vector<Candidate> entries = { { space.distance(entry, query),
+					     entry } };
+	std::vector<Candidate> found, neighbours;
+
+	for (int l = std::min(level, max_level_); l >= 0; l--) {
+		search_layer(space, query, entries, options_.ef_construction,
+			     l, found);
+		neighbours = found;
+		select(space, neighbours, max_links(l));
+
+		uint32_t *own = links(id, l);
+		own[0] = neighbours.size();
+		for (size_t i = 0; i < neighbours.size(); i++) {
+			own[i + 1] = neighbours[i].second;
+			connect(space, neighbours[i].second, id, l);
+		}
+		entries.swap(found);
+	}
+
+	if (level > max_level_) {
+		max_level_ = level;
+		entry_ = id;
+	}
+}
+
+void HnswGraph::search(const HnswSpace &space, const void *query, size_t k,
+		       std::vector<Match> &out) const
+{
+	out.clear();
+	if (size() == 0 || k == 0) {
+		return;
+	}
+
+	uint32_t entry = greedy(space, query, entry_, max_level_, 0);
+	std::vector<Candidate> found;
+	search_layer(space, query, { { space.distance(entry, query), entry } },
+		     std::max(options_.ef_search, k), 0, found);
+
+	k = std::min(k, found.size());
+	out.reserve(k);
+	for (size_t i = 0; i < k; i++) {
+		out.emplace_back(1.0f - found[i].first, found[i].second);
+	}
+}
+
+bool HnswGraph::save(const std::string &path, size_t dim) const
+{
+	std::string tmp = path + ".tmp";
+	std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+	HnswHeader header = {};
+
+	std::memcpy(header.magic, HNSW_MAGIC, 4);
+	header.version = HNSW_VERSION;
+	header.dim = dim;
+	header.m = options_.m;
+	header.count = size();
+	header.max_level = max_level_;
+	header.entry = entry_;
+
+	ofs.write((const char *)&header, sizeof(header));
+	ofs.write((const char *)levels_.data(), levels_.size());
+	ofs.write((const char *)links0_.data(),
+		  links0_.size() * sizeof(uint32_t));
+	for (auto &upper : upper_) {
+		ofs.write((const char *)upper.data(),
+			  upper.size() * sizeof(uint32_t));
+	}
+	ofs.close();
+	if (!ofs) {
+		std::cerr << "Error: Cannot write " << tmp << std::endl;
+		std::remove(tmp.c_str());
+		return false;
+	}
+	return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool HnswGraph::load(const std::string &path, size_t dim, size_t max_rows)
+{
+	std::ifstream ifs(path, std::ios::binary);
+	HnswHeader header;
+
+	if (!ifs || !ifs.read((char *)&header, sizeof(header))) {
+		return false;
+	}
+	if (std::memcmp(header.magic, HNSW_MAGIC, 4) != 0 ||
+	    header.version != HNSW_VERSION || header.dim != dim ||
+	    header.m < 2 || header.count > max_rows ||
+	    header.max_level > HNSW_MAX_LEVEL ||
+	    (header.count > 0 && header.entry >= header.count)) {
+		std::cerr << "Warning: " << path
+			  << " does not match the face gallery" << std::endl;
+		return false;
+	}
+
+	clear();
+	options_.m = header.m;
+	level_mult_ = 1.0 / std::log((double)options_.m);
+	levels_.resize(header.count);
+	links0_.resize(header.count * (2 * options_.m + 1));
+	upper_.resize(header.count);
+	ifs.read((char *)levels_.data(), levels_.size());
+	ifs.read((char *)links0_.data(), links0_.size() * sizeof(uint32_t));
+	for (size_t i = 0; i < upper_.size() && ifs; i++) {
+		upper_[i].resize((size_t)levels_[i] * (options_.m + 1));
+		ifs.read((char *)upper_[i].data(),
+			 upper_[i].size() * sizeof(uint32_t));
+	}
+
+	/* A damaged graph would send searches out of bounds */
+	bool valid = (bool)ifs;
+	for (uint32_t id = 0; valid && id < header.count; id++) {
+		for (int level = 0; valid && level <= levels_[id]; level++) {
+			const uint32_t *l = links(id, level);
+			valid = levels_[id] <= header.max_level &&
+				l[0] <= max_links(level);
+			for (uint32_t i = 1; valid && i <= l[0]; i++) {
+				valid = l[i] < header.count;
+			}
+		}
+	}
+	if (!valid) {
+		std::cerr << "Warning: " << path << " is damaged" << std::endl;
+		clear();
+		return false;
+	}
+	max_level_ = header.count > 0 ? header.max_level : -1;
+	entry_ = header.entry;
+	return true;
+}
+
+size_t HnswGraph::memory() const
+{
+	size_t bytes = levels_.capacity() + links0_.capacity() * sizeof(uint32_t);
+
+	for (auto &upper : upper_) {
+		bytes += sizeof(upper) + upper.capacity() * sizeof(uint32_t);
+	}
+	return bytes;
+}
+
+void HnswGraph::clear()
+{
+	max_level_ = -1;
+	entry_ = 0;
+	levels_.clear();
+	links0_.clear();
+	upper_.clear();
+}
@@ -0,0 +1,145 @@
+/**
+ *
+ * @brief      Hierarchical navigable small world graph for approximate
+ *             nearest neighbour search over embeddings.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef HNSW_HPP
+#define HNSW_HPP
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief      Rows the graph is built on.
+ *
+ *             The owner keeps the vectors and may store them in any form,
+ *             e.g. float or quantized; the graph only asks for distances.
+ */
+class HnswSpace {
+public:
+	virtual ~HnswSpace() = default;
+
+	/* Row id in the form search() takes a query */
+	virtual const void *row(uint32_t id) const = 0;
+
+	/* Distance of row id to a query, 1 - similarity */
+	virtual float distance(uint32_t id, const void *query) const = 0;
+};
+
+/**
+ * @brief      Shape of the graph and effort of a search.
+ */
+struct HnswOptions {
+	size_t m = 16;		      /* Links per node, 2 m on the bottom layer */
+	size_t ef_construction = 100; /* Candidates kept while inserting */
+	size_t ef_search = 64;	      /* Candidates kept per query: higher is
+				       * more accurate and slower */
+	unsigned seed = 42;	      /* Layer assignment */
+};
+
+/**
+ * @brief      HNSW graph (Malkov and Yashunin) over the rows of a space.
+ *
+ *             The graph holds only links; the vectors stay with the owner,
+ *             which passes its HnswSpace to every call, so the rows may
+ *             move as long as row i keeps its values.
+ *
+ *             Every node is on the bottom layer with up to 2 m links, a
+ *             geometrically shrinking share is also on the layers above
+ *             with up to m links. A search walks down greedily from the
+ *             top and ends with a beam search of width ef_search on the
+ *             bottom layer, visiting a few thousand rows whatever the size
+ *             of the gallery.
+ *
+ *             search() may run concurrently, insert() must not overlap
+ *             with anything.
+ */
+class HnswGraph {
+public:
+	/* Similarity (dot product) and row of a match */
+	typedef std::pair<float, uint32_t> Match;
+
+	explicit HnswGraph(const HnswOptions &options = HnswOptions());
+
+	/**
+	 * @brief      Link row size() of a space into the graph.
+	 */
+	void insert(const HnswSpace &space);
+
+	/**
+	 * @brief      Approximate k most similar rows.
+	 *
+	 * @param[in]  space  Rows given to insert()
+	 * @param[in]  query  Query in the form of the space's rows
+	 * @param[in]  k      Number of matches
+	 * @param[out] out    Up to k matches, best first
+	 */
+	void search(const HnswSpace &space, const void *query, size_t k,
+		    std::vector<Match> &out) const;
+
+	/**
+	 * @brief      Write the graph to a file, replacing it atomically.
+	 */
+	bool save(const std::string &path, size_t dim) const;
+
+	/**
+	 * @brief      Read a graph written by save().
+	 *
+	 * @param[in]  path      Graph file
+	 * @param[in]  dim       Values per row the graph must have been built on
+	 * @param[in]  max_rows  Rows available; a graph of more is rejected
+	 *
+	 * @return     false if the file is missing, invalid or does not fit
+	 */
+	bool load(const std::string &path, size_t dim, size_t max_rows);
+
+	void clear();
+
+	void set_ef(size_t ef) { options_.ef_search = ef; }
+	size_t ef() const { return options_.ef_search; }
+	size_t size() const { return levels_.size(); }
+
+	/* Bytes held by the links */
+	size_t memory() const;
+
+private:
+	/* Distance and row of a candidate */
+	typedef std::pair<float, uint32_t> Candidate;
+
+	int random_level();
+	uint32_t *links(uint32_t id, int level);
+	const uint32_t *links(uint32_t id, int level) const;
+	size_t max_links(int level) const
+	{
+		return level == 0 ? 2 * options_.m : options_.m;
+	}
+
+	uint32_t greedy(const HnswSpace &space, const void *query,
+			uint32_t entry, int top, int bottom) const;
+	void search_layer(const HnswSpace &space, const void *query,
+			  const std::vector<Candidate> &entries, size_t ef,
+			  int level, std::vector<Candidate> &found) const;
+	void select(const HnswSpace &space, std::vector<Candidate> &candidates,
+		    size_t m) const;
+	void connect(const HnswSpace &space, uint32_t from, uint32_t to,
+		     int level);
+
+	HnswOptions options_;
+	double level_mult_;
+	std::minstd_rand rng_;
+	int max_level_ = -1;
+	uint32_t entry_ = 0;
+	std::vector<uint8_t> levels_;
+	std::vector<uint32_t> links0_; /* Per node a count and 2 m rows */
+	std::vector<std::vector<uint32_t> > upper_; /* Per node and layer above
+						     * the bottom a count and
+						     * m rows */
+};
+
+#endif
@@ -0,0 +1,76 @@
+/**
+ *
+ * @brief      Identity of tracked faces, so a face is matched once per track.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <algorithm>
+
+#include "identity_cache.hpp"
+
+void IdentityCache::observe(const std::vector<Track> &tracks)
+{
+	/* Both sorted by id, one merge pass */
+	std::vector<const Track *> live;
+	for (auto &track : tracks) {
+		live.push_back(&track);
+	}
+	std::sort(live.begin(), live.end(),
+		  [](const Track *a, const Track *b) { return a->id < b->id; });
+
+	auto it = live.begin();
+	for (auto entry = identities_.begin(); entry != identities_.end();) {
+		while (it != live.end() && (*it)->id < entry->first) {
+			++it;
+		}
+		if (it == live.end() || (*it)->id != entry->first) {
+			entry = identities_.erase(entry);
+			continue;
+		}
+		if ((*it)->misses > options_.max_misses) {
+			entry->second.stale = true;
+		}
+		++entry;
+	}
+}
+
+bool IdentityCache::needs_verification(const Track &track, long frame) const
+{
+	auto it = identities_.find(track.id);
+
+	if (it == identities_.end()) {
+		return true;
+	}
+	const Identity &identity = it->second;
+	if (identity.stale) {
+		return true;
+	}
+	if (identity.confidence >= options_.confident) {
+		return frame - identity.verified >= options_.reverify_every;
+	}
+	return frame - identity.verified >= options_.retry_every;
+}
+
+void IdentityCache::store(int track_id, const std::string &name,
+			  float confidence, long frame)
+{
+	Identity &identity = identities_[track_id];
+
+	identity.name = name;
+	identity.confidence = confidence;
+	identity.verified = frame;
+	identity.stale = false;
+	verifications_++;
+}
+
+const IdentityCache::Identity *IdentityCache::find(int track_id)
+{
+	auto it = identities_.find(track_id);
+
+	if (it == identities_.end()) {
+		return nullptr;
+	}
+	hits_++;
+	return &it->second;
+}
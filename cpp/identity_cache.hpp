@@ -0,0 +1,89 @@
+/**
+ *
+ * @brief      Identity of tracked faces, so a face is matched once per track.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef IDENTITY_CACHE_HPP
+#define IDENTITY_CACHE_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tracker.hpp"
+
+/**
+ * @brief      When a cached identity is trusted, in frames.
+ */
+struct IdentityCacheOptions {
+	float confident = 0.9f;	 /* Match confidence kept until re-verify */
+	int reverify_every = 150; /* Frames a confident identity is kept */
+	int retry_every = 5;	 /* Frames between tries of an uncertain face */
+	int max_misses = 2;	 /* Frames a track may coast and keep its name */
+};
+
+/**
+ * @brief      Names of face tracks, verified on a schedule.
+ *
+ *             A track is verified (embedding + gallery search) when it
+ *             first appears. A confident match is then reused for
+ *             reverify_every frames; an unknown or uncertain face is tried
+ *             again every retry_every frames. A track that went without a
+ *             detection for more than max_misses frames may have jumped to
+ *             another person, so it is verified again as soon as it is
+ *             detected again.
+ */
+class IdentityCache {
+public:
+	struct Identity {
+		std::string name;
+		float confidence = 0;
+		long verified = 0;  /* Frame of the last verification */
+		bool stale = false; /* Tracking was lost for a while */
+	};
+
+	explicit IdentityCache(
+		const IdentityCacheOptions &options = IdentityCacheOptions())
+		: options_(options)
+	{
+	}
+
+	/**
+	 * @brief      Follow the tracks of a frame.
+	 *
+	 *             Forgets tracks that ended and flags the ones that are
+	 *             coasting.
+	 */
+	void observe(const std::vector<Track> &tracks);
+
+	/**
+	 * @brief      Whether a track needs a verification in this frame.
+	 */
+	bool needs_verification(const Track &track, long frame) const;
+
+	/**
+	 * @brief      Record the result of a verification.
+	 */
+	void store(int track_id, const std::string &name, float confidence,
+		   long frame);
+
+	/**
+	 * @brief      Identity of a track, counted as a cache hit.
+	 *
+	 * @return     nullptr if the track was never verified
+	 */
+	const Identity *find(int track_id);
+
+	size_t hits() const { return hits_; }
+	size_t verifications() const { return verifications_; }
+
+private:
+	IdentityCacheOptions options_;
+	std::map<int, Identity> identities_;
+	size_t hits_ = 0;
+	size_t verifications_ = 0;
+};
+
+#endif
@@ -0,0 +1,263 @@
+/**
+ *
+ * @brief      Local stand-in for the BrainyPi AI server, for benchmarks.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <random>
+#include <thread>
+
+#include <pistache/http.h>
+#include <pistache/net.h>
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include "api_result.hpp"
+#include "helper.hpp"
+#include "mock_server.hpp"
+
+typedef rapidjson::Writer<rapidjson::StringBuffer> JsonWriter;
+typedef std::map<std::string, std::string> ResponseMap;
+
+static void write_box(JsonWriter &w, float top, float left, float width,
+		      float height)
+{
+	w.Key("boundingBox");
+	w.StartObject();
+	w.Key("top");
+	w.Double(top);
+	w.Key("left");
+	w.Double(left);
+	w.Key("width");
+	w.Double(width);
+	w.Key("height");
+	w.Double(height);
+	w.EndObject();
+}
+
+static void write_faces(JsonWriter &w, int count, bool embeddings)
+{
+	static const char *landmarks[] = { "pupilLeft", "pupilRight",
+					   "noseTip", "mouthLeft",
+					   "mouthRight" };
+
+	w.Key("faces");
+	w.StartArray();
+	for (int i = 0; i < count; i++) {
+		w.StartObject();
+		w.Key("confidence");
+		w.Double(0.99);
+		write_box(w, 75.46, 59.01 + i * 120, 96.16, 141.24);
+		w.Key("landmarks");
+		w.StartArray();
+		for (auto type : landmarks) {
+			w.StartObject();
+			w.Key("type");
+			w.String(type);
+			w.Key("x");
+			w.Double(100.53 + i * 120);
+			w.Key("y");
+			w.Double(114.02);
+			w.EndObject();
+		}
+		w.EndArray();
+		if (embeddings) {
+			w.Key("embeddings");
+			w.StartArray();
+			for (int j = 0; j < FACE_EMBEDDING_DIM; j++) {
+				w.Double(((j * 7 + i * 13) % 15 - 7) / 100.0);
+			}
+			w.EndArray();
+		}
+		w.EndObject();
+	}
+	w.EndArray();
+}
+
+std::string mock_response(const std::string &endpoint,
+			  const MockServerOptions &options)
+{
+	rapidjson::StringBuffer buffer;
+	JsonWriter w(buffer);
+	w.SetMaxDecimalPlaces(2);
+
+	w.StartObject();
+	w.Key("apiVersion");
+	w.String("1.1.0");
+	w.Key("requestId");
+	w.Int(1687514443);
+	w.Key("result");
+	w.StartObject();
+	if (endpoint == API_DETECT_FACE) {
+		write_faces(w, options.faces, false);
+	} else if (endpoint == API_FACE_TO_EMBEDDING) {
+		write_faces(w, options.faces, true);
+	} else if (endpoint == API_DETECT_OBJECTS) {
+		w.Key("objects");
+		w.StartArray();
+		for (int i = 0; i < options.objects; i++) {
+			w.StartObject();
+			w.Key("object");
+			w.String("car");
+			w.Key("confidence");
+			w.Double(0.97);
+			write_box(w, 57.5, 18.81 + i * 60, 53.66, 47.86);
+			w.EndObject();
+		}
+		w.EndArray();
+	} else if (endpoint == API_ESTIMATE_POSE) {
+		w.Key("poses");
+		w.StartArray();
+		for (int i = 0; i < options.poses; i++) {
+			w.StartObject();
+			w.Key("points");
+			w.StartArray();
+			for (int j = 0; j < 17; j++) {
+				w.StartObject();
+				w.Key("x");
+				w.Double(120.0 + i * 200 + (j % 5) * 20);
+				w.Key("y");
+				w.Double(50.0 + j * 15);
+				w.Key("confidence");
+				w.Double(0.86);
+				w.EndObject();
+			}
+			w.EndArray();
+			w.EndObject();
+		}
+		w.EndArray();
+	} else if (endpoint == API_CLASSIFY_IMAGE) {
+		w.Key("classes");
+		w.StartArray();
+		for (int i = 0; i < options.classes; i++) {
+			w.StartObject();
+			w.Key("class");
+			w.String("tabby,tabby-cat");
+			w.Key("confidence");
+			w.Double(0.7 / (i + 1));
+			w.EndObject();
+		}
+		w.EndArray();
+	} else if (endpoint == API_COMPARE_FACE) {
+		w.Key("confidence");
+		w.Double(0.11);
+	} else {
+		return "";
+	}
+	w.EndObject();
+	w.EndObject();
+
+	return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+/**
+ * @brief      Request handler, cloned by Pistache for every thread.
+ */
+class MockHandler : public Pistache::Http::Handler {
+public:
+	HTTP_PROTOTYPE(MockHandler)
+
+	MockHandler(std::shared_ptr<const ResponseMap> responses,
+		    const MockServerOptions &options)
+		: responses_(responses), options_(options),
+		  active_(std::make_shared<std::atomic<int> >(0))
+	{
+	}
+
+	void onRequest(const Pistache::Http::Request &request,
+		       Pistache::Http::ResponseWriter response) override
+	{
+		using Pistache::Http::Code;
+
+		auto it = responses_->find(request.resource());
+		if (request.method() != Pistache::Http::Method::Post ||
+		    it == responses_->end()) {
+			response.send(Code::Not_Found);
+			return;
+		}
+		if (request.resource() != API_COMPARE_FACE &&
+		    (request.body().empty() ||
+		     request.body().size() > API_MAX_IMAGE_SIZE)) {
+			response.send(Code::Bad_Request);
+			return;
+		}
+
+		/* Shared by the clones of every thread */
+		if (options_.capacity > 0 &&
+		    ++*active_ > options_.capacity) {
+			--*active_;
+			response.send(Code::Too_Many_Requests);
+			return;
+		}
+
+		/* Stand-in for inference, blocks this handler thread */
+		int delay = options_.latency_ms;
+		if (options_.jitter_ms > 0) {
+			thread_local std::minstd_rand rng(std::random_device{}());
+			delay += rng() % (options_.jitter_ms + 1);
+		}
+		if (delay > 0) {
+			std::this_thread::sleep_for(
+				std::chrono::milliseconds(delay));
+		}
+		if (options_.capacity > 0) {
+			--*active_;
+		}
+		response.send(Code::Ok, it->second,
+			      MIME(Application, Json));
+	}
+
+private:
+	std::shared_ptr<const ResponseMap> responses_;
+	MockServerOptions options_;
+	std::shared_ptr<std::atomic<int> > active_;
+};
+
+MockServer::MockServer(const MockServerOptions &options) : options_(options)
+{
+}
+
+MockServer::~MockServer()
+{
+	stop();
+}
+
+void MockServer::start()
+{
+	auto responses = std::make_shared<ResponseMap>();
+	for (auto endpoint :
+	     { API_DETECT_FACE, API_DETECT_OBJECTS, API_ESTIMATE_POSE,
+	       API_CLASSIFY_IMAGE, API_FACE_TO_EMBEDDING, API_COMPARE_FACE }) {
+		(*responses)[endpoint] = mock_response(endpoint, options_);
+	}
+
+	Pistache::Address address(Pistache::Ipv4::loopback(),
+				  Pistache::Port(options_.port));
+	auto opts = Pistache::Http::Endpoint::options()
+			    .threads(options_.threads)
+			    .maxRequestSize(2 * API_MAX_IMAGE_SIZE);
+
+	endpoint_ = std::make_shared<Pistache::Http::Endpoint>(address);
+	endpoint_->init(opts);
+	endpoint_->setHandler(
+		std::make_shared<MockHandler>(responses, options_));
+	endpoint_->serveThreaded();
+}
+
+void MockServer::stop()
+{
+	if (endpoint_) {
+		endpoint_->shutdown();
+		endpoint_.reset();
+	}
+}
+
+std::string MockServer::url() const
+{
+	return "http://127.0.0.1:" + std::to_string(options_.port);
+}
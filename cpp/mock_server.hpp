@@ -0,0 +1,75 @@
+/**
+ *
+ * @brief      Local stand-in for the BrainyPi AI server, for benchmarks.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef MOCK_SERVER_HPP
+#define MOCK_SERVER_HPP
+
+#include <memory>
+#include <string>
+
+#include <pistache/endpoint.h>
+
+/**
+ * @brief      Behaviour of the mock server.
+ */
+struct MockServerOptions {
+	int port = 9901;
+	int threads = 8;	/* Handler threads, also the overlap limit */
+	int latency_ms = 20;	/* Synthetic inference time per request */
+	int jitter_ms = 0;	/* Uniform extra latency in [0, jitter_ms] */
+	int capacity = 0;	/* Concurrent requests before 429, 0 no limit */
+	int faces = 3;		/* Entries in face results */
+	int objects = 5;	/* Entries in /v1/detectobjects results */
+	int poses = 2;		/* Entries in /v1/estimatepose results */
+	int classes = 3;	/* Entries in /v1/classifyimage results */
+};
+
+/**
+ * @brief      Serves the six endpoints of openapi.yaml with canned results.
+ *
+ *             Responses follow the examples of openapi.yaml and are built
+ *             once at start-up, so the server costs little CPU next to the
+ *             client under test. Image bodies above API_MAX_IMAGE_SIZE are
+ *             rejected with 400 like the real server does. With a capacity
+ *             set, requests beyond it are answered 429 Too Many Requests
+ *             at once, like an overloaded server behind a rate limiter.
+ */
+class MockServer {
+public:
+	explicit MockServer(const MockServerOptions &options);
+	~MockServer();
+
+	MockServer(const MockServer &) = delete;
+	MockServer &operator=(const MockServer &) = delete;
+
+	/**
+	 * @brief      Start serving on background threads.
+	 */
+	void start();
+
+	void stop();
+
+	/* Base URL clients connect to */
+	std::string url() const;
+
+private:
+	MockServerOptions options_;
+	std::shared_ptr<Pistache::Http::Endpoint> endpoint_;
+};
+
+/**
+ * @brief      Canned response of an endpoint.
+ *
+ * @param[in]  endpoint  Endpoint path, e.g. API_DETECT_FACE
+ * @param[in]  options   Number of entries to put in the result
+ *
+ * @return     JSON body, empty for an unknown endpoint
+ */
+std::string mock_response(const std::string &endpoint,
+			  const MockServerOptions &options);
+
+#endif
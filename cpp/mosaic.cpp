@@ -0,0 +1,194 @@
+/**
+ *
+ * @brief      Detection on many small images packed into one request.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <algorithm>
+#include <future>
+#include <iostream>
+
+#include <opencv2/imgproc.hpp>
+
+#include "mosaic.hpp"
+
+MosaicBatcher::MosaicBatcher(const MosaicOptions &options) : options_(options)
+{
+	options_.max_grid = std::max(options_.max_grid, 1);
+	options_.cell = std::max(options_.cell, 2 * options_.gap + 1);
+	grid_ = std::max(options_.max_grid / 2, 1);
+}
+
+void MosaicBatcher::build(const std::vector<cv::Mat> &images, size_t first,
+			  size_t count, cv::Mat &mosaic,
+			  std::vector<Placement> &placements) const
+{
+	int cell = options_.cell;
+	int inner = cell - 2 * options_.gap;
+	int columns = std::min<int>(grid_, count);
+	int rows = (count + columns - 1) / columns;
+	cv::Mat colour;
+
+	mosaic.create(rows * cell, columns * cell, CV_8UC3);
+	mosaic.setTo(cv::Scalar(114, 114, 114));
+	placements.clear();
+
+	for (size_t k = 0; k < count; k++) {
+		const cv::Mat &image = images[first + k];
+		if (image.empty()) {
+			continue;
+		}
+		const cv::Mat *source = &image;
+		if (image.channels() != 3) {
+			cv::cvtColor(image, colour,
+				     image.channels() == 1 ? cv::COLOR_GRAY2BGR :
+							     cv::COLOR_BGRA2BGR);
+			source = &colour;
+		}
+
+		float scale = std::min((float)inner / image.cols,
+				       (float)inner / image.rows);
+		int width = std::max(1, (int)(image.cols * scale));
+		int height = std::max(1, (int)(image.rows * scale));
+		int x = (k % columns) * cell + (cell - width) / 2;
+		int y = (k / columns) * cell + (cell - height) / 2;
+
+		cv::Mat target = mosaic(cv::Rect(x, y, width, height));
+		cv::resize(*source, target, target.size(), 0, 0,
+			   scale < 1 ? cv::INTER_AREA : cv::INTER_LINEAR);
+		placements.push_back({ first + k,
+				       cv::Rect2f(x, y, width, height), scale });
+	}
+}
+
+/**
+ * @brief      Map a mosaic box into its input.
+ *
+ * @return     false if the box belongs to no input
+ */
+static bool route_box(BoundingBox &box, const cv::Rect2f &area, float scale,
+		      float straddle)
+{
+	cv::Rect2f rect(box.left, box.top, box.width, box.height);
+	cv::Rect2f inside = rect & area;
+
+	if (rect.area() <= 0 ||
+	    rect.area() - inside.area() > straddle * rect.area()) {
+		return false;
+	}
+	box.left = (inside.x - area.x) / scale;
+	box.top = (inside.y - area.y) / scale;
+	box.width = inside.width / scale;
+	box.height = inside.height / scale;
+	return true;
+}
+
+void MosaicBatcher::route(ApiResult &mosaic_result,
+			  const std::vector<Placement> &placements,
+			  std::vector<ApiResult> &results) const
+{
+	/* Cell holding the centre of a box */
+	auto owner = [&](const BoundingBox &box) -> const Placement * {
+		cv::Point2f centre(box.left + box.width / 2,
+				   box.top + box.height / 2);
+		for (auto &placement : placements) {
+			if (placement.area.contains(centre)) {
+				return &placement;
+			}
+		}
+		return nullptr;
+	};
+
+	for (auto &placement : placements) {
+		ApiResult &result = results[placement.input];
+		result.api_version = mosaic_result.api_version;
+		result.request_id = mosaic_result.request_id;
+	}
+	for (auto &object : mosaic_result.objects) {
+		const Placement *p = owner(object.box);
+		if (p && route_box(object.box, p->area, p->scale,
+				   options_.straddle)) {
+			results[p->input].objects.push_back(object);
+		}
+	}
+	for (auto &face : mosaic_result.faces) {
+		const Placement *p = owner(face.box);
+		if (!p || !route_box(face.box, p->area, p->scale,
+				     options_.straddle)) {
+			continue;
+		}
+		for (auto &landmark : face.landmarks) {
+			landmark.x = (landmark.x - p->area.x) / p->scale;
+			landmark.y = (landmark.y - p->area.y) / p->scale;
+		}
+		results[p->input].faces.push_back(face);
+	}
+}
+
+void MosaicBatcher::adapt(double ms)
+{
+	latency_ms_ = latency_ms_ == 0 ? ms : 0.8 * latency_ms_ + 0.2 * ms;
+	if (ms > options_.latency_budget_ms && grid_ > 1) {
+		grid_--;
+	} else if (latency_ms_ < 0.5 * options_.latency_budget_ms &&
+		   grid_ < options_.max_grid) {
+		grid_++;
+	}
+}
+
+void MosaicBatcher::detect(ApiSession &session, const std::string &endpoint,
+			   const std::vector<cv::Mat> &images,
+			   std::vector<ApiResult> &results)
+{
+	struct Request {
+		std::vector<Placement> placements;
+		double scale;
+		std::future<ApiResponse> response;
+	};
+	std::vector<Request> requests;
+	size_t per_mosaic = grid_ * grid_;
+	cv::Mat mosaic;
+
+	results.assign(images.size(), ApiResult());
+
+	/* Send every mosaic before waiting for the first */
+	for (size_t first = 0; first < images.size(); first += per_mosaic) {
+		Request request;
+		std::string jpeg;
+		build(images, first,
+		      std::min(per_mosaic, images.size() - first), mosaic,
+		      request.placements);
+		request.scale = encode_upload(mosaic, session.upload_options(),
+					      jpeg);
+
+		request.response = session.post(endpoint, std::move(jpeg));
+		requests.push_back(std::move(request));
+	}
+
+	ApiResult mosaic_result;
+	double total_ms = 0;
+	size_t answered = 0;
+	for (auto &request : requests) {
+		ApiResponse response = request.response.get();
+		if (response.code > 0) {
+			total_ms += response.latency_ms;
+			answered++;
+		}
+		if (!parse_api_result(response.body, mosaic_result) ||
+		    mosaic_result.has_error) {
+			std::cerr << "Warning: No result for a mosaic of "
+				  << request.placements.size() << " images"
+				  << std::endl;
+			continue;
+		}
+		mosaic_result.rescale(request.scale);
+		route(mosaic_result, request.placements, results);
+	}
+	/* Once per call: the mosaics of a call share the request window */
+	if (answered > 0) {
+		adapt(total_ms / answered);
+	}
+	images_ += images.size();
+	requests_ += requests.size();
+}
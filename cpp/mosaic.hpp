@@ -0,0 +1,95 @@
+/**
+ *
+ * @brief      Detection on many small images packed into one request.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef MOSAIC_HPP
+#define MOSAIC_HPP
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "api_result.hpp"
+#include "helper.hpp"
+
+/**
+ * @brief      Layout of a mosaic and its latency target.
+ */
+struct MosaicOptions {
+	int cell = 320;		   /* Side of one grid cell in pixels */
+	int gap = 8;		   /* Empty border inside each cell */
+	int max_grid = 4;	   /* At most max_grid x max_grid inputs */
+	int latency_budget_ms = 300; /* Target time of one mosaic request */
+	float straddle = 0.1f;	   /* Share of a box allowed outside its cell */
+};
+
+/**
+ * @brief      Packs inputs into grid images for /v1/detectobjects and
+ *             /v1/detectface.
+ *
+ *             The API takes one image per request, so for thumbnails or
+ *             crops the per-request cost dominates. Each input is scaled to
+ *             fit a cell of a grid x grid mosaic, leaving a gap so objects
+ *             of neighbouring cells do not touch, and the mosaics are sent
+ *             concurrently. Every returned box is routed to the cell
+ *             holding its centre and mapped back to the coordinates of its
+ *             input; boxes reaching over the border of their cell belong to
+ *             no input and are dropped.
+ *
+ *             The grid adapts once per detect() call to the average
+ *             latency of its mosaics, timed from when each was sent so
+ *             that waiting for a free request slot does not count: it
+ *             shrinks when a mosaic takes longer than latency_budget_ms
+ *             and grows while requests stay well within it.
+ *
+ *             Not thread safe.
+ */
+class MosaicBatcher {
+public:
+	explicit MosaicBatcher(const MosaicOptions &options = MosaicOptions());
+
+	/**
+	 * @brief      Detect on a list of images.
+	 *
+	 * @param      session   Connection to the API server
+	 * @param[in]  endpoint  API_DETECT_OBJECTS or API_DETECT_FACE
+	 * @param[in]  images    Inputs, any size
+	 * @param[out] results   One result per input in its coordinates
+	 */
+	void detect(ApiSession &session, const std::string &endpoint,
+		    const std::vector<cv::Mat> &images,
+		    std::vector<ApiResult> &results);
+
+	int grid() const { return grid_; }
+	size_t images() const { return images_; }
+	size_t requests() const { return requests_; }
+	double latency_ms() const { return latency_ms_; }
+
+private:
+	/* Where an input was drawn in a mosaic */
+	struct Placement {
+		size_t input;
+		cv::Rect2f area; /* Scaled input inside the mosaic */
+		float scale;	 /* Mosaic pixels per input pixel */
+	};
+
+	void build(const std::vector<cv::Mat> &images, size_t first,
+		   size_t count, cv::Mat &mosaic,
+		   std::vector<Placement> &placements) const;
+	void route(ApiResult &mosaic_result,
+		   const std::vector<Placement> &placements,
+		   std::vector<ApiResult> &results) const;
+	void adapt(double ms);
+
+	MosaicOptions options_;
+	int grid_;
+	double latency_ms_ = 0; /* EWMA of mosaic requests, per call */
+	size_t images_ = 0;
+	size_t requests_ = 0;
+};
+
+#endif
@@ -0,0 +1,51 @@
+/**
+ *
+ * @brief      Frame differencing gate that skips inference on static video.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <opencv2/imgproc.hpp>
+
+#include "motion_gate.hpp"
+
+MotionGate::Decision MotionGate::check(const cv::Mat &image, cv::Mat &small)
+{
+	double factor = (double)options_.width / image.cols;
+	cv::Mat grey;
+
+	/* INTER_AREA averages away most sensor noise on its own */
+	cv::resize(image, small, cv::Size(), factor, factor, cv::INTER_AREA);
+	if (small.channels() > 1) {
+		cv::cvtColor(small, grey, cv::COLOR_BGR2GRAY);
+	} else {
+		grey = small;
+	}
+	cv::GaussianBlur(grey, small, cv::Size(5, 5), 0);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (reference_.empty() || reference_.size() != small.size()) {
+		return Motion;
+	}
+
+	cv::absdiff(small, reference_, diff_);
+	cv::threshold(diff_, diff_, options_.pixel_threshold, 255,
+		      cv::THRESH_BINARY);
+	double changed = (double)cv::countNonZero(diff_) / diff_.total();
+
+	if (changed >= options_.min_changed) {
+		return Motion;
+	}
+	if (++skipped_ > options_.max_skip) {
+		return Refresh;
+	}
+	return Skip;
+}
+
+void MotionGate::sent(const cv::Mat &small)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	small.copyTo(reference_);
+	skipped_ = 0;
+}
@@ -0,0 +1,80 @@
+/**
+ *
+ * @brief      Frame differencing gate that skips inference on static video.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef MOTION_GATE_HPP
+#define MOTION_GATE_HPP
+
+#include <mutex>
+
+#include <opencv2/core.hpp>
+
+/**
+ * @brief      Tuning of the motion gate.
+ */
+struct MotionGateOptions {
+	bool enabled = true;
+	int width = 160;	    /* Width frames are compared at */
+	int pixel_threshold = 25;   /* Grey level change of a moving pixel */
+	double min_changed = 0.002; /* Moving pixel fraction that needs a result */
+	int max_skip = 30;	    /* Frames skipped before a forced refresh */
+};
+
+/**
+ * @brief      Decides which frames of a fixed camera need inference.
+ *
+ *             Every frame is shrunk to a small blurred grey image and
+ *             compared with the one of the last frame sent for inference.
+ *             Only when enough pixels changed is the frame worth a request;
+ *             otherwise the previous detections still describe it. Comparing
+ *             with the last sent frame rather than the previous one means
+ *             slow motion adds up until it triggers. After max_skip skipped
+ *             frames a refresh is forced, so objects that stopped moving or
+ *             left are eventually caught up with; those refreshes measure
+ *             how stale the reused detections were.
+ *
+ *             check() and sent() may be called from different threads.
+ */
+class MotionGate {
+public:
+	/**
+	 * @brief      Verdict on one frame.
+	 */
+	enum Decision {
+		Skip,	 /* Reuse the previous detections */
+		Motion,	 /* Enough of the frame changed */
+		Refresh, /* No motion but max_skip frames were skipped */
+	};
+
+	explicit MotionGate(const MotionGateOptions &options)
+		: options_(options)
+	{
+	}
+
+	/**
+	 * @brief      Compare a frame with the last one sent for inference.
+	 *
+	 * @param[in]  image  Full resolution frame
+	 * @param[out] small  Reduced frame, to pass to sent()
+	 *
+	 * @return     Whether the frame needs inference
+	 */
+	Decision check(const cv::Mat &image, cv::Mat &small);
+
+	/**
+	 * @brief      Record that a frame was sent, making it the reference.
+	 */
+	void sent(const cv::Mat &small);
+
+private:
+	MotionGateOptions options_;
+	std::mutex mutex_;
+	cv::Mat reference_;
+	int skipped_ = 0; /* Frames checked since the last sent() */
+	cv::Mat diff_;
+};
+
+#endif
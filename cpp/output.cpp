@@ -0,0 +1,265 @@
+/**
+ *
+ * @brief      Result images shown and saved off the processing threads.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "output.hpp"
+#include "trace.hpp"
+
+OutputWriter::OutputWriter(size_t threads, size_t capacity)
+	: queue_(std::max<size_t>(capacity, 1))
+{
+	threads = std::max<size_t>(threads, 1);
+	for (size_t i = 0; i < threads; i++) {
+		threads_.emplace_back(&OutputWriter::run, this);
+	}
+}
+
+OutputWriter::~OutputWriter()
+{
+	queue_.close();
+	for (auto &t : threads_) {
+		t.join();
+	}
+}
+
+bool OutputWriter::write(const cv::Mat &image, const std::string &path)
+{
+	return enqueue({ image, std::string(), path });
+}
+
+bool OutputWriter::write_text(std::string text, const std::string &path)
+{
+	return enqueue({ cv::Mat(), std::move(text), path });
+}
+
+bool OutputWriter::enqueue(Job job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		pending_++;
+	}
+	if (queue_.push(std::move(job))) {
+		return true;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (--pending_ == 0) {
+		idle_.notify_all();
+	}
+	return false;
+}
+
+void OutputWriter::flush()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	idle_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void OutputWriter::make_directory(const std::string &path)
+{
+	std::string dir = std::filesystem::path(path).parent_path().string();
+	std::error_code error;
+
+	if (dir.empty()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!directories_.insert(dir).second) {
+			return;
+		}
+	}
+	std::filesystem::create_directories(dir, error);
+	if (error) {
+		std::cerr << "Error: Cannot create " << dir << ": "
+			  << error.message() << std::endl;
+	}
+}
+
+void OutputWriter::run()
+{
+	Job job;
+
+	while (queue_.pop(job)) {
+		make_directory(job.path);
+		bool ok = false;
+		try {
+			TraceSpan span(TRACE_WRITE);
+			if (job.image.empty()) {
+				std::ofstream ofs(job.path, std::ios::trunc);
+				ofs << job.text;
+				ofs.close();
+				ok = !ofs.fail();
+			} else {
+				ok = cv::imwrite(job.path, job.image);
+			}
+		} catch (const cv::Exception &e) {
+			std::cerr << e.what() << std::endl;
+		}
+		if (ok) {
+			written_++;
+		} else {
+			std::cerr << "Error: Cannot write " << job.path
+				  << std::endl;
+			failed_++;
+		}
+		job.image.release();
+		job.text.clear();
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (--pending_ == 0) {
+			idle_.notify_all();
+		}
+	}
+}
+
+PreviewWindow::PreviewWindow(const std::string &title, int max_fps)
+	: title_(title),
+	  interval_(std::chrono::duration_cast<Clock::duration>(
+		  std::chrono::duration<double>(1.0 / std::max(max_fps, 1))))
+{
+}
+
+PreviewWindow::~PreviewWindow()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	wake_.notify_one();
+	if (thread_.joinable()) {
+		thread_.join();
+	}
+}
+
+void PreviewWindow::show(const cv::Mat &image)
+{
+	auto now = Clock::now();
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	if (stop_ || image.empty() || now < next_) {
+		skipped_++;
+		return;
+	}
+	next_ = now + interval_;
+	image.copyTo(pending_);
+	fresh_ = true;
+	if (!thread_.joinable()) {
+		thread_ = std::thread(&PreviewWindow::run, this);
+	}
+	lock.unlock();
+	wake_.notify_one();
+}
+
+void PreviewWindow::hold()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	if (!thread_.joinable() || closed_) {
+		return;
+	}
+	std::cout << "Press any key to continue..." << std::endl;
+	hold_ = true;
+	wake_.notify_one();
+	held_.wait(lock, [this] { return !hold_; });
+}
+
+void PreviewWindow::run()
+{
+	cv::Mat frame;
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	while (!stop_) {
+		if (fresh_) {
+			cv::swap(frame, pending_);
+			fresh_ = false;
+			lock.unlock();
+			cv::imshow(title_, frame);
+			shown_++;
+		} else {
+			lock.unlock();
+		}
+
+		/* Let HighGUI handle its events between frames */
+		int key = cv::waitKey(1);
+		if (key == 27) {
+			closed_ = true;
+		}
+
+		lock.lock();
+		if (hold_ && !fresh_) {
+			lock.unlock();
+			if (!closed_) {
+				cv::waitKey(0);
+			}
+			lock.lock();
+			hold_ = false;
+			held_.notify_all();
+		}
+		wake_.wait_for(lock, interval_,
+			       [this] { return stop_ || fresh_ || hold_; });
+	}
+	lock.unlock();
+	cv::destroyWindow(title_);
+}
+
+bool display_enabled()
+{
+	const char *env = std::getenv("BRAINYPI_DISPLAY");
+	return env && *env && std::string(env) != "0";
+}
+
+OutputWriter &output_writer()
+{
+	static OutputWriter writer;
+	return writer;
+}
+
+PreviewWindow &preview_window()
+{
+	static PreviewWindow window;
+	return window;
+}
+
+void display_output_image(cv::Mat &image)
+{
+	preview_window().show(image);
+}
+
+void save_to_disk(cv::Mat &image, const std::string image_path,
+		  const std::string output_dir)
+{
+	// Save the output image
+	std::string output_image =
+		output_dir + "/result_" +
+		image_path.substr(image_path.find_last_of("/") + 1);
+	output_writer().write(image, output_image);
+}
+
+void finish_outputs(bool hold)
+{
+	OutputWriter &writer = output_writer();
+
+	writer.flush();
+	if (writer.written() || writer.failed()) {
+		std::cout << "Saved " << writer.written() << " result files";
+		if (writer.failed()) {
+			std::cout << ", " << writer.failed() << " failed";
+		}
+		std::cout << std::endl;
+	}
+	if (hold) {
+		preview_window().hold();
+	}
+}
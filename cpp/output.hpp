@@ -0,0 +1,215 @@
+/**
+ *
+ * @brief      Result images shown and saved off the processing threads.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "bounded_queue.hpp"
+
+/* Writer threads and queued images of the process wide writer */
+#define OUTPUT_WRITER_THREADS 2
+#define OUTPUT_WRITER_QUEUE 16
+
+/* Refresh rate of the preview window */
+#define PREVIEW_MAX_FPS 15
+
+/**
+ * @brief      Encodes and writes images on a pool of threads.
+ *
+ *             write() only queues the image, so the caller goes on with
+ *             the next request while the image is encoded and written.
+ *             The queue is bounded: when the disk cannot keep up write()
+ *             waits for a free slot instead of buffering without limit.
+ *             Output directories are created by the writer threads the
+ *             first time they are used. Text results such as JSON files
+ *             go through the same threads with write_text().
+ *
+ *             Thread safe.
+ */
+class OutputWriter {
+public:
+	explicit OutputWriter(size_t threads = OUTPUT_WRITER_THREADS,
+			      size_t capacity = OUTPUT_WRITER_QUEUE);
+	~OutputWriter();
+
+	OutputWriter(const OutputWriter &) = delete;
+	OutputWriter &operator=(const OutputWriter &) = delete;
+
+	/**
+	 * @brief      Queue an image to be written.
+	 *
+	 *             The pixels are shared, not copied: the caller must not
+	 *             draw on the image afterwards.
+	 *
+	 * @param[in]  image  The image
+	 * @param[in]  path   Output file, the extension selects the format
+	 *
+	 * @return     false if the writer is shutting down
+	 */
+	bool write(const cv::Mat &image, const std::string &path);
+
+	/**
+	 * @brief      Queue a text file, e.g. a JSON result, to be written.
+	 *
+	 * @return     false if the writer is shutting down
+	 */
+	bool write_text(std::string text, const std::string &path);
+
+	/**
+	 * @brief      Wait until every queued image is on disk.
+	 */
+	void flush();
+
+	size_t written() const { return written_; }
+	size_t failed() const { return failed_; }
+
+private:
+	struct Job {
+		cv::Mat image;
+		std::string text; /* Written instead if image is empty */
+		std::string path;
+	};
+
+	bool enqueue(Job job);
+	void run();
+	void make_directory(const std::string &path);
+
+	BoundedQueue<Job> queue_;
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable idle_;
+	size_t pending_ = 0;
+	std::set<std::string> directories_;
+	std::atomic<size_t> written_{ 0 };
+	std::atomic<size_t> failed_{ 0 };
+};
+
+/**
+ * @brief      Window showing the latest result on its own thread.
+ *
+ *             show() hands over a frame and returns; the render thread
+ *             draws at most max_fps frames a second and keeps the window
+ *             responsive in between. Frames arriving faster than that are
+ *             skipped without being copied, so processing is never slowed
+ *             down by the display.
+ *
+ *             All HighGUI calls are made on the render thread, which is
+ *             started by the first show().
+ *
+ *             Thread safe.
+ */
+class PreviewWindow {
+public:
+	explicit PreviewWindow(const std::string &title = "Result Image",
+			       int max_fps = PREVIEW_MAX_FPS);
+	~PreviewWindow();
+
+	PreviewWindow(const PreviewWindow &) = delete;
+	PreviewWindow &operator=(const PreviewWindow &) = delete;
+
+	/**
+	 * @brief      Offer a frame for display.
+	 *
+	 *             The frame is copied if it is going to be shown, so the
+	 *             caller may reuse it.
+	 */
+	void show(const cv::Mat &image);
+
+	/**
+	 * @brief      Keep the last frame on screen until a key is pressed.
+	 *
+	 *             Returns at once if nothing was shown.
+	 */
+	void hold();
+
+	/**
+	 * @brief      Whether Esc was pressed in the window.
+	 */
+	bool closed() const { return closed_; }
+
+	size_t shown() const { return shown_; }
+	size_t skipped() const { return skipped_; }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	void run();
+
+	std::string title_;
+	Clock::duration interval_;
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable held_;
+	Clock::time_point next_ = Clock::time_point::min();
+	cv::Mat pending_;
+	bool fresh_ = false;
+	bool hold_ = false;
+	bool stop_ = false;
+	std::atomic<bool> closed_{ false };
+	std::atomic<size_t> shown_{ 0 };
+	std::atomic<size_t> skipped_{ 0 };
+};
+
+/**
+ * @brief      Whether results are shown in a window.
+ *
+ *             The examples run headless unless BRAINYPI_DISPLAY is set to
+ *             a value other than 0.
+ */
+bool display_enabled();
+
+/**
+ * @brief      Writer shared by the whole process, created on first use.
+ */
+OutputWriter &output_writer();
+
+/**
+ * @brief      Preview window shared by the whole process, created on first
+ *             use.
+ */
+PreviewWindow &preview_window();
+
+/**
+ * @brief      Show a result image in the preview window without waiting.
+ *
+ * @param      image  The image
+ */
+void display_output_image(cv::Mat &image);
+
+/**
+ * @brief      Queue a result image to be saved as output_dir/result_<name>.
+ *
+ *             The image is written in the background by output_writer()
+ *             and must not be modified afterwards.
+ *
+ * @param      image       The image
+ * @param[in]  image_path  The input image path
+ * @param[in]  output_dir  The output dir
+ */
+void save_to_disk(cv::Mat &image, const std::string image_path,
+		  const std::string output_dir);
+
+/**
+ * @brief      Wait for the queued outputs before the process exits.
+ *
+ * @param[in]  hold  Keep the preview on screen until a key is pressed
+ */
+void finish_outputs(bool hold);
+
+#endif
@@ -0,0 +1,160 @@
+/**
+ * @brief      Faces registered while verification runs are found, also when
+ *             the face store did not exist at startup.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "face_gallery.hpp"
+#include "face_store.hpp"
+
+#define TEST_DIM 128
+#define TEST_WAIT_MS 5000
+
+static std::vector<float> test_embedding(int seed)
+{
+	std::vector<float> v(TEST_DIM);
+
+	for (int i = 0; i < TEST_DIM; i++) {
+		v[i] = (float)((i * 31 + seed * 17) % 23) - 11;
+	}
+	return v;
+}
+
+/**
+ * @brief      Wait for the gallery to hold count faces.
+ */
+static bool wait_for_size(const FaceGallery &gallery, size_t count)
+{
+	auto deadline = std::chrono::steady_clock::now() +
+			std::chrono::milliseconds(TEST_WAIT_MS);
+
+	while (gallery.snapshot()->size() != count) {
+		if (std::chrono::steady_clock::now() > deadline) {
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return true;
+}
+
+/**
+ * @brief      Whether the best match of an embedding has the given name.
+ */
+static bool finds(const FaceGallery &gallery, const std::vector<float> &face,
+		  const std::string &name)
+{
+	std::shared_ptr<const GallerySnapshot> snapshot = gallery.snapshot();
+	std::vector<FaceMatch> matches = snapshot->search(face.data(), 1);
+
+	return !matches.empty() && snapshot->name(matches[0].id) == name;
+}
+
+/**
+ * @brief      Register a face in a store that is created for it.
+ */
+static bool register_face(const std::string &base, const std::string &name,
+			  const std::vector<float> &face)
+{
+	FaceStore store;
+
+	return store.open(base, TEST_DIM) &&
+	       store.append(name, face.data(), face.size()) && store.flush();
+}
+
+/**
+ * @brief      No store and no JSON gallery at startup.
+ */
+static bool test_store_created_later(const std::string &dir)
+{
+	std::string base = dir + "/" + FACE_STORE;
+	FaceGalleryOptions options;
+	options.poll_ms = 50;
+	FaceGallery gallery(options);
+	std::vector<float> alice = test_embedding(1);
+
+	if (gallery.open(base) || gallery.snapshot()->size() != 0) {
+		std::cerr << "Error: Empty gallery expected" << std::endl;
+		return false;
+	}
+	if (!register_face(base, "alice", alice)) {
+		std::cerr << "Error: Cannot write " << base << std::endl;
+		return false;
+	}
+	if (!wait_for_size(gallery, 1) || !finds(gallery, alice, "alice")) {
+		std::cerr << "Error: Registered face not found" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief      Only a JSON gallery at startup, the store follows.
+ */
+static bool test_store_after_json(const std::string &dir)
+{
+	std::string base = dir + "/" + FACE_STORE;
+	std::string json = dir + "/face_embeddings.json";
+	FaceGalleryOptions options;
+	options.poll_ms = 50;
+	FaceGallery gallery(options);
+	std::vector<float> alice = test_embedding(1);
+	std::vector<float> bob = test_embedding(2);
+
+	std::ofstream ofs(json);
+	ofs << "[{\"name\":\"bob\",\"embeddings\":[";
+	for (size_t i = 0; i < bob.size(); i++) {
+		ofs << (i ? "," : "") << bob[i];
+	}
+	ofs << "]}]" << std::endl;
+	ofs.close();
+
+	if (gallery.open(base) || !gallery.open_json(json) ||
+	    gallery.snapshot()->size() != 1) {
+		std::cerr << "Error: JSON gallery not loaded" << std::endl;
+		return false;
+	}
+	if (!register_face(base, "alice", alice)) {
+		std::cerr << "Error: Cannot write " << base << std::endl;
+		return false;
+	}
+	if (!wait_for_size(gallery, 2) || !finds(gallery, alice, "alice") ||
+	    !finds(gallery, bob, "bob")) {
+		std::cerr << "Error: Registered face not found next to the "
+			  << "JSON gallery" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main()
+{
+	std::filesystem::path root = std::filesystem::temp_directory_path() /
+				     ("test_face_gallery_" +
+				      std::to_string(::getpid()));
+	bool ok = true;
+
+	for (int i = 0; i < 2; i++) {
+		std::filesystem::path dir = root / std::to_string(i);
+		std::filesystem::create_directories(dir);
+		bool passed = i == 0 ? test_store_created_later(dir.string()) :
+				       test_store_after_json(dir.string());
+		std::cout << (i == 0 ? "store created later" :
+				       "store after JSON gallery")
+			  << ": " << (passed ? "ok" : "FAILED") << std::endl;
+		ok &= passed;
+	}
+	std::filesystem::remove_all(root);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+/**
+ *
+ * @brief      Detection on large images in overlapping tiles.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+#include <numeric>
+
+#include "tiling.hpp"
+
+/* Bytes read for the size of a JPEG, enough to skip an EXIF segment */
+#define JPEG_HEADER_BYTES (80 * 1024)
+
+/**
+ * @brief      Start positions of tiles along one axis.
+ */
+static std::vector<int> tile_starts(int length, int tile, float overlap)
+{
+	std::vector<int> starts;
+	int step = std::max(1, (int)(tile * (1 - overlap)));
+
+	if (length <= tile) {
+		return { 0 };
+	}
+	for (int pos = 0; pos + tile < length; pos += step) {
+		starts.push_back(pos);
+	}
+	starts.push_back(length - tile);
+	return starts;
+}
+
+std::vector<cv::Rect> make_tiles(cv::Size image, const TileOptions &options)
+{
+	std::vector<cv::Rect> tiles;
+	int tile = std::max(options.tile, 1);
+
+	for (int y : tile_starts(image.height, tile, options.overlap)) {
+		for (int x : tile_starts(image.width, tile, options.overlap)) {
+			tiles.emplace_back(x, y, std::min(tile, image.width),
+					   std::min(tile, image.height));
+		}
+	}
+	return tiles;
+}
+
+bool load_for_tiling(const std::string &image_path,
+		     const TileOptions &options, cv::Mat &image)
+{
+	std::ifstream ifs(image_path, std::ios::binary);
+	std::string header(JPEG_HEADER_BYTES, '\0');
+	int width, height;
+
+	ifs.read(&header[0], header.size());
+	header.resize(ifs.gcount());
+	if (jpeg_info(header, width, height) &&
+	    std::max(width, height) <= options.min_side) {
+		/* Small JPEG, no need to decode it here */
+		image.release();
+		return false;
+	}
+
+	/* Decoded once, small images are then sent and drawn from it */
+	image = read_image(image_path);
+	return !image.empty() &&
+	       std::max(image.cols, image.rows) > options.min_side;
+}
+
+std::vector<size_t> non_max_suppression(const std::vector<BoundingBox> &boxes,
+					const std::vector<float> &scores,
+					float iou_threshold, float containment)
+{
+	size_t n = boxes.size();
+	std::vector<size_t> order(n), keep;
+
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(),
+			 [&](size_t a, size_t b) {
+				 return scores[a] > scores[b];
+			 });
+
+	/* Structure of arrays in score order */
+	std::vector<float> x1(n), y1(n), x2(n), y2(n), area(n);
+	std::vector<unsigned char> suppressed(n, 0);
+	for (size_t i = 0; i < n; i++) {
+		const BoundingBox &box = boxes[order[i]];
+		x1[i] = box.left;
+		y1[i] = box.top;
+		x2[i] = box.left + box.width;
+		y2[i] = box.top + box.height;
+		area[i] = std::max(box.width, 0.0f) *
+			  std::max(box.height, 0.0f);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if (suppressed[i]) {
+			continue;
+		}
+		keep.push_back(order[i]);
+
+		const float ax1 = x1[i], ay1 = y1[i], ax2 = x2[i], ay2 = y2[i];
+		const float aa = area[i];
+		for (size_t j = i + 1; j < n; j++) {
+			float w = std::max(0.0f, std::min(ax2, x2[j]) -
+							 std::max(ax1, x1[j]));
+			float h = std::max(0.0f, std::min(ay2, y2[j]) -
+							 std::max(ay1, y1[j]));
+			float inter = w * h;
+			float uni = aa + area[j] - inter;
+			float smaller = std::min(aa, area[j]);
+			suppressed[j] |= (inter > iou_threshold * uni) |
+					 (inter > containment * smaller);
+		}
+	}
+	return keep;
+}
+
+/**
+ * @brief      Merge duplicates of the same label across tiles.
+ */
+static void merge_objects(std::vector<DetectedObject> &objects,
+			  const TileOptions &options)
+{
+	std::map<std::string, std::vector<size_t> > by_label;
+	std::vector<DetectedObject> merged;
+	std::vector<BoundingBox> boxes;
+	std::vector<float> scores;
+
+	for (size_t i = 0; i < objects.size(); i++) {
+		by_label[objects[i].object].push_back(i);
+	}
+	for (auto &label : by_label) {
+		boxes.clear();
+		scores.clear();
+		for (size_t i : label.second) {
+			boxes.push_back(objects[i].box);
+			scores.push_back(objects[i].confidence);
+		}
+		for (size_t k : non_max_suppression(boxes, scores,
+						    options.nms_iou,
+						    options.containment)) {
+			merged.push_back(objects[label.second[k]]);
+		}
+	}
+	objects.swap(merged);
+}
+
+static void merge_faces(std::vector<Face> &faces, const TileOptions &options)
+{
+	std::vector<Face> merged;
+	std::vector<BoundingBox> boxes;
+	std::vector<float> scores;
+
+	for (auto &face : faces) {
+		boxes.push_back(face.box);
+		scores.push_back(face.confidence);
+	}
+	for (size_t k : non_max_suppression(boxes, scores, options.nms_iou,
+					    options.containment)) {
+		merged.push_back(faces[k]);
+	}
+	faces.swap(merged);
+}
+
+static void offset_result(ApiResult &result, float x, float y)
+{
+	for (auto &object : result.objects) {
+		object.box.left += x;
+		object.box.top += y;
+	}
+	for (auto &face : result.faces) {
+		face.box.left += x;
+		face.box.top += y;
+		for (auto &landmark : face.landmarks) {
+			landmark.x += x;
+			landmark.y += y;
+		}
+	}
+}
+
+bool detect_tiled(ApiSession &session, const std::string &endpoint,
+		  const cv::Mat &image, const TileOptions &options,
+		  ApiResult &result)
+{
+	bool faces = endpoint == API_DETECT_FACE;
+	std::vector<cv::Rect> tiles = make_tiles(image.size(), options);
+	std::vector<std::future<ApiResponse> > responses;
+	std::vector<double> scales;
+
+	if (options.full_image && tiles.size() > 1) {
+		/* Large objects that no tile holds entirely */
+		tiles.emplace_back(0, 0, image.cols, image.rows);
+	}
+	scales.resize(tiles.size(), 1.0);
+	for (size_t i = 0; i < tiles.size(); i++) {
+		cv::Mat tile = image(tiles[i]);
+		responses.push_back(faces ?
+					    session.detect_face(tile, &scales[i]) :
+					    session.detect_objects(tile,
+								   &scales[i]));
+	}
+
+	ApiResult tile_result;
+	size_t answered = 0;
+	result.clear();
+	for (size_t i = 0; i < tiles.size(); i++) {
+		std::string body = responses[i].get().body;
+		if (!parse_api_result(body, tile_result) ||
+		    tile_result.has_error) {
+			std::cerr << "Warning: No result for tile " << i
+				  << std::endl;
+			continue;
+		}
+		tile_result.rescale(scales[i]);
+		offset_result(tile_result, tiles[i].x, tiles[i].y);
+		result.merge(tile_result);
+		answered++;
+	}
+
+	if (faces) {
+		merge_faces(result.faces, options);
+	} else {
+		merge_objects(result.objects, options);
+	}
+	return answered > 0;
+}
@@ -0,0 +1,91 @@
+/**
+ *
+ * @brief      Detection on large images in overlapping tiles.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef TILING_HPP
+#define TILING_HPP
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "api_result.hpp"
+#include "helper.hpp"
+
+/**
+ * @brief      How an image is cut and the tile results merged.
+ */
+struct TileOptions {
+	int tile = 1280;	 /* Tile side in image pixels */
+	float overlap = 0.2f;	 /* Fraction shared by neighbouring tiles */
+	int min_side = 1920;	 /* Smaller images are not tiled */
+	bool full_image = true;	 /* Also detect on the whole, downscaled */
+	float nms_iou = 0.5f;	 /* Overlap that makes two boxes one */
+	float containment = 0.8f; /* Share of the smaller box inside the
+				    * other that makes them one, for objects
+				    * cut by a tile edge */
+};
+
+/**
+ * @brief      Tiles covering an image.
+ *
+ *             Tiles are tile x tile pixels (less if the image is
+ *             smaller) and overlap by at least overlap x tile, the last
+ *             row and column are aligned with the image border.
+ */
+std::vector<cv::Rect> make_tiles(cv::Size image, const TileOptions &options);
+
+/**
+ * @brief      Decode an image file if it is large enough to be tiled.
+ *
+ *             The size of a JPEG is read from the first bytes of the file,
+ *             so small JPEGs are not decoded. Other images are decoded to
+ *             learn their size, and are then left in image even if they
+ *             are small, so the caller sends and draws that decoded image
+ *             instead of reading the file again.
+ *
+ * @return     true with image set if its longer side exceeds min_side
+ */
+bool load_for_tiling(const std::string &image_path,
+		     const TileOptions &options, cv::Mat &image);
+
+/**
+ * @brief      Run /v1/detectobjects or /v1/detectface on every tile.
+ *
+ *             All tiles are submitted before the first answer is waited
+ *             for, so they run as parallel as the session allows. Boxes are
+ *             mapped back to image coordinates and duplicates from the
+ *             overlaps merged with non_max_suppression(), per label.
+ *
+ * @param      session   Connection to the API server
+ * @param[in]  endpoint  API_DETECT_OBJECTS or API_DETECT_FACE
+ * @param[in]  image     Full resolution image
+ * @param[in]  options   Tiling
+ * @param[out] result    Merged result in image coordinates
+ *
+ * @return     false if no tile got a result
+ */
+bool detect_tiled(ApiSession &session, const std::string &endpoint,
+		  const cv::Mat &image, const TileOptions &options,
+		  ApiResult &result);
+
+/**
+ * @brief      Keep the best of each group of overlapping boxes.
+ *
+ *             Boxes are visited by decreasing score; a box is dropped if
+ *             it overlaps a kept one by more than iou_threshold, or if more
+ *             than containment of the smaller of the two lies inside the
+ *             other. The inner loop works on separate coordinate arrays
+ *             without branches so the compiler can vectorise it.
+ *
+ * @return     Indices of the kept boxes, best first
+ */
+std::vector<size_t> non_max_suppression(const std::vector<BoundingBox> &boxes,
+					const std::vector<float> &scores,
+					float iou_threshold, float containment);
+
+#endif
@@ -0,0 +1,306 @@
+/**
+ *
+ * @brief      Time spent in each stage of the request pipeline.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "trace.hpp"
+
+/* Upper bounds of the histogram buckets, in seconds */
+static const double bucket_bounds[] = { 0.00005, 0.0001, 0.00025, 0.0005,
+					0.001,	 0.0025, 0.005,	  0.01,
+					0.025,	 0.05,	 0.1,	  0.25,
+					0.5,	 1,	 2.5,	  5 };
+
+#define TRACE_BUCKETS (sizeof(bucket_bounds) / sizeof(bucket_bounds[0]))
+
+static const char *stage_names[TRACE_STAGES] = {
+	"decode", "encode", "queue", "network",
+	"parse",  "search", "draw",  "write"
+};
+
+/**
+ * @brief      Spans and histograms of one thread.
+ *
+ *             Only the owning thread writes, so plain loads and stores of
+ *             the atomics are enough; they only keep the exporter from
+ *             reading torn values. A buffer outlives its thread and is
+ *             handed to the next new thread, keeping the counts.
+ */
+struct TraceBuffer {
+	struct Event {
+		std::atomic<uint64_t> start; /* ns */
+		std::atomic<uint64_t> info;  /* Duration in ns << 8 | stage */
+	};
+
+	Event events[TRACE_RING_SIZE];
+	std::atomic<uint64_t> head{ 0 }; /* Spans started */
+	std::atomic<uint64_t> done{ 0 }; /* Spans completely written */
+	std::atomic<uint64_t> counts[TRACE_STAGES][TRACE_BUCKETS + 1];
+	std::atomic<uint64_t> sum_ns[TRACE_STAGES];
+	std::atomic<long> tid{ 0 };
+	bool in_use = false; /* Under the registry lock */
+
+	TraceBuffer()
+	{
+		for (auto &stage : counts) {
+			for (auto &count : stage) {
+				count.store(0, std::memory_order_relaxed);
+			}
+		}
+		for (auto &sum : sum_ns) {
+			sum.store(0, std::memory_order_relaxed);
+		}
+	}
+};
+
+/* Bucket bounds in ns, compared with the durations as integers */
+static uint64_t bucket_ns[TRACE_BUCKETS];
+
+static void export_at_exit();
+
+/**
+ * @brief      Buffers of all threads. Never freed, so spans can be exported
+ *             from anywhere until the process ends.
+ */
+struct TraceRegistry {
+	std::mutex mutex;
+	std::vector<TraceBuffer *> buffers;
+	std::string export_path; /* BRAINYPI_TRACE */
+
+	TraceRegistry()
+	{
+		for (size_t i = 0; i < TRACE_BUCKETS; i++) {
+			bucket_ns[i] = (uint64_t)(bucket_bounds[i] * 1e9);
+		}
+		const char *env = std::getenv("BRAINYPI_TRACE");
+		if (env && *env) {
+			export_path = env;
+			std::atexit(export_at_exit);
+		}
+	}
+};
+
+static TraceRegistry &registry()
+{
+	static TraceRegistry *instance = new TraceRegistry();
+	return *instance;
+}
+
+/**
+ * @brief      Buffer of the calling thread, returned to the registry when
+ *             the thread ends.
+ */
+struct ThreadTrace {
+	TraceBuffer *buffer = nullptr;
+
+	TraceBuffer *get()
+	{
+		if (buffer) {
+			return buffer;
+		}
+		TraceRegistry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		for (auto b : r.buffers) {
+			if (!b->in_use) {
+				buffer = b;
+				break;
+			}
+		}
+		if (!buffer) {
+			buffer = new TraceBuffer();
+			r.buffers.push_back(buffer);
+		}
+		buffer->in_use = true;
+		buffer->tid.store(syscall(SYS_gettid),
+				  std::memory_order_relaxed);
+		return buffer;
+	}
+
+	~ThreadTrace()
+	{
+		if (buffer) {
+			std::lock_guard<std::mutex> lock(registry().mutex);
+			buffer->in_use = false;
+		}
+	}
+};
+
+static thread_local ThreadTrace thread_trace;
+
+uint64_t trace_clock()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		       std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+static void bump(std::atomic<uint64_t> &value, uint64_t by)
+{
+	value.store(value.load(std::memory_order_relaxed) + by,
+		    std::memory_order_relaxed);
+}
+
+void trace_record(TraceStage stage, uint64_t start_ns, uint64_t end_ns)
+{
+	TraceBuffer *b = thread_trace.get();
+	uint64_t duration = end_ns > start_ns ? end_ns - start_ns : 0;
+	size_t bucket = 0;
+
+	while (bucket < TRACE_BUCKETS && duration > bucket_ns[bucket]) {
+		bucket++;
+	}
+	bump(b->counts[stage][bucket], 1);
+	bump(b->sum_ns[stage], duration);
+
+	/* head claims a slot before it is rewritten, done publishes it */
+	uint64_t head = b->head.load(std::memory_order_relaxed);
+	TraceBuffer::Event &e = b->events[head % TRACE_RING_SIZE];
+	b->head.store(head + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	e.start.store(start_ns, std::memory_order_relaxed);
+	e.info.store(duration << 8 | stage, std::memory_order_relaxed);
+	b->done.store(head + 1, std::memory_order_release);
+}
+
+/**
+ * @brief      Copy the buffers without stopping their threads.
+ */
+static std::vector<TraceBuffer *> snapshot_buffers()
+{
+	TraceRegistry &r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	return r.buffers;
+}
+
+bool write_chrome_trace(const std::string &path)
+{
+	std::ofstream ofs(path, std::ios::trunc);
+	const char *separator = "";
+	char line[192];
+
+	ofs << "{\"traceEvents\":[";
+	for (auto b : snapshot_buffers()) {
+		struct Span {
+			uint64_t index, start, info;
+		};
+		std::vector<Span> spans;
+		uint64_t done = b->done.load(std::memory_order_acquire);
+		uint64_t first = done > TRACE_RING_SIZE ?
+					 done - TRACE_RING_SIZE :
+					 0;
+		for (uint64_t i = first; i < done; i++) {
+			TraceBuffer::Event &e = b->events[i % TRACE_RING_SIZE];
+			spans.push_back({ i,
+					  e.start.load(std::memory_order_relaxed),
+					  e.info.load(std::memory_order_relaxed) });
+		}
+
+		/* Drop the slots the thread may have been rewriting meanwhile */
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t head = b->head.load(std::memory_order_relaxed);
+		long tid = b->tid.load(std::memory_order_relaxed);
+		for (auto &s : spans) {
+			if (s.index + TRACE_RING_SIZE < head) {
+				continue;
+			}
+			std::snprintf(line, sizeof(line),
+				      "%s\n{\"name\":\"%s\",\"cat\":\"pipeline\","
+				      "\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+				      "\"pid\":%d,\"tid\":%ld}",
+				      separator, stage_names[s.info & 0xff],
+				      s.start / 1e3, (s.info >> 8) / 1e3,
+				      (int)getpid(), tid);
+			ofs << line;
+			separator = ",";
+		}
+	}
+	ofs << "\n]}\n";
+	ofs.close();
+	if (!ofs) {
+		std::cerr << "Error: Cannot write " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+std::string prometheus_metrics()
+{
+	uint64_t counts[TRACE_STAGES][TRACE_BUCKETS + 1] = {};
+	uint64_t sums[TRACE_STAGES] = {};
+	std::ostringstream out;
+
+	for (auto b : snapshot_buffers()) {
+		for (int s = 0; s < TRACE_STAGES; s++) {
+			for (size_t i = 0; i <= TRACE_BUCKETS; i++) {
+				counts[s][i] += b->counts[s][i].load(
+					std::memory_order_relaxed);
+			}
+			sums[s] += b->sum_ns[s].load(std::memory_order_relaxed);
+		}
+	}
+
+	out << "# HELP brainypi_stage_seconds Time spent in each stage of "
+	       "the request pipeline.\n"
+	    << "# TYPE brainypi_stage_seconds histogram\n";
+	for (int s = 0; s < TRACE_STAGES; s++) {
+		uint64_t total = 0;
+		for (size_t i = 0; i <= TRACE_BUCKETS; i++) {
+			total += counts[s][i];
+			out << "brainypi_stage_seconds_bucket{stage=\""
+			    << stage_names[s] << "\",le=\"";
+			if (i < TRACE_BUCKETS) {
+				out << bucket_bounds[i];
+			} else {
+				out << "+Inf";
+			}
+			out << "\"} " << total << "\n";
+		}
+		out << "brainypi_stage_seconds_sum{stage=\"" << stage_names[s]
+		    << "\"} " << sums[s] / 1e9 << "\n"
+		    << "brainypi_stage_seconds_count{stage=\""
+		    << stage_names[s] << "\"} " << total << "\n";
+	}
+	return out.str();
+}
+
+bool write_prometheus_metrics(const std::string &path)
+{
+	std::string tmp = path + ".tmp";
+	std::ofstream ofs(tmp, std::ios::trunc);
+
+	ofs << prometheus_metrics();
+	ofs.close();
+	if (!ofs) {
+		std::cerr << "Error: Cannot write " << tmp << std::endl;
+		std::remove(tmp.c_str());
+		return false;
+	}
+	/* Atomic, a collector never reads half a file */
+	return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+static void export_at_exit()
+{
+	const std::string &base = registry().export_path;
+
+	if (write_chrome_trace(base + ".json") &&
+	    write_prometheus_metrics(base + ".prom")) {
+		std::cout << "Trace written to " << base << ".json and "
+			  << base << ".prom" << std::endl;
+	}
+}
@@ -0,0 +1,84 @@
+/**
+ *
+ * @brief      Time spent in each stage of the request pipeline.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstdint>
+#include <string>
+
+/* Latest spans kept per thread */
+#define TRACE_RING_SIZE 4096
+
+/**
+ * @brief      Stages of the pipeline that are timed.
+ */
+enum TraceStage {
+	TRACE_DECODE,  /* Image file or video frame to pixels */
+	TRACE_ENCODE,  /* Resize and JPEG encoding of an upload */
+	TRACE_QUEUE,   /* Waiting for a server to take a request */
+	TRACE_NETWORK, /* Request sent until the answer is received */
+	TRACE_PARSE,   /* JSON answer to ApiResult */
+	TRACE_SEARCH,  /* Face gallery search */
+	TRACE_DRAW,    /* Boxes and labels */
+	TRACE_WRITE,   /* Result image to disk */
+	TRACE_STAGES
+};
+
+/**
+ * @brief      Monotonic time in nanoseconds.
+ */
+uint64_t trace_clock();
+
+/**
+ * @brief      Record a span of a stage.
+ *
+ *             The span goes to a ring buffer of the calling thread and
+ *             into the histogram of the stage. Nothing is locked or
+ *             allocated after the first span of a thread, so a span costs
+ *             a few tens of nanoseconds and tracing is always on.
+ */
+void trace_record(TraceStage stage, uint64_t start_ns, uint64_t end_ns);
+
+/**
+ * @brief      Time the enclosing scope as one span.
+ */
+class TraceSpan {
+public:
+	explicit TraceSpan(TraceStage stage)
+		: stage_(stage), start_(trace_clock())
+	{
+	}
+	~TraceSpan() { trace_record(stage_, start_, trace_clock()); }
+
+	TraceSpan(const TraceSpan &) = delete;
+	TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+	TraceStage stage_;
+	uint64_t start_;
+};
+
+/**
+ * @brief      Write the spans still in the ring buffers as a Chrome trace
+ *             (chrome://tracing or ui.perfetto.dev).
+ */
+bool write_chrome_trace(const std::string &path);
+
+/**
+ * @brief      Histograms of all stages since startup in the Prometheus text
+ *             format, as metric brainypi_stage_seconds.
+ */
+std::string prometheus_metrics();
+
+/**
+ * @brief      Write prometheus_metrics() to a file, e.g. for the textfile
+ *             collector of node_exporter.
+ */
+bool write_prometheus_metrics(const std::string &path);
+
+#endif
@@ -0,0 +1,251 @@
+/**
+ *
+ * @brief      Multi-object tracker giving detections stable identities.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#include <algorithm>
+#include <cmath>
+
+#include "tracker.hpp"
+
+float box_iou(const BoundingBox &a, const BoundingBox &b)
+{
+	float w = std::min(a.left + a.width, b.left + b.width) -
+		  std::max(a.left, b.left);
+	float h = std::min(a.top + a.height, b.top + b.height) -
+		  std::max(a.top, b.top);
+
+	if (w <= 0 || h <= 0) {
+		return 0;
+	}
+	float overlap = w * h;
+	return overlap / (a.width * a.height + b.width * b.height - overlap);
+}
+
+/**
+ * @brief      Box of a Kalman state, width and height kept positive.
+ */
+static BoundingBox state_box(const float pos[4])
+{
+	BoundingBox box;
+
+	box.width = std::max(pos[2], 1.0f);
+	box.height = std::max(pos[3], 1.0f);
+	box.left = pos[0] - box.width / 2;
+	box.top = pos[1] - box.height / 2;
+	return box;
+}
+
+void Tracker::init(State &state, const TrackInput &detection)
+{
+	const BoundingBox &box = detection.box;
+	float sp = 2 * options_.position_noise * box.height;
+	float sv = 10 * options_.velocity_noise * box.height;
+
+	state.track.id = next_id_++;
+	state.track.label = detection.label;
+	state.track.confidence = detection.confidence;
+	state.track.box = box;
+	state.track.hits = 1;
+	state.track.misses = 0;
+
+	state.pos[0] = box.left + box.width / 2;
+	state.pos[1] = box.top + box.height / 2;
+	state.pos[2] = box.width;
+	state.pos[3] = box.height;
+	for (int i = 0; i < 4; i++) {
+		state.vel[i] = 0;
+		state.cov[i][0] = sp * sp;
+		state.cov[i][1] = 0;
+		state.cov[i][2] = sv * sv;
+	}
+}
+
+void Tracker::predict()
+{
+	for (auto &state : tracks_) {
+		float h = std::max(state.pos[3], 1.0f);
+		float qp = options_.position_noise * h;
+		float qv = options_.velocity_noise * h;
+
+		/* x' = F x, P' = F P F^T + Q with F = [1 1; 0 1] */
+		for (int i = 0; i < 4; i++) {
+			float *c = state.cov[i];
+			state.pos[i] += state.vel[i];
+			c[0] += 2 * c[1] + c[2] + qp * qp;
+			c[1] += c[2];
+			c[2] += qv * qv;
+		}
+		state.track.box = state_box(state.pos);
+		state.track.misses++;
+	}
+
+	/* Drop tracks lost for too long */
+	tracks_.erase(std::remove_if(tracks_.begin(), tracks_.end(),
+				     [this](const State &state) {
+					     return state.track.misses >
+						    options_.max_age;
+				     }),
+		      tracks_.end());
+}
+
+void Tracker::correct(State &state, const TrackInput &detection)
+{
+	const BoundingBox &box = detection.box;
+	float z[4] = { box.left + box.width / 2, box.top + box.height / 2,
+		       box.width, box.height };
+	float r = options_.position_noise * std::max(state.pos[3], 1.0f);
+
+	/* H = [1 0], scalar innovation per coordinate */
+	for (int i = 0; i < 4; i++) {
+		float *c = state.cov[i];
+		float s = c[0] + r * r;
+		float k0 = c[0] / s;
+		float k1 = c[1] / s;
+		float y = z[i] - state.pos[i];
+
+		state.pos[i] += k0 * y;
+		state.vel[i] += k1 * y;
+		c[2] -= k1 * c[1];
+		c[0] *= 1 - k0;
+		c[1] *= 1 - k0;
+	}
+	state.track.box = state_box(state.pos);
+	state.track.confidence = detection.confidence;
+	state.track.hits++;
+	state.track.misses = 0;
+}
+
+/**
+ * @brief      Greedily pair the best candidates still free.
+ */
+void Tracker::assign(const std::vector<TrackInput> &detections)
+{
+	for (auto &c : candidates_) {
+		if (track_used_[c.track] || detection_used_[c.detection]) {
+			continue;
+		}
+		track_used_[c.track] = 1;
+		detection_used_[c.detection] = 1;
+		correct(tracks_[c.track], detections[c.detection]);
+	}
+}
+
+void Tracker::update(const std::vector<TrackInput> &detections)
+{
+	/* Detections by left edge, so each track only looks at the few
+	 * whose horizontal extent can overlap its box */
+	float max_width = 0;
+	order_.resize(detections.size());
+	for (int d = 0; d < (int)detections.size(); d++) {
+		order_[d] = d;
+		max_width = std::max(max_width, detections[d].box.width);
+	}
+	std::sort(order_.begin(), order_.end(), [&](int a, int b) {
+		return detections[a].box.left < detections[b].box.left;
+	});
+
+	candidates_.clear();
+	for (int t = 0; t < (int)tracks_.size(); t++) {
+		const Track &track = tracks_[t].track;
+		auto it = std::lower_bound(
+			order_.begin(), order_.end(),
+			track.box.left - max_width, [&](int d, float left) {
+				return detections[d].box.left < left;
+			});
+		for (; it != order_.end(); ++it) {
+			const TrackInput &detection = detections[*it];
+			if (detection.box.left >=
+			    track.box.left + track.box.width) {
+				break;
+			}
+			float overlap = box_iou(track.box, detection.box);
+			if (overlap >= options_.min_iou &&
+			    detection.label == track.label) {
+				candidates_.push_back({ overlap, t, *it });
+			}
+		}
+	}
+	std::sort(candidates_.begin(), candidates_.end(),
+		  [](const Candidate &a, const Candidate &b) {
+			  return a.iou > b.iou;
+		  });
+
+	track_used_.assign(tracks_.size(), 0);
+	detection_used_.assign(detections.size(), 0);
+	assign(detections);
+
+	/* Second chance by distance for what did not overlap enough, e.g.
+	 * a young track whose speed is not known yet after a long gap */
+	candidates_.clear();
+	for (int t = 0; t < (int)tracks_.size(); t++) {
+		if (track_used_[t]) {
+			continue;
+		}
+		const Track &track = tracks_[t].track;
+		float reach = options_.max_distance * track.box.height;
+		for (int d = 0; d < (int)detections.size(); d++) {
+			const TrackInput &detection = detections[d];
+			if (detection_used_[d]) {
+				continue;
+			}
+			float dx = detection.box.left + detection.box.width / 2 -
+				   tracks_[t].pos[0];
+			float dy = detection.box.top + detection.box.height / 2 -
+				   tracks_[t].pos[1];
+			float distance = std::sqrt(dx * dx + dy * dy);
+			if (distance < reach && detection.label == track.label) {
+				/* Closer is better, sorted like an overlap */
+				candidates_.push_back(
+					{ 1 - distance / reach, t, d });
+			}
+		}
+	}
+	std::sort(candidates_.begin(), candidates_.end(),
+		  [](const Candidate &a, const Candidate &b) {
+			  return a.iou > b.iou;
+		  });
+	assign(detections);
+
+	for (size_t d = 0; d < detections.size(); d++) {
+		if (!detection_used_[d]) {
+			tracks_.emplace_back();
+			init(tracks_.back(), detections[d]);
+		}
+	}
+}
+
+void Tracker::tracks(std::vector<Track> &out) const
+{
+	out.clear();
+	for (auto &state : tracks_) {
+		if (state.track.hits >= options_.min_hits) {
+			out.push_back(state.track);
+		}
+	}
+}
+
+void track_inputs(const ApiResult &result, float min_confidence,
+		  std::vector<TrackInput> &out)
+{
+	out.clear();
+	for (auto &object : result.objects) {
+		if (object.confidence >= min_confidence) {
+			out.push_back({ object.object, object.confidence,
+					object.box });
+		}
+	}
+	for (auto &face : result.faces) {
+		if (face.confidence >= min_confidence) {
+			out.push_back({ "face", face.confidence, face.box });
+		}
+	}
+	for (auto &embedding : result.embeddings) {
+		if (embedding.face.confidence >= min_confidence) {
+			out.push_back({ "face", embedding.face.confidence,
+					embedding.face.box });
+		}
+	}
+}
@@ -0,0 +1,139 @@
+/**
+ *
+ * @brief      Multi-object tracker giving detections stable identities.
+ *
+ * @author     ShunyaOS Team
+ * @date       2023
+ */
+#ifndef TRACKER_HPP
+#define TRACKER_HPP
+
+#include <string>
+#include <vector>
+
+#include "api_result.hpp"
+
+/**
+ * @brief      Tuning of the tracker, in frames and pixels.
+ */
+struct TrackerOptions {
+	float min_iou = 0.3f; /* Overlap for a detection to continue a track */
+	float max_distance = 1.0f; /* Else centre distance / box height */
+	int max_age = 45;     /* Frames a track survives without detection */
+	int min_hits = 1;     /* Detections before a track is reported */
+	float position_noise = 1.0f / 20; /* Measurement noise / box height */
+	float velocity_noise = 1.0f / 160; /* Motion change / box height */
+};
+
+/**
+ * @brief      One detection handed to the tracker.
+ */
+struct TrackInput {
+	std::string label; /* Only boxes with the same label are matched */
+	float confidence = 0;
+	BoundingBox box;
+};
+
+/**
+ * @brief      A tracked object.
+ */
+struct Track {
+	int id;		     /* Stable for the life of the track */
+	std::string label;
+	float confidence;    /* Of the last detection */
+	BoundingBox box;     /* Predicted for the current frame */
+	int hits = 0;	     /* Detections so far */
+	int misses = 0;	     /* Frames since the last detection */
+};
+
+/**
+ * @brief      SORT style tracker for boxes of /v1/detectobjects and
+ *             /v1/detectface.
+ *
+ *             Each track runs a constant velocity Kalman filter on the
+ *             centre and size of its box, with noise proportional to the
+ *             box height. Call predict() once for every frame and update()
+ *             for frames that have a result: detections are matched to
+ *             the predicted boxes greedily by decreasing intersection over
+ *             union, unmatched ones start new tracks and tracks without a
+ *             detection for max_age frames are dropped. In between two
+ *             results the predicted boxes follow the objects, so inference
+ *             can run at a fraction of the frame rate.
+ *
+ *             Not thread safe, one tracker per stream.
+ */
+class Tracker {
+public:
+	explicit Tracker(const TrackerOptions &options = TrackerOptions())
+		: options_(options)
+	{
+	}
+
+	/**
+	 * @brief      Advance all tracks by one frame.
+	 */
+	void predict();
+
+	/**
+	 * @brief      Correct the tracks with the detections of this frame.
+	 *
+	 * @param[in]  detections  Boxes in frame coordinates
+	 */
+	void update(const std::vector<TrackInput> &detections);
+
+	/**
+	 * @brief      Tracks confirmed by at least min_hits detections.
+	 */
+	void tracks(std::vector<Track> &out) const;
+
+	size_t size() const { return tracks_.size(); }
+	void clear() { tracks_.clear(); }
+
+private:
+	/* Kalman state of centre x, centre y, width and height */
+	struct State {
+		Track track;
+		float pos[4];
+		float vel[4];
+		float cov[4][3]; /* pos/pos, pos/vel, vel/vel of each */
+	};
+
+	void init(State &state, const TrackInput &detection);
+	void correct(State &state, const TrackInput &detection);
+	void assign(const std::vector<TrackInput> &detections);
+
+	TrackerOptions options_;
+	std::vector<State> tracks_;
+	int next_id_ = 1;
+
+	/* Scratch space of update() */
+	struct Candidate {
+		float iou; /* Or closeness on the second pass */
+		int track;
+		int detection;
+	};
+	std::vector<Candidate> candidates_;
+	std::vector<int> order_;
+	std::vector<char> track_used_;
+	std::vector<char> detection_used_;
+};
+
+/**
+ * @brief      Collect the boxes of a result as tracker input.
+ *
+ *             Objects keep their label, faces are labelled "face".
+ *
+ * @param[in]  result          Parsed /v1/detectobjects or /v1/detectface
+ *                             response, in frame coordinates
+ * @param[in]  min_confidence  Boxes below it are left out
+ * @param[out] out             Tracker input, cleared first
+ */
+void track_inputs(const ApiResult &result, float min_confidence,
+		  std::vector<TrackInput> &out);
+
+/**
+ * @brief      Intersection over union of two boxes, 0 if they are apart.
+ */
+float box_iou(const BoundingBox &a, const BoundingBox &b);
+
+#endif